@@ -0,0 +1,522 @@
+// Benchmark driver: runs reader/writer pairs of the copy binary over a sweep of file sizes, geometries,
+// transports and I/O backends, measures the hand-off latency of each transport, and prints JSON.
+
+#include "Options.h"
+#include "SharedMemoryTransport.h"
+#include "SocketTransport.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+    struct BenchOptions {
+        std::string copy = COPY_BINARY;
+        std::string directory = fs::temp_directory_path().string();
+        std::string output;
+        std::vector<std::size_t> sizes{256 * 1024 * 1024};
+        std::vector<std::size_t> chunkSizes{256 * 1024, 4 * 1024 * 1024};
+        std::vector<std::size_t> slotCounts{4, 16};
+        std::vector<std::string> transports{"shm", "unix", "tcp"};
+        std::vector<std::string> backends{"stream", "uring", "mmap"};
+        std::vector<std::string> caches{"cold", "warm"};
+        std::size_t repeat = 3;
+        int port = 47400;
+        bool handoff = true;
+    };
+
+    struct ProcessUsage {
+        double userSeconds = 0;
+        double systemSeconds = 0;
+        long voluntarySwitches = 0;
+        long involuntarySwitches = 0;
+    };
+
+    struct CopyRun {
+        std::string transport;
+        std::string io;
+        std::string cache;
+        std::size_t size = 0;
+        std::size_t chunkSize = 0;
+        std::size_t slotCount = 0;
+        std::size_t repeat = 0;
+        double seconds = 0;
+        ProcessUsage usage[2];
+    };
+
+    struct Handoff {
+        std::string transport;
+        std::size_t chunkSize = 0;
+        std::size_t slotCount = 0;
+        std::size_t chunks = 0;
+        // Microseconds from publishing a chunk to the consumer holding it
+        double percentiles[4] = {};
+    };
+
+    constexpr double HANDOFF_PERCENTILES[] = {0.5, 0.9, 0.99, 1.0};
+
+    std::vector<std::string> split(std::string_view value) {
+        std::vector<std::string> result;
+        std::size_t start = 0;
+        while (start <= value.size()) {
+            const std::size_t end = std::min(value.find(',', start), value.size());
+            if (end > start) {
+                result.emplace_back(value.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+        return result;
+    }
+
+    std::vector<std::size_t> splitSizes(std::string_view value) {
+        std::vector<std::size_t> result;
+        for (const std::string& item : split(value)) {
+            result.push_back(cp::parseSize(item));
+        }
+        return result;
+    }
+
+    std::string usage(std::string_view program) {
+        return "Usage: " + std::string(program) + " [options]\n"
+            "Options (lists are comma separated):\n"
+            "  --copy=<path>          copy binary to run (default " COPY_BINARY ")\n"
+            "  --dir=<path>           directory for the files and sockets (default the temp directory)\n"
+            "  --sizes=<sizes>        file sizes (default 256M)\n"
+            "  --chunk-sizes=<sizes>  chunk sizes (default 256K,4M)\n"
+            "  --slots=<counts>       slot counts (default 4,16)\n"
+            "  --transports=<list>    shm, unix, tcp (default all)\n"
+            "  --io=<list>            stream, uring, mmap (default all)\n"
+            "  --cache=<list>         cold: source evicted from the page cache first, warm: read first\n"
+            "                         (default both)\n"
+            "  --repeat=<n>           runs of every combination (default 3)\n"
+            "  --port=<port>          TCP port on 127.0.0.1 (default 47400)\n"
+            "  --no-handoff           skip the hand-off latency measurement\n"
+            "  --output=<file>        write the JSON there instead of stdout\n";
+    }
+
+    BenchOptions parseBenchOptions(int argc, char* argv[]) {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg = argv[i];
+            if (arg == "--no-handoff") {
+                options.handoff = false;
+                continue;
+            }
+            const std::size_t separator = arg.find('=');
+            if (!arg.starts_with("--") or separator == std::string_view::npos) {
+                throw std::invalid_argument("Unknown argument: " + std::string(arg));
+            }
+            const std::string_view name = arg.substr(0, separator);
+            const std::string_view value = arg.substr(separator + 1);
+
+            if (name == "--copy") {
+                options.copy = value;
+            } else if (name == "--dir") {
+                options.directory = value;
+            } else if (name == "--output") {
+                options.output = value;
+            } else if (name == "--sizes") {
+                options.sizes = splitSizes(value);
+            } else if (name == "--chunk-sizes") {
+                options.chunkSizes = splitSizes(value);
+            } else if (name == "--slots") {
+                options.slotCounts = splitSizes(value);
+            } else if (name == "--transports") {
+                options.transports = split(value);
+            } else if (name == "--io") {
+                options.backends = split(value);
+            } else if (name == "--cache") {
+                options.caches = split(value);
+            } else if (name == "--repeat") {
+                options.repeat = cp::parseSize(value);
+            } else if (name == "--port") {
+                options.port = static_cast<int>(cp::parseSize(value));
+            } else {
+                throw std::invalid_argument("Unknown option: " + std::string(name));
+            }
+        }
+        return options;
+    }
+
+    std::system_error failure(const std::string& what) {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+
+    // Incompressible, non-repeating content, the same for every run of a size
+    void createSource(const std::string& path, std::size_t size) {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw failure("Failed to create " + path);
+        }
+        std::vector<std::uint64_t> block(128 * 1024);
+        std::uint64_t state = 0x9E3779B97F4A7C15ull ^ size;
+        for (std::size_t written = 0; written < size;) {
+            for (std::uint64_t& word : block) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                word = state;
+            }
+            const std::size_t count = std::min(size - written, block.size() * sizeof(std::uint64_t));
+            if (write(fd, block.data(), count) != static_cast<ssize_t>(count)) {
+                close(fd);
+                throw failure("Failed to write " + path);
+            }
+            written += count;
+        }
+        fsync(fd);
+        close(fd);
+    }
+
+    // Cold: drops the clean pages of the file from the page cache. Warm: reads it once.
+    void prepareCache(const std::string& path, const std::string& cache) {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw failure("Failed to open " + path);
+        }
+        if (cache == "cold") {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        } else {
+            std::vector<char> buffer(1024 * 1024);
+            while (read(fd, buffer.data(), buffer.size()) > 0) {
+            }
+        }
+        close(fd);
+    }
+
+    bool sameContent(const std::string& first, const std::string& second) {
+        std::ifstream a(first, std::ios::binary);
+        std::ifstream b(second, std::ios::binary);
+        std::vector<char> left(1024 * 1024);
+        std::vector<char> right(left.size());
+        while (a and b) {
+            a.read(left.data(), static_cast<std::streamsize>(left.size()));
+            b.read(right.data(), static_cast<std::streamsize>(right.size()));
+            if (a.gcount() != b.gcount() or std::memcmp(left.data(), right.data(), static_cast<std::size_t>(a.gcount())) != 0) {
+                return false;
+            }
+        }
+        return a.eof() and b.eof();
+    }
+
+    pid_t spawn(const std::string& program, const std::vector<std::string>& arguments, const std::string& log) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            throw failure("Failed to fork");
+        }
+        if (pid == 0) {
+            const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd >= 0) {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+            }
+            std::vector<char*> argv{const_cast<char*>(program.c_str())};
+            for (const std::string& argument : arguments) {
+                argv.push_back(const_cast<char*>(argument.c_str()));
+            }
+            argv.push_back(nullptr);
+            execv(program.c_str(), argv.data());
+            _exit(127);
+        }
+        return pid;
+    }
+
+    // Waits for the process; false if it failed
+    bool reap(pid_t pid, ProcessUsage& usage) {
+        int status = 0;
+        rusage resources{};
+        if (wait4(pid, &status, 0, &resources) != pid) {
+            throw failure("Failed to wait for a copy process");
+        }
+        usage.userSeconds = resources.ru_utime.tv_sec + resources.ru_utime.tv_usec / 1e6;
+        usage.systemSeconds = resources.ru_stime.tv_sec + resources.ru_stime.tv_usec / 1e6;
+        usage.voluntarySwitches = resources.ru_nvcsw;
+        usage.involuntarySwitches = resources.ru_nivcsw;
+        return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+    }
+
+    std::string endpoint(const BenchOptions& options, const std::string& transport) {
+        if (transport == "unix") {
+            return options.directory + "/copy-bench.sock";
+        }
+        if (transport == "tcp") {
+            return "127.0.0.1:" + std::to_string(options.port);
+        }
+        return "copy-bench";
+    }
+
+    CopyRun runCopy(const BenchOptions& options, CopyRun run, const std::string& source) {
+        const std::string target = options.directory + "/copy-bench.target";
+        fs::remove(target);
+        prepareCache(source, run.cache);
+
+        // Every run streams through the transport with exactly the geometry in the matrix
+        const std::vector<std::string> arguments{
+            "--no-offload", "--no-tune", "--transport=" + run.transport, "--io=" + run.io,
+            "--chunk-size=" + std::to_string(run.chunkSize), "--slots=" + std::to_string(run.slotCount),
+            source, target, endpoint(options, run.transport)
+        };
+
+        const auto started = std::chrono::steady_clock::now();
+        const pid_t first = spawn(options.copy, arguments, options.directory + "/copy-bench.1.log");
+        const pid_t second = spawn(options.copy, arguments, options.directory + "/copy-bench.2.log");
+        const bool succeeded = reap(first, run.usage[0]) & reap(second, run.usage[1]);
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        if (!succeeded or !sameContent(source, target)) {
+            throw std::runtime_error("Copy failed for " + run.transport + "/" + run.io + ", see " + options.directory + "/copy-bench.*.log");
+        }
+        fs::remove(target);
+        return run;
+    }
+
+    std::uint64_t nowNanoseconds() {
+        timespec time{};
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<std::uint64_t>(time.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(time.tv_nsec);
+    }
+
+    // One end of the hand-off measurement, in a child process. The producer stamps every chunk
+    // with the time it publishes it; the consumer writes the percentiles of the delays to fd.
+    void handoffSide(const BenchOptions& options, const Handoff& handoff, int fd) {
+        const cp::Geometry geometry{handoff.chunkSize, handoff.slotCount};
+        std::unique_ptr<cp::IDataTransport> transport;
+        cp::EStrategy strategy = cp::EStrategy::E_Read;
+        if (handoff.transport == "shm") {
+            auto shared = std::make_unique<cp::SharedMemoryTransport>(endpoint(options, handoff.transport), geometry);
+            strategy = shared->strategy();
+            transport = std::move(shared);
+        } else {
+            const cp::ESocketFamily family = handoff.transport == "unix" ? cp::ESocketFamily::E_Unix : cp::ESocketFamily::E_Tcp;
+            auto socket = std::make_unique<cp::SocketTransport>(family, endpoint(options, handoff.transport), geometry);
+            strategy = socket->strategy();
+            transport = std::move(socket);
+        }
+
+        if (strategy == cp::EStrategy::E_Read) {
+            transport->setTotalSize(std::nullopt);
+            transport->offerLocalFile(std::nullopt);
+            for (std::size_t index = 0; index < handoff.chunks; ++index) {
+                std::span<char> buffer = transport->getBuffer();
+                const std::uint64_t stamp = nowNanoseconds();
+                std::memcpy(buffer.data(), &stamp, sizeof(stamp));
+                transport->sendData(buffer);
+            }
+            transport->finish();
+            return;
+        }
+
+        transport->offeredLocalFile();
+        std::vector<double> delays;
+        delays.reserve(handoff.chunks);
+        while (!transport->hasFinished()) {
+            std::span<const char> buffer = transport->receiveData();
+            if (buffer.data() == nullptr) {
+                continue;
+            }
+            const std::uint64_t received = nowNanoseconds();
+            std::uint64_t stamp = 0;
+            std::memcpy(&stamp, buffer.data(), sizeof(stamp));
+            delays.push_back((received - stamp) / 1000.0);
+            transport->releaseData();
+        }
+
+        std::sort(delays.begin(), delays.end());
+        double percentiles[4] = {};
+        for (std::size_t index = 0; index < 4 and !delays.empty(); ++index) {
+            percentiles[index] = delays[static_cast<std::size_t>(HANDOFF_PERCENTILES[index] * (delays.size() - 1))];
+        }
+        if (write(fd, percentiles, sizeof(percentiles)) != sizeof(percentiles)) {
+            throw failure("Failed to report the hand-off delays");
+        }
+    }
+
+    Handoff measureHandoff(const BenchOptions& options, Handoff handoff) {
+        // Enough chunks for stable percentiles without moving gigabytes through a socket
+        handoff.chunks = std::clamp<std::size_t>(256 * 1024 * 1024 / handoff.chunkSize, 200, 10000);
+
+        int results[2];
+        if (pipe(results) != 0) {
+            throw failure("Failed to create a pipe");
+        }
+        pid_t pids[2];
+        for (pid_t& pid : pids) {
+            pid = fork();
+            if (pid < 0) {
+                throw failure("Failed to fork");
+            }
+            if (pid == 0) {
+                close(results[0]);
+                try {
+                    handoffSide(options, handoff, results[1]);
+                } catch (const std::exception& ex) {
+                    std::cerr << "Hand-off over " << handoff.transport << " failed: " << ex.what() << std::endl;
+                    _exit(1);
+                }
+                _exit(0);
+            }
+        }
+        close(results[1]);
+
+        ProcessUsage usage;
+        const bool succeeded = reap(pids[0], usage) & reap(pids[1], usage);
+        const bool reported = read(results[0], handoff.percentiles, sizeof(handoff.percentiles)) == sizeof(handoff.percentiles);
+        close(results[0]);
+        if (!succeeded or !reported) {
+            throw std::runtime_error("Hand-off measurement over " + handoff.transport + " failed");
+        }
+        return handoff;
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values.empty() ? 0 : values[values.size() / 2];
+    }
+
+    std::string quote(std::string_view value) {
+        std::string result = "\"";
+        for (char c : value) {
+            if (c == '"' or c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    void writeUsage(std::ostream& out, const ProcessUsage& usage) {
+        out << "{\"user_s\": " << usage.userSeconds << ", \"system_s\": " << usage.systemSeconds
+            << ", \"voluntary_switches\": " << usage.voluntarySwitches
+            << ", \"involuntary_switches\": " << usage.involuntarySwitches << "}";
+    }
+
+    void writeJson(std::ostream& out, const std::vector<CopyRun>& runs, const std::vector<Handoff>& handoffs) {
+        utsname system{};
+        uname(&system);
+        out << "{\n  \"host\": {\"kernel\": " << quote(system.release) << ", \"machine\": " << quote(system.machine)
+            << ", \"cpus\": " << std::thread::hardware_concurrency() << ", \"timestamp\": " << std::time(nullptr) << "},\n";
+
+        auto configuration = [](const CopyRun& run) {
+            std::ostringstream key;
+            key << "\"transport\": " << quote(run.transport) << ", \"io\": " << quote(run.io) << ", \"cache\": " << quote(run.cache)
+                << ", \"size\": " << run.size << ", \"chunk_size\": " << run.chunkSize << ", \"slots\": " << run.slotCount;
+            return key.str();
+        };
+
+        out << "  \"runs\": [";
+        std::map<std::string, std::vector<double>> throughputs;
+        std::vector<std::string> order;
+        for (std::size_t index = 0; index < runs.size(); ++index) {
+            const CopyRun& run = runs[index];
+            const double gigabytes = run.size / run.seconds / 1e9;
+            const std::string key = configuration(run);
+            if (throughputs[key].empty()) {
+                order.push_back(key);
+            }
+            throughputs[key].push_back(gigabytes);
+
+            out << (index == 0 ? "\n" : ",\n") << "    {" << key << ", \"repeat\": " << run.repeat
+                << ", \"seconds\": " << run.seconds << ", \"gb_per_s\": " << gigabytes << ", \"processes\": [";
+            writeUsage(out, run.usage[0]);
+            out << ", ";
+            writeUsage(out, run.usage[1]);
+            out << "]}";
+        }
+        out << "\n  ],\n  \"summary\": [";
+        for (std::size_t index = 0; index < order.size(); ++index) {
+            out << (index == 0 ? "\n" : ",\n") << "    {" << order[index] << ", \"median_gb_per_s\": " << median(throughputs[order[index]]) << "}";
+        }
+        out << "\n  ],\n  \"handoff\": [";
+        for (std::size_t index = 0; index < handoffs.size(); ++index) {
+            const Handoff& handoff = handoffs[index];
+            out << (index == 0 ? "\n" : ",\n") << "    {\"transport\": " << quote(handoff.transport)
+                << ", \"chunk_size\": " << handoff.chunkSize << ", \"slots\": " << handoff.slotCount << ", \"chunks\": " << handoff.chunks
+                << ", \"p50_us\": " << handoff.percentiles[0] << ", \"p90_us\": " << handoff.percentiles[1]
+                << ", \"p99_us\": " << handoff.percentiles[2] << ", \"max_us\": " << handoff.percentiles[3] << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    try {
+        options = parseBenchOptions(argc, argv);
+    } catch (const std::invalid_argument& ex) {
+        std::cerr << "Error: " << ex.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::vector<CopyRun> runs;
+        for (std::size_t size : options.sizes) {
+            const std::string source = options.directory + "/copy-bench-" + std::to_string(size) + ".source";
+            std::cerr << "Creating a source file of " << size << " bytes" << std::endl;
+            createSource(source, size);
+
+            for (const std::string& transport : options.transports) {
+                for (const std::string& io : options.backends) {
+                    for (std::size_t chunkSize : options.chunkSizes) {
+                        for (std::size_t slotCount : options.slotCounts) {
+                            for (const std::string& cache : options.caches) {
+                                for (std::size_t repeat = 0; repeat < options.repeat; ++repeat) {
+                                    CopyRun run{transport, io, cache, size, chunkSize, slotCount, repeat, 0, {}};
+                                    runs.push_back(runCopy(options, run, source));
+                                    std::cerr << transport << " " << io << " " << cache << " chunk " << chunkSize << " slots " << slotCount
+                                        << ": " << size / runs.back().seconds / 1e9 << " GB/s" << std::endl;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            fs::remove(source);
+        }
+
+        std::vector<Handoff> handoffs;
+        if (options.handoff) {
+            for (const std::string& transport : options.transports) {
+                for (std::size_t chunkSize : options.chunkSizes) {
+                    for (std::size_t slotCount : options.slotCounts) {
+                        handoffs.push_back(measureHandoff(options, Handoff{transport, chunkSize, slotCount}));
+                    }
+                }
+            }
+        }
+
+        if (options.output.empty()) {
+            writeJson(std::cout, runs, handoffs);
+        } else {
+            std::ofstream file(options.output);
+            writeJson(file, runs, handoffs);
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "Checkpoint.h"
+#include "Checksum.h"
+#include "Constants.h"
+#include "Durability.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+namespace cp {
+
+    namespace {
+
+        std::system_error failure(const std::string& what) {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        constexpr std::uint32_t CHECKPOINT_MAGIC = 0x43504b54; // "CPKT"
+        constexpr std::uint32_t CHECKPOINT_VERSION = 1;
+        constexpr std::uint64_t UNKNOWN_SIZE = ~std::uint64_t{0};
+        // Read back in pieces this large when verifying a prefix
+        constexpr std::size_t VERIFY_BUFFER_SIZE = 4 * 1024 * 1024;
+
+        // On-disk record, in host byte order; the target is resumed on the host that wrote it
+        struct Record {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint64_t sourceSize;
+            std::uint64_t offset;
+            std::uint32_t checksum;
+            // CRC32C of the fields above
+            std::uint32_t recordChecksum;
+        };
+
+        std::uint32_t recordChecksum(const Record& record) {
+            return crc32c(0, std::span<const char>(reinterpret_cast<const char*>(&record), offsetof(Record, recordChecksum)));
+        }
+
+        std::optional<Record> readRecord(const std::string& path) {
+            const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return std::nullopt;
+            }
+            Record record{};
+            const ssize_t result = pread(fd, &record, sizeof(record), 0);
+            close(fd);
+            if (result != static_cast<ssize_t>(sizeof(record)) or record.magic != CHECKPOINT_MAGIC
+                or record.version != CHECKPOINT_VERSION or record.recordChecksum != recordChecksum(record)) {
+                return std::nullopt;
+            }
+            return record;
+        }
+
+    } // namespace
+
+    Checkpoint::Checkpoint(const std::string& target, std::optional<std::uint64_t> sourceSize)
+        : target_(std::filesystem::absolute(target).string())
+        , path_(target_ + ".checkpoint")
+        , sourceSize_(sourceSize)
+        , saved_(0) {
+    }
+
+    Checkpoint::Progress Checkpoint::verify(const std::function<void(std::uint64_t)>& progress) {
+        const std::optional<Record> record = readRecord(path_);
+        if (!record or !sourceSize_ or record->sourceSize != *sourceSize_ or record->offset > *sourceSize_) {
+            return {};
+        }
+
+        const int fd = open(target_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return {};
+        }
+        posix_fadvise(fd, 0, static_cast<off_t>(record->offset), POSIX_FADV_SEQUENTIAL);
+
+        std::vector<char> buffer(VERIFY_BUFFER_SIZE);
+        std::uint32_t checksum = 0;
+        std::uint64_t offset = 0;
+        while (offset < record->offset) {
+            const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), record->offset - offset));
+            const ssize_t result = pread(fd, buffer.data(), length, static_cast<off_t>(offset));
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            // Shorter than recorded: someone truncated it
+            if (result <= 0) {
+                break;
+            }
+            checksum = crc32c(checksum, std::span<const char>(buffer.data(), static_cast<std::size_t>(result)));
+            offset += static_cast<std::uint64_t>(result);
+            progress(offset);
+        }
+        close(fd);
+
+        if (offset != record->offset or checksum != record->checksum) {
+            return {};
+        }
+        saved_ = record->offset;
+        return {record->offset, record->checksum};
+    }
+
+    bool Checkpoint::due(std::uint64_t offset) const {
+        return offset - std::min(offset, saved_) >= CHECKPOINT_INTERVAL;
+    }
+
+    void Checkpoint::save(Progress progress) {
+        Record record{CHECKPOINT_MAGIC, CHECKPOINT_VERSION, sourceSize_.value_or(UNKNOWN_SIZE), progress.offset, progress.checksum, 0};
+        record.recordChecksum = recordChecksum(record);
+
+        // Written aside and renamed over the old one, so a crash leaves either of them whole
+        const std::string temporary = path_ + ".tmp";
+        const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw failure("Failed to create checkpoint " + temporary);
+        }
+        const bool written = write(fd, &record, sizeof(record)) == static_cast<ssize_t>(sizeof(record)) and fdatasync(fd) == 0;
+        const int error = errno;
+        close(fd);
+        if (!written) {
+            errno = error;
+            throw failure("Failed to write checkpoint " + temporary);
+        }
+        if (std::rename(temporary.c_str(), path_.c_str()) != 0) {
+            throw failure("Failed to replace checkpoint " + path_);
+        }
+        syncDirectory(std::filesystem::path(path_).parent_path().string());
+        saved_ = progress.offset;
+    }
+
+    void Checkpoint::remove() {
+        if (unlink(path_.c_str()) != 0 and errno != ENOENT) {
+            throw failure("Failed to remove checkpoint " + path_);
+        }
+    }
+
+} // namespace cp
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+namespace cp {
+
+    // Progress of a copy into a target file, kept next to it in <target>.checkpoint so that a copy
+    // that died can go on where it stopped. Only a durable prefix of the target is ever recorded.
+    class Checkpoint {
+    public:
+        struct Progress {
+            // Bytes at the start of the target, and their CRC32C
+            std::uint64_t offset = 0;
+            std::uint32_t checksum = 0;
+        };
+
+        // For a copy of a source of sourceSize bytes, if known
+        Checkpoint(const std::string& target, std::optional<std::uint64_t> sourceSize);
+
+        // Progress recorded by a previous copy of the same size that the target still holds: the
+        // prefix is read back and checksummed, reporting the bytes read to progress. Nothing if
+        // there is no checkpoint, it is for another size, or the prefix changed since.
+        Progress verify(const std::function<void(std::uint64_t)>& progress);
+
+        // Whether CHECKPOINT_INTERVAL bytes were written since the last save, or the verified prefix
+        bool due(std::uint64_t offset) const;
+
+        // Records progress, whose prefix has to be durable already. Replaces the checkpoint
+        // atomically and syncs it.
+        void save(Progress progress);
+
+        // The copy is complete, nothing is left to resume
+        void remove();
+
+        const std::string& path() const {
+            return path_;
+        }
+
+    private:
+        std::string target_;
+        std::string path_;
+        std::optional<std::uint64_t> sourceSize_;
+        std::uint64_t saved_;
+    };
+
+} // namespace cp
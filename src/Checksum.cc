@@ -0,0 +1,142 @@
+#include "Checksum.h"
+
+#include <nmmintrin.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace cp {
+
+    namespace {
+
+        // Reflected Castagnoli polynomial
+        constexpr std::uint32_t POLYNOMIAL = 0x82F63B78;
+
+        // Bytes per stream in the interleaved loop; three streams hide the latency of crc32
+        constexpr std::size_t BLOCK_SIZE = 8192;
+
+        constexpr std::array<std::uint32_t, 256> makeTable() {
+            std::array<std::uint32_t, 256> table{};
+            for (std::uint32_t index = 0; index < table.size(); ++index) {
+                std::uint32_t crc = index;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+                }
+                table[index] = crc;
+            }
+            return table;
+        }
+
+        constexpr std::array<std::uint32_t, 256> TABLE = makeTable();
+
+        // a * b modulo the polynomial, bit-reflected as in the checksum itself
+        std::uint32_t multiply(std::uint32_t a, std::uint32_t b) {
+            std::uint32_t product = 0;
+            for (std::uint32_t mask = 1u << 31; mask != 0; mask >>= 1) {
+                if (a & mask) {
+                    product ^= b;
+                }
+                b = b & 1 ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+            }
+            return product;
+        }
+
+        // x^(8 * length) modulo the polynomial, by squaring
+        std::uint32_t shiftOperator(std::uint64_t length) {
+            // powers[k] = x^(2^k), enough for any 64 bit length in bytes
+            static const std::array<std::uint32_t, 67> powers = [] {
+                std::array<std::uint32_t, 67> result{};
+                result[0] = 1u << 30;
+                for (std::size_t k = 1; k < result.size(); ++k) {
+                    result[k] = multiply(result[k - 1], result[k - 1]);
+                }
+                return result;
+            }();
+
+            std::uint32_t shift = 1u << 31;
+            for (std::size_t k = 3; length != 0; length >>= 1, ++k) {
+                if (length & 1) {
+                    shift = multiply(powers[k], shift);
+                }
+            }
+            return shift;
+        }
+
+        // The update functions work on the inverted state
+        std::uint32_t updateTable(std::uint32_t state, const unsigned char* data, std::size_t size) {
+            for (std::size_t index = 0; index < size; ++index) {
+                state = TABLE[(state ^ data[index]) & 0xFF] ^ (state >> 8);
+            }
+            return state;
+        }
+
+        __attribute__((target("sse4.2")))
+        std::uint32_t updateHardware(std::uint32_t state, const unsigned char* data, std::size_t size) {
+            static const std::uint32_t blockShift = shiftOperator(BLOCK_SIZE);
+
+            std::uint64_t first = state;
+            while (size >= 3 * BLOCK_SIZE) {
+                std::uint64_t second = 0xFFFFFFFF;
+                std::uint64_t third = 0xFFFFFFFF;
+                for (std::size_t offset = 0; offset < BLOCK_SIZE; offset += 8) {
+                    std::uint64_t words[3];
+                    std::memcpy(&words[0], data + offset, 8);
+                    std::memcpy(&words[1], data + BLOCK_SIZE + offset, 8);
+                    std::memcpy(&words[2], data + 2 * BLOCK_SIZE + offset, 8);
+                    first = _mm_crc32_u64(first, words[0]);
+                    second = _mm_crc32_u64(second, words[1]);
+                    third = _mm_crc32_u64(third, words[2]);
+                }
+
+                // Join the three streams as if they had been one
+                std::uint32_t crc = ~static_cast<std::uint32_t>(first);
+                crc = multiply(blockShift, crc) ^ ~static_cast<std::uint32_t>(second);
+                crc = multiply(blockShift, crc) ^ ~static_cast<std::uint32_t>(third);
+                first = ~crc;
+
+                data += 3 * BLOCK_SIZE;
+                size -= 3 * BLOCK_SIZE;
+            }
+
+            for (; size >= 8; data += 8, size -= 8) {
+                std::uint64_t word;
+                std::memcpy(&word, data, 8);
+                first = _mm_crc32_u64(first, word);
+            }
+            for (; size > 0; ++data, --size) {
+                first = _mm_crc32_u8(static_cast<std::uint32_t>(first), *data);
+            }
+            return static_cast<std::uint32_t>(first);
+        }
+
+        using Update = std::uint32_t (*)(std::uint32_t, const unsigned char*, std::size_t);
+
+        Update selectUpdate() {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.2") ? updateHardware : updateTable;
+        }
+
+    } // namespace
+
+    std::uint32_t crc32c(std::uint32_t crc, std::span<const char> data) {
+        static const Update update = selectUpdate();
+        return ~update(~crc, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    }
+
+    std::uint32_t crc32cCombine(std::uint32_t first, std::uint32_t second, std::uint64_t secondLength) {
+        return multiply(shiftOperator(secondLength), first) ^ second;
+    }
+
+    std::uint32_t crc32cZeros(std::uint64_t length) {
+        // Zeros only shift the initial register
+        return ~multiply(shiftOperator(length), 0xFFFFFFFF);
+    }
+
+    std::string formatChecksum(std::uint32_t crc) {
+        char text[16];
+        std::snprintf(text, sizeof(text), "%08x", crc);
+        return std::string("crc32c:") + text;
+    }
+
+} // namespace cp
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace cp {
+
+    // CRC32C (Castagnoli) of data, continuing from crc; crc32c(0, data) starts a new checksum.
+    // Uses the SSE4.2 crc32 instruction when the CPU has it, a table otherwise.
+    std::uint32_t crc32c(std::uint32_t crc, std::span<const char> data);
+
+    // Checksum of A followed by B from the checksums of A and B and the length of B,
+    // without touching the data again
+    std::uint32_t crc32cCombine(std::uint32_t first, std::uint32_t second, std::uint64_t secondLength);
+
+    // Checksum of length zero bytes, for holes that are skipped instead of read
+    std::uint32_t crc32cZeros(std::uint64_t length);
+
+    // "crc32c:0123abcd"
+    std::string formatChecksum(std::uint32_t crc);
+
+} // namespace cp
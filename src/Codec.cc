@@ -0,0 +1,365 @@
+#include "Codec.h"
+#include "Constants.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace cp {
+
+    namespace {
+
+        // A sequence is a token, literals and a match: the token holds the literal length in its high
+        // and the match length minus MIN_MATCH in its low four bits, 15 meaning that bytes of 255 and
+        // one below follow. The match is a 16 bit little endian offset back into the output and follows
+        // the literals; the last sequence has literals only and ends the input.
+        constexpr std::size_t MIN_MATCH = 4;
+        constexpr std::size_t MAX_OFFSET = 65535;
+        constexpr unsigned LENGTH_MASK = 15;
+
+        // The last bytes are always literals, and no match starts in the last MATCH_LIMIT bytes,
+        // so that matching can compare whole words
+        constexpr std::size_t LAST_LITERALS = 5;
+        constexpr std::size_t MATCH_LIMIT = 12;
+
+        // Block the decoder copies at once, overwriting past the end of shorter copies
+        constexpr std::size_t WILD_COPY = 16;
+
+        constexpr unsigned HASH_BITS = 14;
+        // After 2^SKIP_TRIGGER positions without a match the search takes bigger steps,
+        // which is what makes incompressible data cheap
+        constexpr unsigned SKIP_TRIGGER = 6;
+
+        using Byte = unsigned char;
+
+        std::uint32_t read32(const Byte* data) {
+            std::uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint64_t read64(const Byte* data) {
+            std::uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint32_t hash(std::uint32_t sequence) {
+            return (sequence * 2654435761U) >> (32 - HASH_BITS);
+        }
+
+        // Number of equal bytes at left and right, reading no further than limit on the left
+        std::size_t commonLength(const Byte* left, const Byte* right, const Byte* limit) {
+            const Byte* start = left;
+            if constexpr (std::endian::native == std::endian::little) {
+                while (left + sizeof(std::uint64_t) <= limit) {
+                    const std::uint64_t difference = read64(left) ^ read64(right);
+                    if (difference != 0) {
+                        return static_cast<std::size_t>(left - start) + std::countr_zero(difference) / 8;
+                    }
+                    left += sizeof(std::uint64_t);
+                    right += sizeof(std::uint64_t);
+                }
+            }
+            while (left < limit and *left == *right) {
+                ++left;
+                ++right;
+            }
+            return static_cast<std::size_t>(left - start);
+        }
+
+        // Bytes needed to extend a length field beyond LENGTH_MASK
+        std::size_t extensionSize(std::size_t length) {
+            return length < LENGTH_MASK ? 0 : (length - LENGTH_MASK) / 255 + 1;
+        }
+
+        Byte* writeExtension(Byte* out, std::size_t length) {
+            if (length < LENGTH_MASK) {
+                return out;
+            }
+            for (length -= LENGTH_MASK; length >= 255; length -= 255) {
+                *out++ = 255;
+            }
+            *out++ = static_cast<Byte>(length);
+            return out;
+        }
+
+        std::size_t readExtension(const Byte*& in, const Byte* end) {
+            std::size_t length = 0;
+            Byte byte = 255;
+            while (byte == 255) {
+                if (in == end) {
+                    throw std::runtime_error("Corrupt compressed chunk: truncated length");
+                }
+                byte = *in++;
+                length += byte;
+            }
+            return length;
+        }
+
+        // Appends a sequence, with matchLength 0 for the last one; nullptr if it does not fit
+        // The input may be read up to literalsEnd.
+        Byte* writeSequence(Byte* out, const Byte* outEnd, const Byte* literals, const Byte* literalsEnd, std::size_t literalLength,
+                            std::size_t offset, std::size_t matchLength) {
+            const std::size_t match = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+            const std::size_t needed = 1 + extensionSize(literalLength) + literalLength
+                + (matchLength > 0 ? 2 + extensionSize(match) : 0);
+            if (static_cast<std::size_t>(outEnd - out) < needed) {
+                return nullptr;
+            }
+
+            *out++ = static_cast<Byte>((std::min<std::size_t>(literalLength, LENGTH_MASK) << 4)
+                                       | std::min<std::size_t>(match, LENGTH_MASK));
+            out = writeExtension(out, literalLength);
+            if (literalLength <= WILD_COPY and static_cast<std::size_t>(outEnd - out) >= WILD_COPY + 2 + extensionSize(match)
+                and static_cast<std::size_t>(literalsEnd - literals) >= WILD_COPY) {
+                std::memcpy(out, literals, WILD_COPY);
+            } else {
+                std::memcpy(out, literals, literalLength);
+            }
+            out += literalLength;
+            if (matchLength > 0) {
+                *out++ = static_cast<Byte>(offset);
+                *out++ = static_cast<Byte>(offset >> 8);
+                out = writeExtension(out, match);
+            }
+            return out;
+        }
+
+    } // namespace
+
+    const char* toString(ECodec codec) {
+        switch (codec) {
+            case ECodec::E_None: return "none";
+            case ECodec::E_Lz: return "lz";
+        }
+        return "unknown";
+    }
+
+    std::size_t compress(std::span<const char> input, std::span<char> output) {
+        const Byte* const begin = reinterpret_cast<const Byte*>(input.data());
+        const Byte* const end = begin + input.size();
+        Byte* out = reinterpret_cast<Byte*>(output.data());
+        const Byte* const outEnd = out + output.size();
+
+        const Byte* anchor = begin;
+        if (input.size() > MATCH_LIMIT) {
+            // Positions relative to begin; a stale or empty entry is only a candidate that fails to match
+            std::uint32_t table[std::size_t{1} << HASH_BITS] = {};
+            const Byte* const matchLimit = end - MATCH_LIMIT;
+            const Byte* const compareLimit = end - LAST_LITERALS;
+
+            const Byte* in = begin + 1;
+            while (true) {
+                const Byte* match = nullptr;
+                std::size_t attempts = std::size_t{1} << SKIP_TRIGGER;
+                for (std::size_t step = 1; in <= matchLimit; step = attempts++ >> SKIP_TRIGGER) {
+                    const std::uint32_t sequence = read32(in);
+                    std::uint32_t& entry = table[hash(sequence)];
+                    const Byte* candidate = begin + entry;
+                    entry = static_cast<std::uint32_t>(in - begin);
+                    if (candidate < in and static_cast<std::size_t>(in - candidate) <= MAX_OFFSET and read32(candidate) == sequence) {
+                        match = candidate;
+                        break;
+                    }
+                    in += step;
+                }
+                if (match == nullptr) {
+                    break;
+                }
+
+                // The match may start before the position that found it
+                while (in > anchor and match > begin and in[-1] == match[-1]) {
+                    --in;
+                    --match;
+                }
+                const std::size_t length = MIN_MATCH + commonLength(in + MIN_MATCH, match + MIN_MATCH, compareLimit);
+
+                out = writeSequence(out, outEnd, anchor, end, static_cast<std::size_t>(in - anchor),
+                                    static_cast<std::size_t>(in - match), length);
+                if (out == nullptr) {
+                    return 0;
+                }
+                in += length;
+                anchor = in;
+                if (in > matchLimit) {
+                    break;
+                }
+                // Keeps the table current inside long matches
+                table[hash(read32(in - 2))] = static_cast<std::uint32_t>(in - 2 - begin);
+            }
+        }
+
+        out = writeSequence(out, outEnd, anchor, end, static_cast<std::size_t>(end - anchor), 0, 0);
+        if (out == nullptr) {
+            return 0;
+        }
+        return static_cast<std::size_t>(out - reinterpret_cast<Byte*>(output.data()));
+    }
+
+    void decompress(std::span<const char> input, std::span<char> output) {
+        const Byte* in = reinterpret_cast<const Byte*>(input.data());
+        const Byte* const end = in + input.size();
+        Byte* const begin = reinterpret_cast<Byte*>(output.data());
+        Byte* out = begin;
+        Byte* const outEnd = begin + output.size();
+
+        while (true) {
+            if (in == end) {
+                throw std::runtime_error("Corrupt compressed chunk: missing sequence");
+            }
+            const Byte token = *in++;
+
+            std::size_t literalLength = token >> 4;
+            if (literalLength == LENGTH_MASK) {
+                literalLength += readExtension(in, end);
+            }
+            if (literalLength > static_cast<std::size_t>(end - in) or literalLength > static_cast<std::size_t>(outEnd - out)) {
+                throw std::runtime_error("Corrupt compressed chunk: literals out of bounds");
+            }
+            // Short runs are copied as one whole block where both sides have room for it
+            if (literalLength <= WILD_COPY and static_cast<std::size_t>(end - in) >= WILD_COPY
+                and static_cast<std::size_t>(outEnd - out) >= WILD_COPY) {
+                std::memcpy(out, in, WILD_COPY);
+            } else {
+                std::memcpy(out, in, literalLength);
+            }
+            in += literalLength;
+            out += literalLength;
+            if (in == end) {
+                break;
+            }
+
+            if (end - in < 2) {
+                throw std::runtime_error("Corrupt compressed chunk: truncated offset");
+            }
+            const std::size_t offset = in[0] | (std::size_t{in[1]} << 8);
+            in += 2;
+            if (offset == 0 or offset > static_cast<std::size_t>(out - begin)) {
+                throw std::runtime_error("Corrupt compressed chunk: offset out of bounds");
+            }
+            std::size_t matchLength = token & LENGTH_MASK;
+            if (matchLength == LENGTH_MASK) {
+                matchLength += readExtension(in, end);
+            }
+            matchLength += MIN_MATCH;
+            if (matchLength > static_cast<std::size_t>(outEnd - out)) {
+                throw std::runtime_error("Corrupt compressed chunk: match out of bounds");
+            }
+
+            const Byte* source = out - offset;
+            if (offset >= WILD_COPY and static_cast<std::size_t>(outEnd - out) >= matchLength + WILD_COPY) {
+                for (std::size_t copied = 0; copied < matchLength; copied += WILD_COPY) {
+                    std::memcpy(out + copied, source + copied, WILD_COPY);
+                }
+                out += matchLength;
+                continue;
+            }
+            // An overlapping match repeats its first offset bytes; copying from the same start, the
+            // distance to it doubles with every round
+            while (matchLength > 0) {
+                const std::size_t length = std::min(matchLength, static_cast<std::size_t>(out - source));
+                std::memcpy(out, source, length);
+                out += length;
+                matchLength -= length;
+            }
+        }
+
+        if (out != outEnd) {
+            throw std::runtime_error("Corrupt compressed chunk: expected " + std::to_string(output.size())
+                + " bytes, got " + std::to_string(out - begin));
+        }
+    }
+
+    CompressorPool::CompressorPool(std::size_t workers, std::size_t chunkSize)
+        : chunkSize_(chunkSize)
+        , started_(0)
+        , stopping_(false) {
+
+        for (std::size_t index = 0; index < std::max<std::size_t>(workers, 1); ++index) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    CompressorPool::~CompressorPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        queued_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void CompressorPool::submit(std::span<char> chunk) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(Job{chunk});
+        }
+        queued_.notify_one();
+    }
+
+    std::size_t CompressorPool::complete() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (jobs_.empty()) {
+            throw std::logic_error("No chunk to complete");
+        }
+        finished_.wait(lock, [this] { return jobs_.front().done or error_; });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        const std::size_t compressed = jobs_.front().compressed;
+        jobs_.pop_front();
+        --started_;
+        return compressed;
+    }
+
+    bool CompressorPool::ready() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !jobs_.empty() and jobs_.front().done;
+    }
+
+    std::size_t CompressorPool::pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+    void CompressorPool::run() {
+        std::vector<char> scratch(chunkSize_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            queued_.wait(lock, [this] { return stopping_ or started_ < jobs_.size(); });
+            if (stopping_) {
+                return;
+            }
+            // Only the front is ever removed, and only once it is done, so the job stays put
+            Job& job = jobs_[started_++];
+            lock.unlock();
+
+            std::size_t compressed = 0;
+            std::exception_ptr error;
+            try {
+                std::span<char> chunk = job.chunk;
+                const std::size_t limit = std::min(chunk.size() - chunk.size() / COMPRESS_MIN_GAIN, scratch.size());
+                compressed = compress(chunk, std::span<char>(scratch.data(), limit));
+                if (compressed > 0) {
+                    std::memcpy(chunk.data(), scratch.data(), compressed);
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            job.compressed = compressed;
+            job.done = true;
+            if (error and !error_) {
+                error_ = error;
+            }
+            finished_.notify_all();
+        }
+    }
+
+} // namespace cp
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace cp {
+
+    // Transform applied to the chunks between the source and the transport
+    enum class ECodec {
+        E_None = 0,
+        // Byte oriented LZ77 with a 64 KiB window, in the spirit of LZ4: a few hundred MB/s per core
+        E_Lz
+    };
+
+    const char* toString(ECodec codec);
+
+    // Compresses input into output with the LZ codec. Returns the compressed size, or 0 if it does not
+    // fit into output: pass a smaller output to only accept a minimum gain.
+    std::size_t compress(std::span<const char> input, std::span<char> output);
+
+    // Decompresses input, which has to expand to exactly output.size() bytes.
+    // Throws std::runtime_error on corrupt input.
+    void decompress(std::span<const char> input, std::span<char> output);
+
+    // Compresses chunks in place on a few threads, handing them back in the order they were queued.
+    // A chunk that does not get at least 1/COMPRESS_MIN_GAIN smaller is left as it is.
+    class CompressorPool {
+    public:
+        CompressorPool(std::size_t workers, std::size_t chunkSize);
+        ~CompressorPool();
+
+        CompressorPool(const CompressorPool&) = delete;
+        CompressorPool& operator=(const CompressorPool&) = delete;
+
+        // The chunk belongs to the pool until it is handed back by complete
+        void submit(std::span<char> chunk);
+
+        // The oldest queued chunk once it is done: its compressed size, 0 if it stays uncompressed.
+        // Rethrows what the worker failed with.
+        std::size_t complete();
+
+        // Whether complete would return without waiting
+        bool ready() const;
+
+        std::size_t pending() const;
+
+    private:
+        struct Job {
+            std::span<char> chunk;
+            std::size_t compressed = 0;
+            bool done = false;
+        };
+
+        void run();
+
+        std::size_t chunkSize_;
+        mutable std::mutex mutex_;
+        std::condition_variable queued_;
+        std::condition_variable finished_;
+        // Jobs from the oldest one not handed back; the first started_ of them are taken by a worker
+        std::deque<Job> jobs_;
+        std::size_t started_;
+        std::exception_ptr error_;
+        bool stopping_;
+        std::vector<std::thread> workers_;
+    };
+
+} // namespace cp
@@ -1,3 +1,85 @@
+#pragma once
+
+#include <chrono>
 #include <cstddef>
-// Buffer size for reading and writing
-constexpr std::size_t BUFFER_SIZE = 4 * 1024 * 1024; // 4 MB
\ No newline at end of file
+#include <cstdint>
+// Default chunk size for reading and writing
+constexpr std::size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024; // 4 MB
+// Default number of slots in the shared memory ring
+constexpr std::size_t DEFAULT_SLOT_COUNT = 4;
+
+// Slot data is aligned to and sized in multiples of a page for O_DIRECT I/O
+constexpr std::size_t SLOT_ALIGNMENT = 4096;
+
+// Default number of requests kept in flight by the io_uring backend
+constexpr std::size_t DEFAULT_QUEUE_DEPTH = 4;
+
+// Size of the file window mapped at a time by the mmap backend
+constexpr std::size_t MAP_WINDOW_SIZE = 64 * 1024 * 1024; // 64 MB
+
+// Permissions of a target file the copy creates, before the umask, as with std::ofstream or cp
+constexpr unsigned TARGET_FILE_MODE = 0666;
+
+// Capacity requested for pipes we read or write, the default limit for unprivileged processes
+constexpr int PIPE_BUFFER_SIZE = 1024 * 1024; // 1 MB
+
+// Upper bound for the threads unpacking files of a directory copy
+constexpr std::size_t MAX_UNPACK_WORKERS = 8;
+
+// Bounds accepted for a negotiated geometry
+constexpr std::size_t MIN_CHUNK_SIZE = 4 * 1024; // 4 KB
+constexpr std::size_t MAX_CHUNK_SIZE = 1024 * 1024 * 1024; // 1 GB
+constexpr std::size_t MAX_SLOT_COUNT = 1024;
+
+// Default and maximal number of lanes, i.e. rings copying separate ranges of one file
+constexpr std::size_t DEFAULT_LANE_COUNT = 1;
+constexpr std::size_t MAX_LANE_COUNT = 64;
+
+// Upper bound for the writers a broadcast copy feeds from one reader
+constexpr std::size_t MAX_CONSUMER_COUNT = 16;
+
+// Jobs a copy daemon can hold at once, queued or running; a power of two
+constexpr std::size_t JOB_QUEUE_CAPACITY = 64;
+// Worker threads of a copy daemon, each with its own slots
+constexpr std::size_t DEFAULT_DAEMON_WORKERS = 4;
+
+// How often copy --stats prints the progress of a running copy
+constexpr std::chrono::seconds STATS_INTERVAL{1};
+
+// How long one side waits for the other before giving up
+constexpr std::chrono::seconds TRANSPORT_TIMEOUT{10};
+
+// A TCP peer that stops acknowledging data or answering keepalive probes for this long is taken for dead
+constexpr std::chrono::seconds TCP_PEER_TIMEOUT{20};
+
+// Bytes the writer lets the page cache hold dirty before writing them back behind itself
+constexpr std::size_t WRITE_BEHIND_WINDOW = 16 * 1024 * 1024; // 16 MB
+
+// Bytes written between two syncs with --durability=periodic
+constexpr std::uint64_t DURABILITY_INTERVAL = 256 * 1024 * 1024; // 256 MB
+
+// Threads compressing chunks on the reader, capped at the number of cores
+constexpr std::size_t DEFAULT_COMPRESS_WORKERS = 4;
+
+// A compressed chunk is only sent if it is at least 1/16 smaller than the original
+constexpr std::size_t COMPRESS_MIN_GAIN = 16;
+
+// Files from this size on have their chunk size and read depth tuned while they are copied
+constexpr std::uint64_t TUNE_MIN_SIZE = 1024 * 1024 * 1024; // 1 GB
+// Bytes sent with every setting tried, at least four chunks
+constexpr std::uint64_t TUNE_TRIAL_BYTES = 32 * 1024 * 1024; // 32 MB
+// Chunk sizes tried, halving from the slot size but never below TUNE_MIN_CHUNK
+constexpr std::size_t TUNE_CHUNK_CANDIDATES = 4;
+constexpr std::size_t TUNE_MIN_CHUNK = 64 * 1024;
+// How much faster a smaller chunk size or depth has to be to be chosen
+constexpr double TUNE_MARGIN = 0.05;
+
+// A capped copy reads in pieces of this much time's worth of bytes, and never bursts beyond it
+constexpr std::chrono::milliseconds RATE_PACING_INTERVAL{10};
+constexpr std::size_t RATE_MIN_PIECE = 64 * 1024;
+
+// A copy run with --resume records its progress every 256 MB, after syncing what it wrote
+constexpr std::uint64_t CHECKPOINT_INTERVAL = 256 * 1024 * 1024; // 256 MB
+
+// How often a process blocked on the other side checks that it is still alive
+constexpr std::chrono::milliseconds LIVENESS_INTERVAL{100};
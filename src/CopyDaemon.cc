@@ -0,0 +1,174 @@
+#include "CopyDaemon.h"
+#include "CopyManager.h"
+#include "Endpoints.h"
+#include "LocalTransport.h"
+
+#include <signal.h>
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace cp {
+
+    CopyDaemon::CopyDaemon(const Options& options)
+        : options_(options)
+        , queue_(JobQueue::create(options.sharedMemoryName, options.daemonWorkers, options.chunkSize, options.slotCount)) {
+    }
+
+    void CopyDaemon::run() {
+        // Blocked before the workers start, so only sigwait below sees the signals
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        std::vector<std::thread> workers;
+        for (std::size_t worker = 0; worker < options_.daemonWorkers; ++worker) {
+            workers.emplace_back(&CopyDaemon::work, this, worker);
+        }
+        std::cout << "Copy daemon serving " << options_.sharedMemoryName << " with " << workers.size() << " workers, "
+            << options_.slotCount << " slots of " << options_.chunkSize << " bytes each" << std::endl;
+
+        int signal = 0;
+        sigwait(&signals, &signal);
+        std::cout << "Stopping after the queued jobs" << std::endl;
+
+        JobQueueHeader& header = queue_.header();
+        header.stopping = true;
+        header.pendingEvent.notify();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void CopyDaemon::work(std::size_t worker) {
+        JobQueueHeader& header = queue_.header();
+
+        std::span<char> slots = queue_.slots(worker);
+        std::vector<std::span<char>> buffers;
+        for (std::size_t index = 0; index < header.slotCount; ++index) {
+            buffers.push_back(slots.subspan(index * header.chunkSize, header.chunkSize));
+        }
+
+        AdaptiveWaiter waiter;
+        while (true) {
+            std::uint32_t index = 0;
+            if (!header.pending.pop(index)) {
+                if (header.stopping) {
+                    return;
+                }
+                waiter.wait(header.pendingEvent, TRANSPORT_TIMEOUT, [&header] {
+                    return !header.pending.empty() or header.stopping;
+                });
+                continue;
+            }
+
+            JobRecord& job = header.jobs[index];
+            job.state = EJobState::E_Running;
+
+            const auto started = std::chrono::steady_clock::now();
+            JobResult result = execute(job, buffers);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+
+            std::cout << "Job " << index << " " << (result.succeeded ? "done" : "failed") << " in " << elapsed.count() << " ms: "
+                << job.source << " -> " << job.target << (result.succeeded ? "" : ": " + result.error) << std::endl;
+
+            job.bytes = result.bytes;
+            std::strncpy(job.error, result.error.c_str(), sizeof(job.error) - 1);
+            job.error[sizeof(job.error) - 1] = '\0';
+            job.state = result.succeeded ? EJobState::E_Done : EJobState::E_Failed;
+            job.done.notify();
+        }
+    }
+
+    JobResult CopyDaemon::execute(const JobRecord& job, const std::vector<std::span<char>>& buffers) {
+        Options options = options_;
+        options.source = job.source;
+        options.target = job.target;
+        options.recursive = job.recursive;
+        options.durability = job.durability;
+
+        CopySettings settings;
+        settings.kernelOffload = job.kernelOffload;
+        settings.verify = job.verify;
+        settings.sparse = job.sparse;
+        // The cap of the daemon holds for each of its jobs
+        settings.maxRate = options_.maxRate.value_or(0);
+
+        LocalTransport::Ptr producer = std::make_unique<LocalTransport>(buffers);
+        LocalTransport::Ptr consumer = producer->connect();
+        // Survives both managers, to wake the other side when one of them fails
+        LocalTransport::Ptr control = producer->connect();
+
+        std::once_flag failed;
+        std::exception_ptr error;
+        auto fail = [&] {
+            std::call_once(failed, [&error] { error = std::current_exception(); });
+            control->abort();
+        };
+
+        try {
+            IDataSource::Ptr source = makeSource(options, *producer);
+            IDataDestination::Ptr destination = makeDestination(options, *consumer);
+
+            std::thread writer([&] {
+                try {
+                    CopyManager(nullptr, std::move(destination), std::move(consumer), settings).start();
+                } catch (const std::exception&) {
+                    fail();
+                }
+            });
+            try {
+                CopyManager(std::move(source), nullptr, std::move(producer), settings).start();
+            } catch (const std::exception&) {
+                fail();
+            }
+            writer.join();
+        } catch (const std::exception&) {
+            fail();
+        }
+
+        // The side that failed first explains it; the other one only saw the abort
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (const std::exception& ex) {
+                return JobResult{false, 0, ex.what()};
+            }
+        }
+        return JobResult{true, control->totalSize().value_or(0), {}};
+    }
+
+    int submitJob(const Options& options) {
+        JobRequest request;
+        request.source = std::filesystem::absolute(options.source).string();
+        request.target = std::filesystem::absolute(options.target).string();
+        request.verify = options.verify;
+        request.kernelOffload = options.kernelOffload;
+        request.recursive = options.recursive;
+        request.sparse = options.sparse;
+        request.durability = options.durability;
+
+        JobQueue queue = JobQueue::open(options.sharedMemoryName);
+        const auto started = std::chrono::steady_clock::now();
+        JobResult result = queue.submit(request);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+
+        if (!result.succeeded) {
+            std::cerr << "Error: " << result.error << "\n";
+            return 1;
+        }
+        // A tree has no total size up front
+        std::cout << "Copied " << (options.recursive ? std::string("the tree") : std::to_string(result.bytes) + " bytes")
+            << " through the daemon in " << elapsed.count() << " ms" << std::endl;
+        return 0;
+    }
+
+} // namespace cp
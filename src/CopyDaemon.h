@@ -0,0 +1,33 @@
+#pragma once
+
+#include "JobQueue.h"
+#include "Options.h"
+
+#include <span>
+#include <vector>
+
+namespace cp {
+
+    // Long-lived copy service. It keeps one pre-faulted segment with a job queue and the slots of its
+    // workers, so clients pay neither for creating a segment nor for the attach handshake per copy.
+    // Each worker runs both ends of a job through its own slots, on two threads.
+    class CopyDaemon {
+    public:
+        // Creates the queue named by options.sharedMemoryName, geometry and backend from the options
+        explicit CopyDaemon(const Options& options);
+
+        // Serves jobs until SIGINT or SIGTERM; jobs already queued are still run
+        void run();
+
+    private:
+        void work(std::size_t worker);
+        JobResult execute(const JobRecord& job, const std::vector<std::span<char>>& buffers);
+
+        Options options_;
+        JobQueue queue_;
+    };
+
+    // Client side of --submit: hands the copy to the daemon and waits for it. Returns the exit status.
+    int submitJob(const Options& options);
+
+} // namespace cp
@@ -1,43 +1,80 @@
 #include "CopyManager.h"
-#include <iostream>
-#include <chrono>
+#include "FileDestination.h"
+#include "FileSource.h"
+#include "LocalTransport.h"
+#include "MappedFileDestination.h"
+#include "MappedFileSource.h"
+#include "SharedMemoryTransport.h"
+#include "UringFileDestination.h"
+#include "UringFileSource.h"
+
+#include <utility>
 
 
 namespace cp {
-    
-    CopyManager::CopyManager(IDataSource::Ptr source, IDataDestination::Ptr destination, IDataTransport::Ptr transport)
-        : source_(std::move(source))
-        , destination_(std::move(destination))
-        , transport_(std::move(transport)) {
 
-    }
+    namespace {
 
-    void CopyManager::start() {
-        if (source_) {
-            read();
-        } else if (destination_) {
-            write();
+        template <typename... Types>
+        struct TypeList {};
+
+        // Combinations compiled into their own pipeline; each one is a separate copy of the loop
+        using Transports = TypeList<SharedMemoryTransport, LocalTransport>;
+        using Sources = TypeList<FileSource, UringFileSource, MappedFileSource>;
+        using Destinations = TypeList<FileDestination, UringFileDestination, MappedFileDestination>;
+
+        template <typename Source, typename Transport>
+        bool readAs(IDataSource& source, Transport& transport, const CopySettings& settings) {
+            Source* concrete = dynamic_cast<Source*>(&source);
+            if (concrete) {
+                CopyPipeline<Source, Transport, IDataDestination>(concrete, nullptr, transport, settings).read();
+            }
+            return concrete != nullptr;
         }
-    }
 
+        template <typename Destination, typename Transport>
+        bool writeAs(IDataDestination& destination, Transport& transport, const CopySettings& settings) {
+            Destination* concrete = dynamic_cast<Destination*>(&destination);
+            if (concrete) {
+                CopyPipeline<IDataSource, Transport, Destination>(nullptr, concrete, transport, settings).write();
+            }
+            return concrete != nullptr;
+        }
 
-    void CopyManager::read() {
-        std::size_t bytesRead = 0;
-        bool hasToRead = true;
-        while(hasToRead) {
-            std::span<char> buffer = transport_->getBuffer();
-            if(hasToRead = source_->readChunk(buffer, bytesRead); hasToRead) 
-                transport_->sendData(std::span<char>{buffer.data(), bytesRead});
+        template <typename Transport, typename... Source, typename... Destination>
+        bool runAs(IDataSource* source, IDataDestination* destination, IDataTransport& transport, const CopySettings& settings,
+                   TypeList<Source...>, TypeList<Destination...>) {
+            Transport* concrete = dynamic_cast<Transport*>(&transport);
+            if (!concrete) {
+                return false;
+            }
+            return source ? (readAs<Source>(*source, *concrete, settings) or ...)
+                          : (writeAs<Destination>(*destination, *concrete, settings) or ...);
         }
-        transport_->finish();
+
+        template <typename... Transport>
+        bool runSpecialized(IDataSource* source, IDataDestination* destination, IDataTransport& transport,
+                            const CopySettings& settings, TypeList<Transport...>) {
+            return (runAs<Transport>(source, destination, transport, settings, Sources{}, Destinations{}) or ...);
+        }
+
+    } // namespace
+    
+    CopyManager::CopyManager(IDataSource::Ptr source, IDataDestination::Ptr destination, IDataTransport::Ptr transport, CopySettings settings)
+        : source_(std::move(source))
+        , destination_(std::move(destination))
+        , transport_(std::move(transport))
+        , settings_(settings) {
+
     }
 
-    void CopyManager::write() {
-        while(!transport_->hasFinished()) {
-            std::span<const char> buffer = transport_->receiveData();
-            if (buffer.size() > 0)
-                destination_->writeChunk(buffer);
+    void CopyManager::start() {
+        if (!source_ and !destination_) {
+            return;
+        }
+        if (!runSpecialized(source_.get(), destination_.get(), *transport_, settings_, Transports{})) {
+            CopyPipeline<IDataSource, IDataTransport, IDataDestination>(source_.get(), destination_.get(), *transport_, settings_).start();
         }
     }
     
-} // namespace cp
\ No newline at end of file
+} // namespace cp
@@ -1,29 +1,30 @@
 #pragma once
 
+#include "CopyPipeline.h"
 #include "IDataTransport.h"
 #include "IDataSource.h"
 #include "IDataDestination.h"
 
 namespace cp {
 
+    // Runs one side of a copy on endpoints chosen at runtime. The common combinations of concrete
+    // source, destination and transport get a CopyPipeline specialized for them; anything else goes
+    // through the virtual interfaces.
     class CopyManager {
     public:
         CopyManager(
             IDataSource::Ptr source, 
             IDataDestination::Ptr destination,
-            IDataTransport::Ptr transport);
+            IDataTransport::Ptr transport,
+            CopySettings settings = {});
 
         void start();
 
-    private:
-
-        void read();
-        void write();
-
     private:
         IDataSource::Ptr source_;
         IDataDestination::Ptr destination_;
         IDataTransport::Ptr transport_;
+        CopySettings settings_;
     };
 
-} // namespace cp
\ No newline at end of file
+} // namespace cp
@@ -0,0 +1,62 @@
+#include "CopyPipeline.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cp {
+
+    ECopyMethod copyOfferedFile(const LocalFile& file, const std::string& target, bool sparse,
+                                const std::function<void(std::uint64_t)>& progress) {
+        // The offered path has to resolve to the very same file for us
+        int sourceFd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (sourceFd < 0) {
+            return ECopyMethod::E_None;
+        }
+
+        struct stat status{};
+        int targetFd = -1;
+        if (fstat(sourceFd, &status) == 0 and static_cast<std::uint64_t>(status.st_dev) == file.device
+            and static_cast<std::uint64_t>(status.st_ino) == file.inode) {
+            targetFd = open(target.c_str(), O_WRONLY | O_CLOEXEC);
+        }
+
+        ECopyMethod method = ECopyMethod::E_None;
+        try {
+            if (targetFd >= 0) {
+                method = kernelCopy(sourceFd, targetFd, file.size, sparse, progress);
+            }
+        } catch (const std::exception&) {
+            close(targetFd);
+            close(sourceFd);
+            throw;
+        }
+
+        if (targetFd >= 0) {
+            close(targetFd);
+        }
+        close(sourceFd);
+        return method;
+    }
+
+    std::optional<BlockSignature> hashTarget(const std::string& target, std::size_t blockSize, std::vector<std::uint32_t>& checksums,
+                                             const std::function<void(std::uint64_t)>& progress) {
+        int targetFd = open(target.c_str(), O_RDONLY | O_CLOEXEC);
+        if (targetFd < 0) {
+            return std::nullopt;
+        }
+
+        std::optional<BlockSignature> signature;
+        try {
+            signature = readSignature(targetFd, blockSize, &checksums, progress);
+        } catch (const std::exception&) {
+            close(targetFd);
+            throw;
+        }
+        close(targetFd);
+        return signature;
+    }
+
+    template class CopyPipeline<IDataSource, IDataTransport, IDataDestination>;
+
+} // namespace cp
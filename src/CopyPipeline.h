@@ -0,0 +1,590 @@
+#pragma once
+
+#include "Checkpoint.h"
+#include "Checksum.h"
+#include "Codec.h"
+#include "Delta.h"
+#include "Durability.h"
+#include "IDataDestination.h"
+#include "IDataSource.h"
+#include "IDataTransport.h"
+#include "KernelCopy.h"
+#include "LocalFile.h"
+#include "Sparse.h"
+#include "Stats.h"
+#include "Throttle.h"
+#include "Tuner.h"
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cp {
+
+    struct CopySettings {
+        // Let the kernel copy between local files instead of streaming through the transport
+        bool kernelOffload = true;
+        // Checksum every chunk on the reader; the writer verifies whatever carries a checksum
+        bool verify = false;
+        // How holes and zeros of the source are handled
+        ESparseMode sparse = ESparseMode::E_Auto;
+        // Reader: ask for the signature of the target and skip the blocks it already has.
+        // Writer: hash the target when asked; the destination has to be opened to patch it.
+        bool delta = false;
+        // Parallel copy: when the writer syncs the target; single streams get it from their destination
+        EDurability durability = EDurability::E_End;
+        // Reader: how chunks are compressed before they are published, and on how many threads.
+        // Writer: compressed chunks are decompressed whatever this says.
+        ECodec codec = ECodec::E_None;
+        std::size_t compressWorkers = DEFAULT_COMPRESS_WORKERS;
+        // Reader: try smaller chunks and depths on a large source and keep the fastest
+        bool tune = true;
+        // Reader: bytes per second it reads at most, 0 for no cap
+        std::uint64_t maxRate = 0;
+        // Reader: ask the writer what it kept of an interrupted copy and skip it.
+        // Writer: checkpoint the target; the destination has to be opened to patch it.
+        bool resume = false;
+    };
+
+    // What the pipeline needs from a source, see IDataSource
+    template <typename T>
+    concept DataSource = requires(T& source, std::span<char> buffer, std::uint64_t offset) {
+        { source.size() } -> std::same_as<std::optional<std::uint64_t>>;
+        { source.localFile() } -> std::same_as<std::optional<LocalFile>>;
+        { source.holeLength() } -> std::same_as<std::uint64_t>;
+        source.skipHole();
+        source.seek(offset);
+        { source.queueDepth() } -> std::convertible_to<std::size_t>;
+        source.submitChunk(buffer);
+        { source.completeChunk() } -> std::same_as<std::span<char>>;
+    };
+
+    // What the pipeline needs from a destination, see IDataDestination
+    template <typename T>
+    concept DataDestination = requires(T& destination, std::span<const char> buffer, std::uint64_t length) {
+        destination.reserve(length);
+        destination.writeHole(length);
+        destination.skipUnchanged(length);
+        destination.resume(length);
+        destination.sync();
+        { destination.localPath() } -> std::same_as<std::optional<std::string>>;
+        { destination.queueDepth() } -> std::convertible_to<std::size_t>;
+        destination.submitChunk(buffer);
+        destination.completeChunk();
+        destination.finish();
+    };
+
+    // What the pipeline needs from a transport, see IDataTransport
+    template <typename T>
+    concept DataTransport = requires(T& transport, std::span<const char> buffer, std::uint64_t length, std::uint32_t checksum,
+                                     std::optional<LocalFile> file, std::optional<BlockSignature> signature) {
+        { transport.getBuffer() } -> std::same_as<std::span<char>>;
+        { transport.tryGetBuffer() } -> std::same_as<std::span<char>>;
+        transport.sendData(buffer);
+        transport.sendHole(buffer, length);
+        transport.sendUnchanged(buffer, length);
+        transport.sendCompressed(buffer, length);
+        transport.setChecksum(checksum);
+        { transport.receiveData() } -> std::same_as<std::span<const char>>;
+        { transport.tryReceiveData() } -> std::same_as<std::span<const char>>;
+        transport.releaseData();
+        { transport.receivedHole() } -> std::same_as<std::uint64_t>;
+        { transport.receivedUnchanged() } -> std::same_as<std::uint64_t>;
+        { transport.receivedOriginalSize() } -> std::same_as<std::uint64_t>;
+        { transport.receivedChecksum() } -> std::same_as<std::optional<std::uint32_t>>;
+        { transport.hasFinished() } -> std::same_as<bool>;
+        transport.finish();
+        transport.setTotalSize(std::optional<std::uint64_t>(length));
+        { transport.totalSize() } -> std::same_as<std::optional<std::uint64_t>>;
+        { transport.offerLocalFile(file) } -> std::same_as<bool>;
+        { transport.offeredLocalFile() } -> std::same_as<std::optional<LocalFile>>;
+        transport.reportOffload(EOffloadState::E_Done, length);
+        transport.requestSignature();
+        { transport.receivedSignature() } -> std::same_as<std::optional<BlockSignature>>;
+        { transport.signatureRequested() } -> std::same_as<bool>;
+        { transport.sendSignature(signature) } -> std::same_as<bool>;
+        transport.reportSignatureProgress(length);
+        transport.requestResume();
+        { transport.receivedResumeOffset() } -> std::same_as<std::uint64_t>;
+        { transport.resumeRequested() } -> std::same_as<bool>;
+        transport.sendResumeOffset(length);
+        transport.reportResumeProgress(length);
+        { transport.chunkSize() } -> std::convertible_to<std::size_t>;
+        { transport.stats() } -> std::same_as<CopyStats*>;
+    };
+
+    // Copies the offered file into target inside the kernel, after checking that the path still
+    // names the offered file. E_None if the data has to be streamed instead.
+    ECopyMethod copyOfferedFile(const LocalFile& file, const std::string& target, bool sparse,
+                                const std::function<void(std::uint64_t)>& progress);
+
+    // Hashes target in blocks of blockSize, std::nullopt if it cannot be opened
+    std::optional<BlockSignature> hashTarget(const std::string& target, std::size_t blockSize, std::vector<std::uint32_t>& checksums,
+                                             const std::function<void(std::uint64_t)>& progress);
+
+    // The read -> hand-off -> write loop of one side of a copy, for concrete types known at compile time:
+    // with final classes every per-chunk call can be inlined. Instantiated with the interfaces it is
+    // the runtime-dispatched loop behind CopyManager.
+    template <DataSource Source, DataTransport Transport, DataDestination Destination>
+    class CopyPipeline {
+    public:
+        // Either source (reader) or destination (writer) is set; both are owned by the caller
+        CopyPipeline(Source* source, Destination* destination, Transport& transport, CopySettings settings = {})
+            : source_(source)
+            , destination_(destination)
+            , transport_(transport)
+            , settings_(settings) {
+        }
+
+        void start() {
+            if (source_) {
+                read();
+            } else if (destination_) {
+                write();
+            }
+        }
+
+        void read();
+        void write();
+
+    private:
+        // Writer side of the kernel offload; false if the data has to be streamed
+        bool copyInKernel(const LocalFile& file);
+
+        Source* source_;
+        Destination* destination_;
+        Transport& transport_;
+        CopySettings settings_;
+    };
+
+    template <DataSource Source, DataTransport Transport, DataDestination Destination>
+    void CopyPipeline<Source, Transport, Destination>::read() {
+        Source& source = *source_;
+        Transport& transport = transport_;
+        const std::size_t depth = source.queueDepth();
+        std::size_t inFlight = 0;
+        bool endOfData = false;
+        std::uint32_t digest = 0;
+        std::uint64_t sent = 0;
+        StageClock reading(transport.stats(), EStage::E_Read);
+        RateLimiter limiter(settings_.maxRate, transport.stats());
+
+        // Published before the first buffer, so the writer sees it with the first chunk
+        transport.setTotalSize(source.size());
+
+        // A copy in the kernel would bypass the checksums, the rate cap, or rewrite what the target already has
+        const bool offload = settings_.kernelOffload and !settings_.verify and !settings_.delta and settings_.maxRate == 0
+            and !settings_.resume;
+        if (settings_.delta) {
+            transport.requestSignature();
+        }
+        if (settings_.resume) {
+            transport.requestResume();
+        }
+        if (transport.offerLocalFile(offload ? source.localFile() : std::nullopt)) {
+            transport.finish();
+            return;
+        }
+
+        // A hole would have to be punched into the old content, so a delta copy reads holes as data
+        const std::optional<BlockSignature> signature = settings_.delta ? transport.receivedSignature() : std::nullopt;
+        const ESparseMode sparse = signature ? ESparseMode::E_Never : settings_.sparse;
+
+        // The writer kept this much of an interrupted copy
+        if (const std::uint64_t kept = settings_.resume ? transport.receivedResumeOffset() : 0; kept > 0) {
+            source.seek(kept);
+            std::cout << "Resuming after the first " << kept << " bytes the target already has" << std::endl;
+            CopyStats* stats = transport.stats();
+            if (std::optional<std::uint64_t> total = source.size(); stats and total and *total >= kept) {
+                stats->totalBytes.store(*total - kept, std::memory_order_relaxed);
+            }
+        }
+
+        // The signature is matched chunk by chunk, so a delta copy keeps the slot size. A capped copy
+        // is as fast as the cap, and reads in pieces of its own.
+        const std::optional<std::uint64_t> size = source.size();
+        std::optional<ChunkTuner> tuner;
+        if (settings_.tune and !settings_.delta and settings_.maxRate == 0 and size and *size >= TUNE_MIN_SIZE) {
+            tuner.emplace(transport.chunkSize(), depth, transport.stats());
+        }
+
+        // Data chunks go through the compressor, which hands them back in order; they are published
+        // before anything else, so a chunk sent directly has to wait for them
+        std::unique_ptr<CompressorPool> compressor = settings_.codec == ECodec::E_Lz
+            ? std::make_unique<CompressorPool>(settings_.compressWorkers, transport.chunkSize()) : nullptr;
+        std::deque<std::pair<std::span<char>, std::optional<std::uint32_t>>> compressing;
+        auto publishCompressed = [&] {
+            std::size_t size = 0;
+            if (compressor->ready()) {
+                size = compressor->complete();
+            } else {
+                ScopedStage waiting(transport.stats(), EStage::E_Compress);
+                size = compressor->complete();
+            }
+            const auto [chunk, checksum] = compressing.front();
+            compressing.pop_front();
+            if (checksum) {
+                transport.setChecksum(*checksum);
+            }
+            if (size > 0) {
+                transport.sendCompressed(chunk.first(size), chunk.size());
+            } else {
+                transport.sendData(chunk);
+            }
+        };
+        auto drain = [&] {
+            while (!compressing.empty()) {
+                publishCompressed();
+            }
+        };
+
+        // Zeros are published as a hole instead of being sent
+        auto sendHole = [&](std::span<const char> buffer, std::uint64_t length) {
+            drain();
+            if (settings_.verify) {
+                const std::uint32_t checksum = crc32cZeros(length);
+                digest = crc32cCombine(digest, checksum, length);
+                transport.setChecksum(checksum);
+            }
+            sent += length;
+            transport.sendHole(buffer, length);
+        };
+
+        while (!endOfData or inFlight > 0 or !compressing.empty()) {
+            while (!compressing.empty() and compressor->ready()) {
+                publishCompressed();
+            }
+
+            if (!endOfData and inFlight < (tuner ? tuner->depth() : depth)) {
+                // A hole is published in order, so the reads and compressions before it are completed first
+                const std::uint64_t hole = sparse != ESparseMode::E_Never ? source.holeLength() : 0;
+                if (hole > 0 and inFlight == 0 and compressing.empty()) {
+                    sendHole(transport.getBuffer(), hole);
+                    source.skipHole();
+                    continue;
+                }
+
+                // Never block on the transport while reads or compressions are outstanding: their
+                // slots have to be published before the writer can free new ones
+                std::span<char> buffer = hole > 0 ? std::span<char>()
+                    : inFlight == 0 and compressing.empty() ? transport.getBuffer() : transport.tryGetBuffer();
+                if (!buffer.empty()) {
+                    if (tuner) {
+                        buffer = buffer.first(std::min(buffer.size(), tuner->chunkSize()));
+                    }
+                    if (signature) {
+                        // Blocks of the signature only match whole slots, so these are read whole
+                        // once each piece of them has had its turn
+                        for (std::size_t paced = 0; paced < buffer.size();) {
+                            const std::size_t piece = limiter.pieceSize(buffer.size() - paced);
+                            limiter.take(piece);
+                            paced += piece;
+                        }
+                    } else {
+                        buffer = buffer.first(limiter.pieceSize(buffer.size()));
+                        limiter.take(buffer.size());
+                    }
+                    reading.start();
+                    source.submitChunk(buffer);
+                    reading.stop();
+                    ++inFlight;
+                    continue;
+                }
+            }
+
+            // Nothing to read: wait for the oldest compression, if the loop above has not published them all
+            if (inFlight == 0) {
+                if (!compressing.empty()) {
+                    publishCompressed();
+                }
+                continue;
+            }
+
+            reading.start();
+            std::span<char> chunk = source.completeChunk();
+            reading.pass();
+            --inFlight;
+
+            if (chunk.empty()) {
+                endOfData = true;
+            } else if (!endOfData) {
+                if (tuner and !tuner->settled()) {
+                    tuner->record(chunk.size(), monotonicNanoseconds());
+                    if (tuner->settled()) {
+                        std::cout << tuner->summary() << std::endl;
+                    }
+                }
+                if (sparse == ESparseMode::E_Always and isZero(chunk)) {
+                    sendHole(chunk, chunk.size());
+                    continue;
+                }
+
+                std::optional<std::uint32_t> checksum;
+                if (settings_.verify) {
+                    checksum = crc32c(0, chunk);
+                    digest = crc32cCombine(digest, *checksum, chunk.size());
+                }
+                const std::uint64_t offset = std::exchange(sent, sent + chunk.size());
+                const bool unchanged = signature and signature->matches(offset, chunk);
+                if (compressor and !unchanged) {
+                    compressing.emplace_back(chunk, checksum);
+                    compressor->submit(chunk);
+                    continue;
+                }
+
+                drain();
+                if (checksum) {
+                    transport.setChecksum(*checksum);
+                }
+                if (unchanged) {
+                    transport.sendUnchanged(chunk, chunk.size());
+                } else {
+                    transport.sendData(chunk);
+                }
+            }
+        }
+        transport.finish();
+
+        if (settings_.verify) {
+            std::cout << "Sent " << sent << " bytes, " << formatChecksum(digest) << std::endl;
+        }
+    }
+
+    template <DataSource Source, DataTransport Transport, DataDestination Destination>
+    bool CopyPipeline<Source, Transport, Destination>::copyInKernel(const LocalFile& file) {
+        std::optional<std::string> target = destination_->localPath();
+        if (!settings_.kernelOffload or !target) {
+            return false;
+        }
+
+        ECopyMethod method = ECopyMethod::E_None;
+        try {
+            method = copyOfferedFile(file, *target, settings_.sparse != ESparseMode::E_Never, [this](std::uint64_t copied) {
+                transport_.reportOffload(EOffloadState::E_Accepted, copied);
+            });
+        } catch (const std::exception&) {
+            transport_.reportOffload(EOffloadState::E_Failed, 0);
+            throw;
+        }
+
+        if (method == ECopyMethod::E_None) {
+            return false;
+        }
+
+        std::cout << "Copied " << file.size << " bytes in the kernel using " << toString(method) << std::endl;
+        return true;
+    }
+
+    template <DataSource Source, DataTransport Transport, DataDestination Destination>
+    void CopyPipeline<Source, Transport, Destination>::write() {
+        Destination& destination = *destination_;
+        Transport& transport = transport_;
+        bool copied = false;
+        if (std::optional<LocalFile> file = transport.offeredLocalFile()) {
+            if ((copied = copyInKernel(*file))) {
+                // The reader reports success as soon as it hears about it
+                try {
+                    destination.finish();
+                } catch (const std::exception&) {
+                    transport.reportOffload(EOffloadState::E_Failed, 0);
+                    throw;
+                }
+                transport.reportOffload(EOffloadState::E_Done, file->size);
+            } else {
+                transport.reportOffload(EOffloadState::E_Declined, 0);
+            }
+        }
+
+        // CRC32C of the target blocks, to verify the ones the reader reports as unchanged
+        std::vector<std::uint32_t> targetChecksums;
+        bool patching = false;
+        if (transport.signatureRequested()) {
+            std::optional<std::string> target = settings_.delta ? destination.localPath() : std::nullopt;
+            std::optional<BlockSignature> signature = target ? hashTarget(*target, transport.chunkSize(), targetChecksums,
+                [&transport](std::uint64_t blocks) { transport.reportSignatureProgress(blocks); }) : std::nullopt;
+            patching = transport.sendSignature(signature);
+            if (signature and !patching) {
+                std::cout << "Signature of the target does not fit the shared memory, copying everything" << std::endl;
+            }
+        }
+
+        // A resumed copy goes on after the prefix the checkpoint vouches for; anything else written
+        // into a target opened to patch it starts over
+        std::optional<Checkpoint> checkpoint;
+        Checkpoint::Progress resumed;
+        if (settings_.resume and !copied) {
+            if (std::optional<std::string> target = destination.localPath()) {
+                checkpoint.emplace(*target, transport.totalSize());
+                if (transport.resumeRequested()) {
+                    resumed = checkpoint->verify([&transport](std::uint64_t bytes) { transport.reportResumeProgress(bytes); });
+                }
+            }
+            destination.resume(resumed.offset);
+        }
+        if (transport.resumeRequested()) {
+            transport.sendResumeOffset(resumed.offset);
+        }
+        // CRC32C of the target up to the last byte received, recorded with each checkpoint
+        std::uint32_t prefix = resumed.checksum;
+
+        const std::size_t depth = destination.queueDepth();
+        std::size_t inFlight = 0;
+        bool reserved = false;
+        bool verified = false;
+        std::uint32_t digest = 0;
+        std::uint64_t received = 0;
+        std::uint64_t unchanged = 0;
+        StageClock writing(transport.stats(), EStage::E_Write);
+        // Compressed chunks are decompressed into one of depth buffers, the one of the oldest chunk
+        // that can still be in flight, and written from there
+        std::unique_ptr<char, void (*)(void*)> decompressed(nullptr, &std::free);
+        std::uint64_t submitted = 0;
+        auto complete = [&destination, &transport, &writing] {
+            writing.start();
+            destination.completeChunk();
+            writing.pass();
+            transport.releaseData();
+        };
+        // Only what is written and synced is recorded, so every write in flight is completed first
+        auto checkpointIfDue = [&] {
+            if (!checkpoint or !checkpoint->due(resumed.offset + received)) {
+                return;
+            }
+            for (; inFlight > 0; --inFlight) {
+                complete();
+            }
+            writing.start();
+            destination.sync();
+            writing.pass();
+            checkpoint->save({resumed.offset + received, prefix});
+        };
+
+        while(!transport.hasFinished()) {
+            // Same rule as the reader: only block for new data with no writes outstanding
+            std::span<const char> buffer = inFlight == 0 ? transport.receiveData() : transport.tryReceiveData();
+            if (buffer.data() != nullptr) {
+                if (!std::exchange(reserved, true)) {
+                    if (std::optional<std::uint64_t> size = transport.totalSize()) {
+                        destination.reserve(*size);
+                    }
+                }
+
+                const std::uint64_t hole = transport.receivedHole();
+                const std::uint64_t kept = transport.receivedUnchanged();
+                if (hole > 0 or kept > 0) {
+                    // Everything before the range is written and released first
+                    for (; inFlight > 0; --inFlight) {
+                        complete();
+                    }
+                    if (std::optional<std::uint32_t> expected = transport.receivedChecksum()) {
+                        // Unchanged blocks are checked against the checksums taken while hashing the target
+                        const std::uint64_t block = received / transport.chunkSize();
+                        const std::optional<std::uint32_t> checksum = hole > 0 ? std::optional<std::uint32_t>(crc32cZeros(hole))
+                            : block < targetChecksums.size() ? std::optional<std::uint32_t>(targetChecksums[block]) : std::nullopt;
+                        if (checksum != expected) {
+                            throw std::runtime_error(std::string("Checksum mismatch in the ") + (hole > 0 ? "hole" : "unchanged block")
+                                + " at offset " + std::to_string(received));
+                        }
+                        digest = crc32cCombine(digest, *expected, hole + kept);
+                        verified = true;
+                    }
+                    received += hole + kept;
+                    unchanged += kept;
+                    if (checkpoint and hole > 0) {
+                        prefix = crc32cCombine(prefix, crc32cZeros(hole), hole);
+                    }
+
+                    writing.start();
+                    if (hole > 0) {
+                        destination.writeHole(hole);
+                    } else {
+                        destination.skipUnchanged(kept);
+                    }
+                    writing.pass();
+                    transport.releaseData();
+                    checkpointIfDue();
+                    continue;
+                }
+
+                if (const std::uint64_t original = transport.receivedOriginalSize(); original > 0) {
+                    const std::size_t chunkSize = transport.chunkSize();
+                    if (original > chunkSize) {
+                        throw std::runtime_error("Compressed chunk at offset " + std::to_string(received) + " is larger than a chunk");
+                    }
+                    if (!decompressed) {
+                        // Page aligned, so that O_DIRECT destinations can write from it too
+                        const std::size_t size = (depth * chunkSize + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+                        decompressed.reset(static_cast<char*>(std::aligned_alloc(SLOT_ALIGNMENT, size)));
+                        if (!decompressed) {
+                            throw std::bad_alloc();
+                        }
+                    }
+                    std::span<char> target(decompressed.get() + submitted % depth * chunkSize, original);
+                    ScopedStage decompressing(transport.stats(), EStage::E_Decompress);
+                    decompress(buffer, target);
+                    buffer = target;
+                }
+
+                // Checked before the data is handed to the destination
+                std::optional<std::uint32_t> checksum;
+                if (std::optional<std::uint32_t> expected = transport.receivedChecksum()) {
+                    checksum = crc32c(0, buffer);
+                    if (*checksum != *expected) {
+                        throw std::runtime_error("Checksum mismatch in the chunk at offset " + std::to_string(received)
+                            + ": expected " + formatChecksum(*expected) + ", got " + formatChecksum(*checksum));
+                    }
+                    digest = crc32cCombine(digest, *checksum, buffer.size());
+                    verified = true;
+                }
+                if (checkpoint) {
+                    prefix = checksum ? crc32cCombine(prefix, *checksum, buffer.size()) : crc32c(prefix, buffer);
+                }
+                received += buffer.size();
+
+                writing.start();
+                destination.submitChunk(buffer);
+                writing.stop();
+                ++submitted;
+                ++inFlight;
+                checkpointIfDue();
+                if (inFlight < depth)
+                    continue;
+            } else if (inFlight == 0) {
+                continue;
+            }
+
+            complete();
+            --inFlight;
+        }
+
+        for (; inFlight > 0; --inFlight) {
+            complete();
+        }
+        destination.finish();
+        if (checkpoint) {
+            checkpoint->remove();
+        }
+
+        if (patching) {
+            std::cout << "Kept " << unchanged << " of " << received << " bytes of the target unchanged" << std::endl;
+        }
+        if (verified) {
+            std::cout << "Received " << received << " bytes, " << formatChecksum(digest) << " verified" << std::endl;
+        }
+    }
+
+    // The loop through the interfaces is compiled once, in CopyPipeline.cc
+    extern template class CopyPipeline<IDataSource, IDataTransport, IDataDestination>;
+
+} // namespace cp
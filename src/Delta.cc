@@ -0,0 +1,139 @@
+#include "Delta.h"
+#include "Checksum.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp {
+
+    namespace {
+
+        constexpr std::uint64_t PRIME1 = 0x9E3779B185EBCA87;
+        constexpr std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4F;
+        constexpr std::uint64_t PRIME3 = 0x165667B19E3779F9;
+        constexpr std::uint64_t PRIME4 = 0x85EBCA77C2B2AE63;
+        constexpr std::uint64_t PRIME5 = 0x27D4EB2F165667C5;
+
+        std::uint64_t read64(const char* data) {
+            std::uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint32_t read32(const char* data) {
+            std::uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint64_t round(std::uint64_t accumulator, std::uint64_t input) {
+            return std::rotl(accumulator + input * PRIME2, 31) * PRIME1;
+        }
+
+        std::uint64_t merge(std::uint64_t hash, std::uint64_t accumulator) {
+            return (hash ^ round(0, accumulator)) * PRIME1 + PRIME4;
+        }
+
+    } // namespace
+
+    bool BlockSignature::matches(std::uint64_t offset, std::span<const char> data) const {
+        if (blockSize == 0 or offset % blockSize != 0 or offset >= fileSize) {
+            return false;
+        }
+        const std::uint64_t index = offset / blockSize;
+        if (index >= hashes.size() or data.size() != std::min<std::uint64_t>(blockSize, fileSize - offset)) {
+            return false;
+        }
+        return blockHash(data) == hashes[index];
+    }
+
+    std::uint64_t blockHash(std::span<const char> data) {
+        const char* input = data.data();
+        std::size_t size = data.size();
+        std::uint64_t hash;
+
+        if (size >= 32) {
+            // Four independent lanes keep the multipliers busy
+            std::uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+            for (; size >= 32; input += 32, size -= 32) {
+                for (int lane = 0; lane < 4; ++lane) {
+                    lanes[lane] = round(lanes[lane], read64(input + 8 * lane));
+                }
+            }
+            hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+            for (std::uint64_t lane : lanes) {
+                hash = merge(hash, lane);
+            }
+        } else {
+            hash = PRIME5;
+        }
+        hash += data.size();
+
+        for (; size >= 8; input += 8, size -= 8) {
+            hash = std::rotl(hash ^ round(0, read64(input)), 27) * PRIME1 + PRIME4;
+        }
+        if (size >= 4) {
+            hash = std::rotl(hash ^ (read32(input) * PRIME1), 23) * PRIME2 + PRIME3;
+            input += 4;
+            size -= 4;
+        }
+        for (; size > 0; ++input, --size) {
+            hash = std::rotl(hash ^ (static_cast<unsigned char>(*input) * PRIME5), 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    BlockSignature readSignature(int fd, std::size_t blockSize, std::vector<std::uint32_t>* checksums,
+                                 const std::function<void(std::uint64_t)>& progress) {
+        struct stat status{};
+        if (fstat(fd, &status) != 0) {
+            throw std::runtime_error(std::string("Failed to stat target file: ") + std::strerror(errno));
+        }
+
+        BlockSignature signature;
+        signature.fileSize = static_cast<std::uint64_t>(status.st_size);
+        signature.blockSize = blockSize;
+        signature.hashes.reserve((signature.fileSize + blockSize - 1) / blockSize);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        std::vector<char> block(blockSize);
+        for (std::uint64_t offset = 0; offset < signature.fileSize; ) {
+            const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(blockSize, signature.fileSize - offset));
+            for (std::size_t done = 0; done < length; ) {
+                ssize_t result = pread(fd, block.data() + done, length - done, static_cast<off_t>(offset + done));
+                if (result < 0 and errno == EINTR) {
+                    continue;
+                }
+                if (result <= 0) {
+                    throw std::runtime_error("Failed to read target file at offset " + std::to_string(offset + done)
+                        + (result < 0 ? std::string(": ") + std::strerror(errno) : std::string(": file shrank")));
+                }
+                done += static_cast<std::size_t>(result);
+            }
+
+            const std::span<const char> data(block.data(), length);
+            signature.hashes.push_back(blockHash(data));
+            if (checksums) {
+                checksums->push_back(crc32c(0, data));
+            }
+            offset += length;
+            progress(signature.hashes.size());
+        }
+        return signature;
+    }
+
+} // namespace cp
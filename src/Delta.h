@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace cp {
+
+    // Signature of an existing target: one hash per block of blockSize bytes, the last block may be shorter
+    struct BlockSignature {
+        std::uint64_t fileSize = 0;
+        std::size_t blockSize = 0;
+        std::vector<std::uint64_t> hashes;
+
+        // True if data starts a block of the target, has its length and hashes the same
+        bool matches(std::uint64_t offset, std::span<const char> data) const;
+    };
+
+    // xxHash64 of data with seed 0; guards against accidental changes, not crafted collisions
+    std::uint64_t blockHash(std::span<const char> data);
+
+    // Hashes the file behind fd block by block. checksums, if given, receives the CRC32C of every block.
+    // progress is called with the number of blocks hashed so far.
+    BlockSignature readSignature(int fd, std::size_t blockSize, std::vector<std::uint32_t>* checksums,
+                                 const std::function<void(std::uint64_t)>& progress);
+
+} // namespace cp
@@ -0,0 +1,268 @@
+#include "DirectoryDestination.h"
+#include "TreeRecord.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace cp
+{
+    namespace {
+
+        std::runtime_error systemError(const std::string& what) {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+        // Closes the descriptor when it leaves the scope, also on errors
+        struct Descriptor {
+            int fd;
+            ~Descriptor() {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        };
+
+        // Directories on the way are opened as paths only; a link or a file there fails with ELOOP or ENOTDIR
+        constexpr int WALK_FLAGS = O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+    } // namespace
+
+    DirectoryDestination::DirectoryDestination(std::string_view directory, std::size_t workerCount, EDurability durability)
+        : root_(fs::absolute(directory))
+        , rootFd_(-1)
+        , durability_(durability)
+        , workers_(std::max<std::size_t>(workerCount, 1))
+        , generation_(0)
+        , busy_(0)
+        , stopping_(false) {
+
+        fs::create_directories(root_);
+        rootFd_ = open(root_.c_str(), WALK_FLAGS & ~O_NOFOLLOW);
+        if (rootFd_ < 0) {
+            throw systemError("Failed to open target directory " + root_.string());
+        }
+
+        for (Worker& worker : workers_) {
+            threads_.emplace_back([this, &worker] { run(worker); });
+        }
+    }
+
+    DirectoryDestination::~DirectoryDestination() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+
+        // Only files of an interrupted copy are still open here
+        for (Worker& worker : workers_) {
+            for (auto& [path, file] : worker.files) {
+                close(file.fd);
+            }
+        }
+        close(rootFd_);
+    }
+
+    int DirectoryDestination::openParent(std::string_view path, std::string& name) const {
+        const fs::path relative(path);
+        std::vector<std::string> parts;
+        for (const fs::path& part : relative) {
+            if (part == "..") {
+                throw std::runtime_error("Path leaves the target directory: " + std::string(path));
+            }
+            if (!part.empty() and part != "." and part != "/") {
+                parts.push_back(part.string());
+            }
+        }
+        if (relative.is_absolute() or parts.empty()) {
+            throw std::runtime_error("Path leaves the target directory: " + std::string(path));
+        }
+
+        name = parts.back();
+        int parent = fcntl(rootFd_, F_DUPFD_CLOEXEC, 0);
+        if (parent < 0) {
+            throw systemError("Failed to open target directory " + root_.string());
+        }
+        for (std::size_t index = 0; index + 1 < parts.size(); ++index) {
+            const int next = openat(parent, parts[index].c_str(), WALK_FLAGS);
+            const int error = errno;
+            close(parent);
+            if (next < 0) {
+                errno = error;
+                throw systemError("Failed to open directory " + parts[index] + " of " + std::string(path));
+            }
+            parent = next;
+        }
+        return parent;
+    }
+
+    void DirectoryDestination::writeChunk(std::span<const char> buffer) {
+        std::size_t position = 0;
+
+        while (buffer.size() - position >= sizeof(TreeRecordHeader)) {
+            TreeRecordHeader header;
+            std::memcpy(&header, buffer.data() + position, sizeof(header));
+            if (header.magic != TREE_RECORD_MAGIC) {
+                throw std::runtime_error("Unexpected data in a directory copy; both processes need --recursive");
+            }
+
+            const std::size_t size = treeRecordSize(header.pathLength, header.length);
+            if (header.length > buffer.size() or size > buffer.size() - position) {
+                throw std::runtime_error("Truncated record in a directory copy");
+            }
+
+            const char* record = buffer.data() + position;
+            std::string_view path(record + sizeof(header), header.pathLength);
+            std::span<const char> payload(record + sizeof(header) + header.pathLength, header.length);
+            position += size;
+
+            // Directories and links are created right away, so they exist before anything below them
+            switch (header.type) {
+                case ETreeRecordType::E_Directory: {
+                    std::string name;
+                    Descriptor parent{openParent(path, name)};
+                    // Kept writable for us until the copy is done
+                    if (mkdirat(parent.fd, name.c_str(), header.mode | S_IRWXU) != 0 and errno != EEXIST) {
+                        throw systemError("Failed to create directory " + std::string(path));
+                    }
+                    // Whatever already has the name has to be a directory as well
+                    Descriptor directory{openat(parent.fd, name.c_str(), WALK_FLAGS)};
+                    if (directory.fd < 0) {
+                        throw systemError("Failed to create directory " + std::string(path));
+                    }
+                    if (durability_ != EDurability::E_None) {
+                        directories_.push_back(root_ / path);
+                    }
+                    break;
+                }
+                case ETreeRecordType::E_Symlink: {
+                    std::string name;
+                    Descriptor parent{openParent(path, name)};
+                    if (unlinkat(parent.fd, name.c_str(), 0) != 0 and errno == EISDIR) {
+                        unlinkat(parent.fd, name.c_str(), AT_REMOVEDIR);
+                    }
+                    if (symlinkat(std::string(payload.data(), payload.size()).c_str(), parent.fd, name.c_str()) != 0) {
+                        throw systemError("Failed to create link " + std::string(path));
+                    }
+                    break;
+                }
+                case ETreeRecordType::E_File: {
+                    Worker& worker = workers_[std::hash<std::string_view>()(path) % workers_.size()];
+                    worker.fragments.push_back({path, header.mode, header.fileSize, header.offset, payload});
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Unknown record type in a directory copy");
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            busy_ = workers_.size();
+            ++generation_;
+            wake_.notify_all();
+            done_.wait(lock, [this] { return busy_ == 0; });
+        }
+
+        for (Worker& worker : workers_) {
+            worker.fragments.clear();
+            if (std::exception_ptr error = std::exchange(worker.error, nullptr)) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    void DirectoryDestination::finish() {
+        if (durability_ == EDurability::E_None) {
+            return;
+        }
+        // Deepest first does not matter for fsync, every entry just has to reach the disk
+        for (const fs::path& directory : directories_) {
+            syncDirectory(directory.string());
+        }
+        syncDirectory(root_.string());
+        syncDirectory(root_.parent_path().string());
+    }
+
+    void DirectoryDestination::run(Worker& worker) {
+        std::uint64_t seen = 0;
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this, seen] { return stopping_ or generation_ != seen; });
+            if (stopping_) {
+                return;
+            }
+            seen = generation_;
+            lock.unlock();
+
+            try {
+                for (const Fragment& fragment : worker.fragments) {
+                    writeFragment(worker, fragment);
+                }
+            } catch (...) {
+                worker.error = std::current_exception();
+            }
+
+            lock.lock();
+            if (--busy_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void DirectoryDestination::writeFragment(Worker& worker, const Fragment& fragment) {
+        auto file = worker.files.find(std::string(fragment.path));
+        if (file == worker.files.end()) {
+            // The final mode is applied once the file is complete, it may not allow writing.
+            // A link sent in place of the file is not followed.
+            std::string name;
+            Descriptor parent{openParent(fragment.path, name)};
+            int fd = openat(parent.fd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (fd < 0) {
+                throw systemError("Failed to create file " + std::string(fragment.path));
+            }
+            file = worker.files.emplace(std::string(fragment.path), OpenFile{fd, 0}).first;
+            // Files split into several fragments are laid out up front
+            if (fragment.data.size() < fragment.fileSize) {
+                preallocate(fd, fragment.fileSize);
+            }
+        }
+
+        for (std::size_t done = 0; done < fragment.data.size();) {
+            ssize_t result = pwrite(file->second.fd, fragment.data.data() + done, fragment.data.size() - done, fragment.offset + done);
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result < 0) {
+                throw systemError("Failed to write file " + std::string(fragment.path));
+            }
+            done += static_cast<std::size_t>(result);
+        }
+
+        file->second.written += fragment.data.size();
+        if (file->second.written == fragment.fileSize) {
+            fchmod(file->second.fd, fragment.mode);
+            if (durability_ != EDurability::E_None and fdatasync(file->second.fd) != 0 and errno != EINVAL) {
+                throw systemError("Failed to sync file " + std::string(fragment.path));
+            }
+            close(file->second.fd);
+            worker.files.erase(file);
+        }
+    }
+
+} // namespace cp
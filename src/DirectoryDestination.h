@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Durability.h"
+#include "IDataDestination.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cp
+{
+    // Unpacks the records written by DirectorySource below a target directory.
+    // File fragments are written by a pool of workers; all fragments of one file go to the same worker.
+    class DirectoryDestination : public IDataDestination {
+    public:
+
+        DirectoryDestination(std::string_view directory, std::size_t workerCount, EDurability durability = EDurability::E_End);
+        ~DirectoryDestination() override;
+
+        void writeChunk(std::span<const char> buffer) override;
+        void finish() override;
+
+    private:
+        struct Fragment {
+            std::string_view path;
+            std::uint32_t mode;
+            std::uint64_t fileSize;
+            std::uint64_t offset;
+            std::span<const char> data;
+        };
+
+        struct OpenFile {
+            int fd;
+            std::uint64_t written;
+        };
+
+        // State owned by one worker thread
+        struct Worker {
+            std::vector<Fragment> fragments;
+            std::unordered_map<std::string, OpenFile> files;
+            std::exception_ptr error;
+        };
+
+        void run(Worker& worker);
+        void writeFragment(Worker& worker, const Fragment& fragment);
+
+        // Opens the directory holding a path from the stream and sets name to its last component.
+        // The path is walked from the target directory without following links, so neither a
+        // link nor a ".." sent by the reader can lead anywhere else.
+        int openParent(std::string_view path, std::string& name) const;
+
+        std::filesystem::path root_;
+        int rootFd_;
+        // Files are synced by their worker before they are closed, directories at the end
+        EDurability durability_;
+        std::vector<std::filesystem::path> directories_;
+
+        std::vector<Worker> workers_;
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        std::uint64_t generation_;
+        std::size_t busy_;
+        bool stopping_;
+    };
+
+} // namespace cp
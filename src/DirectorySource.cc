@@ -0,0 +1,174 @@
+#include "DirectorySource.h"
+#include "TreeRecord.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace cp
+{
+    namespace {
+
+        // Writes the header and the path; the payload follows directly after them
+        char* packRecord(std::span<char> free, ETreeRecordType type, const std::string& path, std::uint32_t mode,
+                         std::uint64_t fileSize, std::uint64_t offset, std::uint64_t length) {
+            TreeRecordHeader header{};
+            header.magic = TREE_RECORD_MAGIC;
+            header.type = type;
+            header.pathLength = static_cast<std::uint16_t>(path.size());
+            header.mode = mode;
+            header.fileSize = fileSize;
+            header.offset = offset;
+            header.length = length;
+
+            std::memcpy(free.data(), &header, sizeof(header));
+            std::memcpy(free.data() + sizeof(header), path.data(), path.size());
+            return free.data() + sizeof(header) + path.size();
+        }
+
+        std::uint32_t modeOf(const fs::file_status& status) {
+            return static_cast<std::uint32_t>(status.permissions()) & 07777;
+        }
+
+    } // namespace
+
+    DirectorySource::DirectorySource(std::string_view directory)
+        : root_(directory) {
+
+        if (!fs::is_directory(root_)) {
+            throw std::runtime_error("Source is not a directory: " + std::string(directory));
+        }
+        walk_ = fs::recursive_directory_iterator(root_);
+    }
+
+    DirectorySource::~DirectorySource() {
+        closeFile();
+    }
+
+    void DirectorySource::closeFile() {
+        if (file_) {
+            close(file_->fd);
+            file_.reset();
+        }
+    }
+
+    bool DirectorySource::readChunk(std::span<char> buffer, std::size_t& bytesRead) {
+        std::size_t used = 0;
+
+        while (true) {
+            if (file_) {
+                if (!packFile(buffer.subspan(used), used)) {
+                    break;
+                }
+                continue;
+            }
+
+            if (!next_) {
+                if (walk_ == fs::recursive_directory_iterator()) {
+                    break;
+                }
+                next_ = *walk_;
+                ++walk_;
+            }
+
+            if (!packEntry(*next_, buffer.subspan(used), used)) {
+                break;
+            }
+            next_.reset();
+        }
+
+        if (used == 0 and (file_ or next_)) {
+            throw std::runtime_error("Chunk is too small for the path of " + (file_ ? file_->path : next_->path().string()));
+        }
+
+        bytesRead = used;
+        return used > 0;
+    }
+
+    bool DirectorySource::packEntry(const fs::directory_entry& entry, std::span<char> free, std::size_t& used) {
+        const std::string path = entry.path().lexically_relative(root_).generic_string();
+        if (path.size() > std::numeric_limits<std::uint16_t>::max()) {
+            throw std::runtime_error("Path is too long: " + path);
+        }
+
+        const fs::file_status status = entry.symlink_status();
+
+        if (fs::is_symlink(status)) {
+            const std::string target = fs::read_symlink(entry.path()).string();
+            const std::size_t size = treeRecordSize(path.size(), target.size());
+            if (size > free.size()) {
+                return false;
+            }
+            char* payload = packRecord(free, ETreeRecordType::E_Symlink, path, 0, target.size(), 0, target.size());
+            std::memcpy(payload, target.data(), target.size());
+            used += size;
+            return true;
+        }
+
+        if (fs::is_directory(status)) {
+            const std::size_t size = treeRecordSize(path.size(), 0);
+            if (size > free.size()) {
+                return false;
+            }
+            packRecord(free, ETreeRecordType::E_Directory, path, modeOf(status), 0, 0, 0);
+            used += size;
+            return true;
+        }
+
+        if (fs::is_regular_file(status)) {
+            int fd = open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat fileStatus{};
+            if (fd < 0 or fstat(fd, &fileStatus) != 0) {
+                const std::string error = std::strerror(errno);
+                if (fd >= 0) {
+                    close(fd);
+                }
+                throw std::runtime_error("Failed to open source file " + entry.path().string() + ": " + error);
+            }
+            file_ = OpenFile{fd, path, modeOf(status), static_cast<std::uint64_t>(fileStatus.st_size), 0};
+            return true;
+        }
+
+        // Sockets, fifos and devices are not copied
+        return true;
+    }
+
+    bool DirectorySource::packFile(std::span<char> free, std::size_t& used) {
+        const std::uint64_t remaining = file_->size - file_->offset;
+        if (treeRecordSize(file_->path.size(), std::min<std::uint64_t>(remaining, 1)) > free.size()) {
+            return false;
+        }
+
+        // Whatever fits of the file goes into this chunk, the rest into the following ones
+        const std::size_t available = free.size() - sizeof(TreeRecordHeader) - file_->path.size();
+        const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, available));
+
+        char* payload = packRecord(free, ETreeRecordType::E_File, file_->path, file_->mode, file_->size, file_->offset, length);
+        for (std::size_t done = 0; done < length;) {
+            ssize_t result = pread(file_->fd, payload + done, length - done, file_->offset + done);
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                throw std::runtime_error("Failed to read source file " + file_->path);
+            }
+            done += static_cast<std::size_t>(result);
+        }
+
+        used += treeRecordSize(file_->path.size(), length);
+        file_->offset += length;
+        if (file_->offset == file_->size) {
+            closeFile();
+        }
+        return true;
+    }
+
+} // namespace cp
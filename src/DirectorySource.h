@@ -0,0 +1,46 @@
+#pragma once
+
+#include "IDataSource.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace cp
+{
+    // Walks a directory tree and packs its entries into chunks of framed records (see TreeRecord.h)
+    class DirectorySource : public IDataSource {
+    public:
+
+        explicit DirectorySource(std::string_view directory);
+        ~DirectorySource() override;
+
+        bool readChunk(std::span<char> buffer, std::size_t& bytesRead) override;
+
+    private:
+        // File whose data is being packed, possibly across several chunks
+        struct OpenFile {
+            int fd;
+            std::string path;
+            std::uint32_t mode;
+            std::uint64_t size;
+            std::uint64_t offset;
+        };
+
+        // Packs the next entry of the walk; false if it does not fit into the free space
+        bool packEntry(const std::filesystem::directory_entry& entry, std::span<char> free, std::size_t& used);
+        // Packs the next fragment of the open file; false if not even one byte fits
+        bool packFile(std::span<char> free, std::size_t& used);
+
+        void closeFile();
+
+        std::filesystem::path root_;
+        std::filesystem::recursive_directory_iterator walk_;
+        // Entry taken from the walk that did not fit into the previous chunk
+        std::optional<std::filesystem::directory_entry> next_;
+        std::optional<OpenFile> file_;
+    };
+
+} // namespace cp
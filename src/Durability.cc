@@ -0,0 +1,108 @@
+#include "Durability.h"
+#include "Constants.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+namespace cp {
+
+    namespace {
+
+        std::system_error failure(const std::string& what) {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        // Errors of file systems or descriptors that do not support the call
+        bool unsupported(int error) {
+            return error == EOPNOTSUPP or error == ENOSYS or error == EINVAL or error == ESPIPE;
+        }
+
+    } // namespace
+
+    void preallocate(int fd, std::uint64_t size) {
+        if (size > 0 and fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) != 0
+            and !unsupported(errno)) {
+            throw failure("Failed to allocate target file");
+        }
+    }
+
+    void punchHole(int fd, std::uint64_t offset, std::uint64_t length) {
+        if (length > 0 and fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                                     static_cast<off_t>(length)) != 0
+            and !unsupported(errno)) {
+            throw failure("Failed to punch a hole in target file");
+        }
+    }
+
+    void syncDirectory(const std::string& path) {
+        const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            throw failure("Failed to open directory " + path);
+        }
+        const int result = fsync(fd);
+        const int error = errno;
+        close(fd);
+        if (result != 0 and !unsupported(error)) {
+            errno = error;
+            throw failure("Failed to sync directory " + path);
+        }
+    }
+
+    WriteBehind::WriteBehind(int fd, EDurability durability, std::uint64_t offset, bool flush)
+        : fd_(fd)
+        , durability_(durability)
+        , flush_(flush)
+        , offset_(offset)
+        , flushed_(offset)
+        , writing_(offset)
+        , synced_(offset) {
+    }
+
+    void WriteBehind::advance(std::uint64_t offset) {
+        offset_ = offset;
+
+        while (flush_ and offset_ - writing_ >= WRITE_BEHIND_WINDOW) {
+            if (sync_file_range(fd_, static_cast<off_t>(writing_), WRITE_BEHIND_WINDOW, SYNC_FILE_RANGE_WRITE) != 0) {
+                if (!unsupported(errno)) {
+                    throw failure("Failed to write back target file");
+                }
+                flush_ = false;
+                break;
+            }
+
+            // The previous window had a whole window's worth of writing to get to the disk
+            if (writing_ > flushed_) {
+                const off_t length = static_cast<off_t>(writing_ - flushed_);
+                if (sync_file_range(fd_, static_cast<off_t>(flushed_), length,
+                                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+                    throw failure("Failed to write back target file");
+                }
+                posix_fadvise(fd_, static_cast<off_t>(flushed_), length, POSIX_FADV_DONTNEED);
+                flushed_ = writing_;
+            }
+            writing_ += WRITE_BEHIND_WINDOW;
+        }
+
+        if (durability_ == EDurability::E_Periodic and offset_ - synced_ >= DURABILITY_INTERVAL) {
+            sync();
+        }
+    }
+
+    void WriteBehind::finish() {
+        if (durability_ != EDurability::E_None) {
+            sync();
+        }
+    }
+
+    void WriteBehind::sync() {
+        if (fdatasync(fd_) != 0 and !unsupported(errno)) {
+            throw failure("Failed to sync target file");
+        }
+        synced_ = offset_;
+    }
+
+} // namespace cp
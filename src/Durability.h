@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cp {
+
+    // When the writer makes the target durable with fdatasync
+    enum class EDurability {
+        E_None = 0,     // never, the kernel writes it back whenever it likes
+        E_End,          // once everything is written, before the copy reports success
+        E_Periodic      // every DURABILITY_INTERVAL bytes, and at the end
+    };
+
+    // Allocates the blocks of a file that is going to be size bytes long, without changing its size,
+    // so a large target is laid out in few extents. Ignored where the file system cannot do it.
+    void preallocate(int fd, std::uint64_t size);
+
+    // Gives back the blocks of a preallocated range that stays a hole
+    void punchHole(int fd, std::uint64_t offset, std::uint64_t length);
+
+    // Makes the entries of a directory durable, e.g. the name of a file created in it
+    void syncDirectory(const std::string& path);
+
+    // Writes a sequentially written file back behind the writer, so dirty pages never pile up:
+    // every WRITE_BEHIND_WINDOW bytes the writeback of the new window is started, and the window
+    // before it is waited for and dropped from the page cache. Syncs as the policy says.
+    class WriteBehind {
+    public:
+        // Writing starts at offset; without flush (O_DIRECT files bypass the page cache) only
+        // the policy is applied
+        WriteBehind(int fd, EDurability durability, std::uint64_t offset = 0, bool flush = true);
+
+        // Everything before offset is written, as data or as a hole
+        void advance(std::uint64_t offset);
+
+        // Everything is written: syncs unless the policy is E_None. May be called again.
+        void finish();
+
+        // Everything before this offset has been synced
+        [[nodiscard]]
+        inline std::uint64_t durable() const {
+            return synced_;
+        }
+
+        // Syncs everything written so far, whatever the policy
+        void sync();
+
+    private:
+        int fd_;
+        EDurability durability_;
+        bool flush_;
+        std::uint64_t offset_;
+        // [flushed_, writing_) is being written back, everything before flushed_ is dropped
+        std::uint64_t flushed_;
+        std::uint64_t writing_;
+        std::uint64_t synced_;
+    };
+
+} // namespace cp
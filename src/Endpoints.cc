@@ -0,0 +1,80 @@
+#include "Endpoints.h"
+
+#include "DirectoryDestination.h"
+#include "DirectorySource.h"
+#include "FileDestination.h"
+#include "FileSource.h"
+#include "IoUring.h"
+#include "MappedFileDestination.h"
+#include "MappedFileSource.h"
+#include "PipeDestination.h"
+#include "PipeSource.h"
+#include "UringFileDestination.h"
+#include "UringFileSource.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace cp {
+
+    namespace {
+
+        bool useUring(const Options& options) {
+            if (options.io != EIoBackend::E_Uring) {
+                return false;
+            }
+            if (!IoUring::supported()) {
+                std::cout << "io_uring is not available, falling back to stream I/O" << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // More requests than slots could never be in flight at once
+        std::size_t queueDepth(const Options& options, const std::vector<std::span<char>>& buffers) {
+            return buffers.empty() ? options.queueDepth : std::min(options.queueDepth, buffers.size());
+        }
+
+    } // namespace
+
+    IDataSource::Ptr makeSource(const Options& options, IDataTransport& transport) {
+        if (options.recursive) {
+            return std::make_unique<DirectorySource>(options.source);
+        }
+        if (std::optional<int> fd = parseDescriptor(options.source, STDIN_FILENO)) {
+            return std::make_unique<PipeSource>(*fd);
+        }
+        if (useUring(options)) {
+            std::vector<std::span<char>> buffers = transport.buffers();
+            return std::make_unique<UringFileSource>(options.source, queueDepth(options, buffers), options.direct, buffers);
+        }
+        if (options.io == EIoBackend::E_Mmap) {
+            return std::make_unique<MappedFileSource>(options.source);
+        }
+        return std::make_unique<FileSource>(options.source);
+    }
+
+    IDataDestination::Ptr makeDestination(const Options& options, IDataTransport& transport) {
+        if (options.recursive) {
+            std::size_t workers = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MAX_UNPACK_WORKERS);
+            return std::make_unique<DirectoryDestination>(options.target, workers, options.durability);
+        }
+        if (std::optional<int> fd = parseDescriptor(options.target, STDOUT_FILENO)) {
+            return std::make_unique<PipeDestination>(*fd);
+        }
+        // A resumed copy keeps the target until the writer knows how much of it to keep
+        const bool patch = options.delta or options.resume;
+        if (useUring(options)) {
+            std::vector<std::span<char>> buffers = transport.buffers();
+            return std::make_unique<UringFileDestination>(options.target, queueDepth(options, buffers), options.direct, buffers, patch, options.durability);
+        }
+        if (options.io == EIoBackend::E_Mmap) {
+            return std::make_unique<MappedFileDestination>(options.target, patch, options.durability);
+        }
+        return std::make_unique<FileDestination>(options.target, patch, options.durability);
+    }
+
+} // namespace cp
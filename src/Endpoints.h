@@ -0,0 +1,14 @@
+#pragma once
+
+#include "IDataDestination.h"
+#include "IDataSource.h"
+#include "IDataTransport.h"
+#include "Options.h"
+
+namespace cp {
+
+    // Create the source or destination selected by the options, working on the transport's buffers
+    IDataSource::Ptr makeSource(const Options& options, IDataTransport& transport);
+    IDataDestination::Ptr makeDestination(const Options& options, IDataTransport& transport);
+
+} // namespace cp
@@ -1,25 +1,63 @@
 #include "FileDestination.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
 namespace cp
 {
-    FileDestination::FileDestination(std::string_view filename) 
-        : file_(filename.data(), std::ios::binary) {
-        
-        if (!file_) {
-            throw std::runtime_error("Failed to open target file: " + std::string(filename));
-        }
+    FileDestination::FileDestination(std::string_view filename, bool patch, EDurability durability)
+        : target_(filename, O_WRONLY, patch, durability)
+        , offset_(0) {
+    }
+
+    void FileDestination::reserve(std::uint64_t size) {
+        target_.reserve(size);
     }
 
     void FileDestination::writeChunk(std::span<const char> buffer) {
-        if (!file_) {
-            throw std::runtime_error("Target file is not open");
+        while (!buffer.empty()) {
+            ssize_t result = pwrite(target_.fd(), buffer.data(), buffer.size(), static_cast<off_t>(offset_));
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                throw std::runtime_error(std::string("Failed to write to target file: ") + std::strerror(errno));
+            }
+            buffer = buffer.subspan(static_cast<std::size_t>(result));
+            offset_ += static_cast<std::uint64_t>(result);
         }
+        target_.advance(offset_);
+    }
 
-        file_.write(buffer.data(), buffer.size());
+    void FileDestination::writeHole(std::uint64_t length) {
+        target_.writeHole(offset_, length);
+        offset_ += length;
+    }
 
-        if (!file_) {
-            throw std::runtime_error("Failed to write to target file");
-        }
+    void FileDestination::skipUnchanged(std::uint64_t length) {
+        offset_ += length;
+        target_.advance(offset_);
     }
- 
+
+    void FileDestination::resume(std::uint64_t offset) {
+        target_.resume(offset);
+        offset_ = offset;
+    }
+
+    void FileDestination::sync() {
+        target_.sync();
+    }
+
+    std::optional<std::string> FileDestination::localPath() const {
+        return target_.path();
+    }
+
+    void FileDestination::finish() {
+        target_.finish();
+    }
+
 } // namespace cp
@@ -1,18 +1,32 @@
 #pragma once
 
-#include <fstream>
 #include "IDataDestination.h"
+#include "TargetFile.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
 
 namespace cp
 {
-    class FileDestination : public IDataDestination {
+    class FileDestination final : public IDataDestination {
     public:
 
-        explicit FileDestination(std::string_view filename);
+        // With patch an existing file is overwritten in place instead of truncated
+        explicit FileDestination(std::string_view filename, bool patch = false, EDurability durability = EDurability::E_End);
+
+        void reserve(std::uint64_t size) override;
         void writeChunk(std::span<const char> buffer) override;
+        void writeHole(std::uint64_t length) override;
+        void skipUnchanged(std::uint64_t length) override;
+        void resume(std::uint64_t offset) override;
+        void sync() override;
+        std::optional<std::string> localPath() const override;
+        void finish() override;
 
     private:
-        std::ofstream file_;
-    }; 
+        TargetFile target_;
+        std::uint64_t offset_;
+    };
 
 } // namespace cp
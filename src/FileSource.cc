@@ -1,20 +1,78 @@
 #include "FileSource.h"
+#include "KernelCopy.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
 
 namespace cp
 {
     FileSource::FileSource(std::string_view filename) 
-        : file_(filename.data(), std::ios::binary) {
+        : filename_(filename)
+        , file_(filename_, std::ios::binary)
+        , offset_(0)
+        , extentsFd_(-1) {
         
         if (!file_) {
             throw std::runtime_error("Failed to open source file: " + std::string(filename));
         }
+
+        std::error_code error;
+        if (std::filesystem::is_regular_file(filename, error)) {
+            size_ = std::filesystem::file_size(filename, error);
+        }
+    }
+
+    FileSource::~FileSource() {
+        if (extentsFd_ >= 0) {
+            close(extentsFd_);
+        }
+    }
+
+    std::uint64_t FileSource::holeLength() {
+        if (!extents_) {
+            if (!size_ or (extentsFd_ = open(filename_.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+                return 0;
+            }
+            extents_.emplace(extentsFd_);
+        }
+        return extents_->holeAt(offset_);
+    }
+
+    void FileSource::skipHole() {
+        offset_ += holeLength();
+        file_.seekg(static_cast<std::streamoff>(offset_));
+    }
+
+    void FileSource::seek(std::uint64_t offset) {
+        offset_ = offset;
+        file_.seekg(static_cast<std::streamoff>(offset_));
+    }
+
+    std::optional<std::uint64_t> FileSource::size() const {
+        return size_;
+    }
+
+    std::optional<LocalFile> FileSource::localFile() const {
+        return describeLocalFile(filename_);
     }
 
     bool FileSource::readChunk(std::span<char> buffer, std::size_t& bytesRead) {
         if (!file_) return false;
 
-        file_.read(buffer.data(), buffer.size());
+        // Stop where the next hole starts, it is skipped rather than read
+        std::size_t count = buffer.size();
+        if (extents_) {
+            if (std::uint64_t data = extents_->dataAt(offset_)) {
+                count = static_cast<std::size_t>(std::min<std::uint64_t>(count, data));
+            }
+        }
+
+        file_.read(buffer.data(), count);
         bytesRead = static_cast<std::size_t>(file_.gcount());
+        offset_ += bytesRead;
 
         return bytesRead > 0;
     }
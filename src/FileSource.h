@@ -2,17 +2,31 @@
 
 #include <fstream>
 #include "IDataSource.h"
+#include "Sparse.h"
 
 namespace cp
 {
-    class FileSource : public IDataSource {
+    class FileSource final : public IDataSource {
     public:
 
         explicit FileSource(std::string_view filename);
+        ~FileSource() override;
         bool readChunk(std::span<char> buffer, std::size_t& bytesRead) override;
+        std::optional<std::uint64_t> size() const override;
+        std::optional<LocalFile> localFile() const override;
+
+        std::uint64_t holeLength() override;
+        void skipHole() override;
+        void seek(std::uint64_t offset) override;
 
     private:
+        std::string filename_;
         std::ifstream file_;
+        std::optional<std::uint64_t> size_;
+        std::uint64_t offset_;
+        // Opened on the first holeLength, the stream does not expose its descriptor
+        int extentsFd_;
+        std::optional<FileExtents> extents_;
     };
 
 } // namespace cp
\ No newline at end of file
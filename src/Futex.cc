@@ -0,0 +1,67 @@
+#include "Futex.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <thread>
+
+namespace cp {
+
+    namespace {
+
+        long futex(std::atomic<std::uint32_t>& word, int operation, std::uint32_t value, const timespec* timeout) {
+            // Shared (non-private) futex: the word is mapped by both processes
+            return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), operation, value, timeout, nullptr, 0);
+        }
+
+    } // namespace
+
+    void FutexEvent::reset() {
+        sequence = 0;
+        waiters = 0;
+    }
+
+    void FutexEvent::notify() {
+        sequence.fetch_add(1);
+        if (waiters.load() != 0) {
+            futex(sequence, FUTEX_WAKE, INT_MAX, nullptr);
+        }
+    }
+
+    AdaptiveWaiter::AdaptiveWaiter()
+        : maxSpin_(std::thread::hardware_concurrency() > 1 ? MAX_SPIN : 0)
+        , spinLimit_(std::min(MIN_SPIN, maxSpin_)) {
+    }
+
+    bool AdaptiveWaiter::sleep(FutexEvent& event, std::uint32_t sequence, std::chrono::steady_clock::time_point deadline) {
+        auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::nanoseconds::zero()) {
+            return false;
+        }
+
+        // FUTEX_WAIT takes a relative timeout measured against CLOCK_MONOTONIC
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+        timespec timeout{
+            static_cast<time_t>(seconds.count()),
+            static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining - seconds).count())};
+
+        if (futex(event.sequence, FUTEX_WAIT, sequence, &timeout) == -1 and errno == ETIMEDOUT) {
+            return false;
+        }
+        // Woken up, value already changed (EAGAIN) or interrupted: let the caller re-check
+        return true;
+    }
+
+    void AdaptiveWaiter::pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+} // namespace cp
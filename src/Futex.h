@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cp {
+
+    // Wake-up channel living in shared memory. A waiter sleeps on the sequence
+    // word with a process-shared futex; a notifier bumps the sequence and only
+    // enters the kernel when somebody is registered as waiting.
+    struct FutexEvent {
+        std::atomic<std::uint32_t> sequence;
+        std::atomic<std::uint32_t> waiters;
+
+        void reset();
+        void notify();
+    };
+
+    // Waits on a FutexEvent: spins with a pause hint first, then sleeps on the futex.
+    // The spin budget adapts to how often spinning alone was enough.
+    class AdaptiveWaiter {
+    public:
+        AdaptiveWaiter();
+
+        // Returns false if the predicate still does not hold after the timeout
+        template <typename Predicate>
+        bool wait(FutexEvent& event, std::chrono::nanoseconds timeout, Predicate predicate);
+
+    private:
+        bool sleep(FutexEvent& event, std::uint32_t sequence, std::chrono::steady_clock::time_point deadline);
+        static void pause();
+
+        static constexpr std::uint32_t MIN_SPIN = 16;
+        static constexpr std::uint32_t MAX_SPIN = 4096;
+
+        // Zero on a single CPU, where the other side cannot make progress while we spin
+        std::uint32_t maxSpin_;
+        std::uint32_t spinLimit_;
+    };
+
+    template <typename Predicate>
+    bool AdaptiveWaiter::wait(FutexEvent& event, std::chrono::nanoseconds timeout, Predicate predicate) {
+        for (std::uint32_t spin = 0; spin < spinLimit_; ++spin) {
+            if (predicate()) {
+                spinLimit_ = std::min<std::uint32_t>(spinLimit_ * 2, maxSpin_);
+                return true;
+            }
+            pause();
+        }
+
+        spinLimit_ = std::min<std::uint32_t>(std::max<std::uint32_t>(spinLimit_ / 2, MIN_SPIN), maxSpin_);
+
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            // Register before re-checking so that a notifier either sees us or we see its update
+            const std::uint32_t sequence = event.sequence.load();
+            event.waiters.fetch_add(1);
+
+            if (predicate()) {
+                event.waiters.fetch_sub(1);
+                return true;
+            }
+
+            bool inTime = sleep(event, sequence, deadline);
+            event.waiters.fetch_sub(1);
+
+            if (!inTime) {
+                return predicate();
+            }
+        }
+    }
+
+} // namespace cp
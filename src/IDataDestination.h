@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <span>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
 
 namespace cp {
 
@@ -11,6 +16,57 @@ namespace cp {
 
         virtual void writeChunk(std::span<const char> buffer) = 0;
         virtual ~IDataDestination() = default;
+
+        // Called before the first chunk with the total number of bytes that will be written
+        virtual void reserve(std::uint64_t /*size*/) {}
+
+        // Skips length bytes of zeros. Called with no writes outstanding. The default writes the zeros.
+        virtual void writeHole(std::uint64_t length);
+
+        // Leaves the next length bytes of the target as they are, for a delta copy. Called with no writes
+        // outstanding. Only destinations opened to patch an existing file support it.
+        virtual void skipUnchanged(std::uint64_t /*length*/) {
+            throw std::logic_error("Destination cannot keep data of an existing target");
+        }
+
+        // Continues a copy that stopped after the first offset bytes of an existing target, which
+        // the destination was opened to patch: drops whatever follows them, 0 starts it over.
+        // Called before the first chunk. Only file destinations support it.
+        virtual void resume(std::uint64_t /*offset*/) {
+            throw std::logic_error("Destination cannot resume a copy");
+        }
+
+        // Makes everything written and completed so far durable, for a checkpoint
+        virtual void sync() {
+            throw std::logic_error("Destination cannot sync what it wrote");
+        }
+
+        // Path of the regular file behind the destination, if the kernel may write it directly
+        virtual std::optional<std::string> localPath() const { return std::nullopt; }
+
+        // Pipelined writes: up to queueDepth buffers may be submitted before the oldest is completed.
+        // Once completeChunk returns, the oldest submitted buffer may be reused.
+        // The default implementation writes synchronously on submission.
+        virtual std::size_t queueDepth() const { return 1; }
+
+        virtual void submitChunk(std::span<const char> buffer) {
+            writeChunk(buffer);
+        }
+
+        virtual void completeChunk() {}
+
+        // Called once everything is written and completed, before the copy reports success: makes
+        // the target as durable as the destination was asked to. Throws if it cannot.
+        virtual void finish() {}
     };
 
-} // namespace cp
\ No newline at end of file
+    inline void IDataDestination::writeHole(std::uint64_t length) {
+        static const char zeros[64 * 1024] = {};
+        while (length > 0) {
+            const std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(length, sizeof(zeros)));
+            writeChunk(std::span<const char>(zeros, count));
+            length -= count;
+        }
+    }
+
+} // namespace cp
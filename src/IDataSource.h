@@ -1,7 +1,12 @@
 #pragma once
 
 #include <span>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+
+#include "LocalFile.h"
 
 namespace cp {
 
@@ -11,6 +16,44 @@ namespace cp {
 
         virtual bool readChunk(std::span<char> buffer, std::size_t& bytesRead) = 0;
         virtual ~IDataSource() = default;
+
+        // Number of bytes the source will produce, if known in advance
+        virtual std::optional<std::uint64_t> size() const { return std::nullopt; }
+
+        // The regular file behind the source, if the kernel may copy it directly
+        virtual std::optional<LocalFile> localFile() const { return std::nullopt; }
+
+        // Sparse files: length of the hole at the position of the next read, 0 if data follows.
+        // Once asked, reads stop where the next hole starts. Only called with no reads outstanding
+        // when a hole is skipped, see skipHole.
+        virtual std::uint64_t holeLength() { return 0; }
+        // Moves the read position past the hole reported by holeLength
+        virtual void skipHole() {}
+
+        // Continues reading at offset, for a copy that resumes; only called before the first read
+        virtual void seek(std::uint64_t /*offset*/) {
+            throw std::logic_error("Source cannot seek");
+        }
+
+        // Pipelined reads: up to queueDepth buffers may be submitted before the oldest is completed.
+        // completeChunk returns the filled part of the oldest submitted buffer, empty at the end of data.
+        // The default implementation reads synchronously on completion.
+        virtual std::size_t queueDepth() const { return 1; }
+
+        virtual void submitChunk(std::span<char> buffer) {
+            pending_ = buffer;
+        }
+
+        virtual std::span<char> completeChunk() {
+            std::size_t bytesRead = 0;
+            if (!readChunk(pending_, bytesRead)) {
+                bytesRead = 0;
+            }
+            return pending_.first(bytesRead);
+        }
+
+    private:
+        std::span<char> pending_;
     };
 
-} // namespace cp
\ No newline at end of file
+} // namespace cp
@@ -1,22 +1,145 @@
 #pragma once
 
 #include <span>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <vector>
+
+#include "Constants.h"
+#include "Delta.h"
+#include "LocalFile.h"
+#include "Stats.h"
+
 namespace cp {
 
+    enum class EStrategy {
+       E_Read = 0,
+       E_Write
+    };
+
+    // Size and number of the ring slots, chosen by the process that creates the segment.
+    // Every lane is an independent ring of slotCount slots, delivered to consumerCount writers.
+    struct Geometry {
+        std::size_t chunkSize = DEFAULT_CHUNK_SIZE;
+        std::size_t slotCount = DEFAULT_SLOT_COUNT;
+        std::size_t laneCount = DEFAULT_LANE_COUNT;
+        std::size_t consumerCount = 1;
+    };
+
+    // Outcome of offering the source file for a copy inside the kernel
+    enum class EOffloadState : std::uint32_t {
+        E_Pending = 0,  // the reader has not decided yet
+        E_NoOffer,      // the reader streams the data through the transport
+        E_Offered,      // the reader waits for the writer's answer
+        E_Declined,     // the writer cannot use the file, the reader streams the data
+        E_Accepted,     // the writer is copying, progress is reported
+        E_Done,
+        E_Failed
+    };
+
     class IDataTransport {
     public:
         using Ptr = std::unique_ptr<IDataTransport>;
         
         virtual ~IDataTransport() = default;
         
+        // Producer side: claims the next free buffer. Several buffers may be claimed
+        // before they are sent; sendData publishes them in the order they were claimed.
         virtual std::span<char> getBuffer() = 0;
+        // Like getBuffer, but returns an empty span instead of blocking
+        virtual std::span<char> tryGetBuffer() = 0;
 
         virtual void sendData(std::span<const char> buffer) = 0;
+
+        // Publishes the oldest claimed buffer as a hole: length bytes of zeros that are not sent.
+        // The consumer receives it as an empty buffer (with a valid data pointer) and learns
+        // the length from receivedHole; the buffer is released like any other.
+        virtual void sendHole(std::span<const char> buffer, std::uint64_t length) = 0;
+
+        // Publishes the oldest claimed buffer as length bytes the consumer already has in its target
+        // at this position, see requestSignature. Received like a hole, the length from receivedUnchanged.
+        virtual void sendUnchanged(std::span<const char> buffer, std::uint64_t length) = 0;
+
+        // Publishes the oldest claimed buffer holding buffer.size() bytes that decompress to originalSize
+        // bytes, see Codec.h. The consumer receives the compressed bytes and learns the size from
+        // receivedOriginalSize.
+        virtual void sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) = 0;
+
+        // Checksum travelling with the next buffer sent; the consumer reads it with receivedChecksum.
+        // Transports without room for it drop it.
+        virtual void setChecksum(std::uint32_t /*checksum*/) {}
+
+        // Consumer side: acquires the next published buffer, or an empty span without data once finished.
+        // Acquired buffers stay valid until they are handed back with releaseData, oldest first.
         virtual std::span<const char> receiveData() = 0;
+        // Like receiveData, but returns an empty span instead of blocking
+        virtual std::span<const char> tryReceiveData() = 0;
+        virtual void releaseData() = 0;
+
+        // Length of the hole described by the buffer returned by the last receiveData/tryReceiveData,
+        // 0 if it carries data
+        virtual std::uint64_t receivedHole() const { return 0; }
+
+        // Length of the unchanged range described by the buffer returned by the last receiveData/tryReceiveData,
+        // 0 if it carries data
+        virtual std::uint64_t receivedUnchanged() const { return 0; }
+
+        // Size before compression of the buffer returned by the last receiveData/tryReceiveData,
+        // 0 if it is not compressed
+        virtual std::uint64_t receivedOriginalSize() const { return 0; }
+
+        // Checksum of the buffer returned by the last receiveData/tryReceiveData, if the producer set one
+        virtual std::optional<std::uint32_t> receivedChecksum() const { return std::nullopt; }
 
         virtual bool hasFinished() = 0;
         virtual void finish() = 0;
+
+        // Total number of bytes the producer is going to send, published before the first buffer
+        // so the consumer can size its target up front. std::nullopt if unknown.
+        virtual void setTotalSize(std::optional<std::uint64_t> size) = 0;
+        virtual std::optional<std::uint64_t> totalSize() const = 0;
+
+        // Kernel offload negotiation. The producer always calls offerLocalFile before sending data,
+        // with std::nullopt if it has nothing to offer; it returns true once the consumer has copied
+        // the file itself. The consumer learns about the offer from offeredLocalFile and answers
+        // with reportOffload. Transports that cannot negotiate never offer anything.
+        virtual bool offerLocalFile(const std::optional<LocalFile>& /*file*/) { return false; }
+        virtual std::optional<LocalFile> offeredLocalFile() { return std::nullopt; }
+        virtual void reportOffload(EOffloadState /*state*/, std::uint64_t /*progress*/ = 0) {}
+
+        // Delta negotiation. A producer that wants to patch the existing target calls requestSignature
+        // before offerLocalFile and later waits for the answer in receivedSignature; std::nullopt means
+        // everything has to be sent. Once the offer is settled the consumer checks signatureRequested
+        // and answers with sendSignature, which returns false if the signature does not fit the
+        // transport; reportSignatureProgress keeps the producer waiting while the target is hashed.
+        virtual void requestSignature() {}
+        virtual std::optional<BlockSignature> receivedSignature() { return std::nullopt; }
+        virtual bool signatureRequested() const { return false; }
+        virtual bool sendSignature(const std::optional<BlockSignature>& /*signature*/) { return false; }
+        virtual void reportSignatureProgress(std::uint64_t /*blocks*/) {}
+
+        // Resume negotiation, ordered like the delta one. A producer that continues an interrupted copy
+        // calls requestResume before offerLocalFile and later waits for receivedResumeOffset, the number
+        // of bytes the consumer kept at the start of its target; 0 means everything has to be sent.
+        // The consumer checks resumeRequested and answers with sendResumeOffset, after reporting
+        // with reportResumeProgress while it reads the kept prefix back.
+        virtual void requestResume() {}
+        virtual std::uint64_t receivedResumeOffset() { return 0; }
+        virtual bool resumeRequested() const { return false; }
+        virtual void sendResumeOffset(std::uint64_t /*offset*/) {}
+        virtual void reportResumeProgress(std::uint64_t /*bytes*/) {}
+
+        // Capacity of the buffers handed out by getBuffer
+        virtual std::size_t chunkSize() const = 0;
+
+        // All buffers the transport hands out, e.g. for registering them with the kernel.
+        // Empty if the transport does not use fixed buffers.
+        virtual std::vector<std::span<char>> buffers() { return {}; }
+
+        // Counters and stage histograms both sides record into, where an observer can read them
+        // while the copy runs. nullptr if the transport keeps none.
+        virtual CopyStats* stats() { return nullptr; }
     };
 
-} // namespace cp
\ No newline at end of file
+} // namespace cp
@@ -0,0 +1,252 @@
+#include "IoUring.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp {
+
+    namespace {
+
+        int setup(unsigned entries, io_uring_params& params) {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+
+        int registerResource(int fd, unsigned opcode, const void* arguments, unsigned count) {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arguments, count));
+        }
+
+        unsigned* field(void* ring, std::uint32_t offset) {
+            return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+        }
+
+        // The rings are shared with the kernel, so the cursors need acquire/release ordering
+        unsigned loadAcquire(unsigned* value) {
+            return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+        }
+
+        void storeRelease(unsigned* value, unsigned newValue) {
+            std::atomic_ref<unsigned>(*value).store(newValue, std::memory_order_release);
+        }
+
+        std::runtime_error systemError(const std::string& what) {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+    } // namespace
+
+    IoUring::IoUring(unsigned entries)
+        : fd_(-1)
+        , entries_(0)
+        , queued_(0)
+        , sqRing_(MAP_FAILED)
+        , sqRingSize_(0)
+        , cqRing_(MAP_FAILED)
+        , cqRingSize_(0)
+        , sqes_(nullptr)
+        , sqesSize_(0) {
+        io_uring_params params{};
+        fd_ = setup(entries, params);
+        if (fd_ < 0) {
+            throw systemError("io_uring_setup failed");
+        }
+        entries_ = params.sq_entries;
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sqRing_ == MAP_FAILED) {
+            int error = errno;
+            release();
+            errno = error;
+            throw systemError("Failed to map io_uring submission ring");
+        }
+
+        cqRing_ = singleMap ? sqRing_
+            : mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (cqRing_ == MAP_FAILED or sqes == MAP_FAILED) {
+            int error = errno;
+            if (sqes != MAP_FAILED) {
+                munmap(sqes, sqesSize_);
+            }
+            release();
+            errno = error;
+            throw systemError("Failed to map io_uring rings");
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        sqHead_ = field(sqRing_, params.sq_off.head);
+        sqTail_ = field(sqRing_, params.sq_off.tail);
+        sqMask_ = field(sqRing_, params.sq_off.ring_mask);
+        sqArray_ = field(sqRing_, params.sq_off.array);
+        cqHead_ = field(cqRing_, params.cq_off.head);
+        cqTail_ = field(cqRing_, params.cq_off.tail);
+        cqMask_ = field(cqRing_, params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cqRing_) + params.cq_off.cqes);
+    }
+
+    IoUring::~IoUring() {
+        release();
+    }
+
+    void IoUring::release() {
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqesSize_);
+        }
+        if (cqRing_ != MAP_FAILED and cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingSize_);
+        }
+        if (sqRing_ != MAP_FAILED) {
+            munmap(sqRing_, sqRingSize_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        sqes_ = nullptr;
+        cqRing_ = sqRing_ = MAP_FAILED;
+        fd_ = -1;
+    }
+
+    bool IoUring::supported() {
+        io_uring_params params{};
+        int fd = setup(1, params);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return true;
+    }
+
+    bool IoUring::registerBuffers(const std::vector<std::span<char>>& buffers) {
+        std::vector<iovec> vectors;
+        vectors.reserve(buffers.size());
+        for (std::span<char> buffer : buffers) {
+            vectors.push_back({buffer.data(), buffer.size()});
+        }
+
+        if (vectors.empty()
+            or registerResource(fd_, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(vectors.size())) != 0) {
+            return false;
+        }
+
+        // Kept sorted by address for lookups; index is the position used at registration
+        registered_.clear();
+        for (std::size_t index = 0; index < buffers.size(); ++index) {
+            registered_.push_back({buffers[index], static_cast<int>(index)});
+        }
+        std::sort(registered_.begin(), registered_.end(), [](const RegisteredBuffer& left, const RegisteredBuffer& right) {
+            return left.buffer.data() < right.buffer.data();
+        });
+        return true;
+    }
+
+    int IoUring::bufferIndex(const char* data, std::size_t size) const {
+        auto next = std::upper_bound(registered_.begin(), registered_.end(), data, [](const char* address, const RegisteredBuffer& registered) {
+            return address < registered.buffer.data();
+        });
+        if (next == registered_.begin()) {
+            return -1;
+        }
+
+        const RegisteredBuffer& candidate = *std::prev(next);
+        if (data + size > candidate.buffer.data() + candidate.buffer.size()) {
+            return -1;
+        }
+        return candidate.index;
+    }
+
+    io_uring_sqe& IoUring::nextEntry() {
+        if (*sqTail_ - loadAcquire(sqHead_) >= entries_) {
+            submit(0);
+        }
+
+        const unsigned tail = *sqTail_;
+        const unsigned index = tail & *sqMask_;
+        io_uring_sqe& entry = sqes_[index];
+        std::memset(&entry, 0, sizeof(entry));
+
+        sqArray_[index] = index;
+        return entry;
+    }
+
+    void IoUring::commitEntry() {
+        storeRelease(sqTail_, *sqTail_ + 1);
+        ++queued_;
+    }
+
+    void IoUring::prepareRead(int fd, std::span<char> buffer, std::uint64_t offset, std::uint64_t userData) {
+        const int index = bufferIndex(buffer.data(), buffer.size());
+        io_uring_sqe& entry = nextEntry();
+        entry.opcode = index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        entry.fd = fd;
+        entry.addr = reinterpret_cast<std::uint64_t>(buffer.data());
+        entry.len = static_cast<std::uint32_t>(buffer.size());
+        entry.off = offset;
+        entry.user_data = userData;
+        if (index >= 0) {
+            entry.buf_index = static_cast<std::uint16_t>(index);
+        }
+        commitEntry();
+    }
+
+    void IoUring::prepareWrite(int fd, std::span<const char> buffer, std::uint64_t offset, std::uint64_t userData) {
+        const int index = bufferIndex(buffer.data(), buffer.size());
+        io_uring_sqe& entry = nextEntry();
+        entry.opcode = index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        entry.fd = fd;
+        entry.addr = reinterpret_cast<std::uint64_t>(buffer.data());
+        entry.len = static_cast<std::uint32_t>(buffer.size());
+        entry.off = offset;
+        entry.user_data = userData;
+        if (index >= 0) {
+            entry.buf_index = static_cast<std::uint16_t>(index);
+        }
+        commitEntry();
+    }
+
+    unsigned IoUring::submit(unsigned waitFor) {
+        int submitted = 0;
+        do {
+            submitted = enter(fd_, queued_, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+        } while (submitted < 0 and errno == EINTR);
+
+        if (submitted < 0) {
+            throw systemError("io_uring_enter failed");
+        }
+        queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(submitted));
+        return static_cast<unsigned>(submitted);
+    }
+
+    IoUring::Completion IoUring::waitCompletion() {
+        unsigned head = *cqHead_;
+        while (head == loadAcquire(cqTail_)) {
+            submit(1);
+        }
+
+        const io_uring_cqe& entry = cqes_[head & *cqMask_];
+        Completion completion{entry.user_data, entry.res};
+        storeRelease(cqHead_, head + 1);
+        return completion;
+    }
+
+} // namespace cp
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace cp {
+
+    // Minimal io_uring instance driven through the raw system calls, so no liburing is needed
+    class IoUring {
+    public:
+        struct Completion {
+            std::uint64_t userData;
+            std::int32_t result;
+        };
+
+        explicit IoUring(unsigned entries);
+        ~IoUring();
+
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+
+        // True if the running kernel lets us create a ring
+        static bool supported();
+
+        // Registers fixed buffers; returns false if the kernel refuses (e.g. RLIMIT_MEMLOCK)
+        bool registerBuffers(const std::vector<std::span<char>>& buffers);
+
+        // Index of the registered buffer containing [data, data + size), or -1
+        int bufferIndex(const char* data, std::size_t size) const;
+
+        // Queues a read or write; buffers inside a registered buffer use the *_FIXED opcodes
+        void prepareRead(int fd, std::span<char> buffer, std::uint64_t offset, std::uint64_t userData);
+        void prepareWrite(int fd, std::span<const char> buffer, std::uint64_t offset, std::uint64_t userData);
+
+        // Submits everything queued and waits for at least one completion
+        Completion waitCompletion();
+
+    private:
+        void release();
+        io_uring_sqe& nextEntry();
+        // Publishes the entry returned by nextEntry() once it is filled in
+        void commitEntry();
+        unsigned submit(unsigned waitFor);
+
+        int fd_;
+        unsigned entries_;
+        unsigned queued_;
+
+        void* sqRing_;
+        std::size_t sqRingSize_;
+        void* cqRing_;
+        std::size_t cqRingSize_;
+        io_uring_sqe* sqes_;
+        std::size_t sqesSize_;
+
+        unsigned* sqHead_;
+        unsigned* sqTail_;
+        unsigned* sqMask_;
+        unsigned* sqArray_;
+        unsigned* cqHead_;
+        unsigned* cqTail_;
+        unsigned* cqMask_;
+        io_uring_cqe* cqes_;
+
+        struct RegisteredBuffer {
+            std::span<char> buffer;
+            int index;
+        };
+        std::vector<RegisteredBuffer> registered_;
+    };
+
+} // namespace cp
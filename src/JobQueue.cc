@@ -0,0 +1,189 @@
+#include "JobQueue.h"
+
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace cp {
+
+    using namespace boost::interprocess;
+
+    namespace {
+
+        constexpr std::uint32_t JOB_QUEUE_MAGIC = 0x514A5043; // "CPJQ"
+        constexpr std::uint32_t JOB_QUEUE_VERSION = 2;
+
+        bool alive(std::int64_t pid) {
+            return kill(static_cast<pid_t>(pid), 0) == 0 or errno == EPERM;
+        }
+
+        void copyPath(char (&target)[PATH_MAX], const std::string& path) {
+            if (path.size() >= PATH_MAX) {
+                throw std::invalid_argument("Path is too long: " + path);
+            }
+            std::memcpy(target, path.c_str(), path.size() + 1);
+        }
+
+    } // namespace
+
+    JobQueue::JobQueue(std::string name, mapped_region region, bool owner)
+        : name_(std::move(name))
+        , region_(std::move(region))
+        , owner_(owner) {
+    }
+
+    JobQueue::JobQueue(JobQueue&& other) noexcept
+        : name_(std::move(other.name_))
+        , region_(std::move(other.region_))
+        , owner_(std::exchange(other.owner_, false)) {
+    }
+
+    JobQueue::~JobQueue() {
+        if (owner_) {
+            shared_memory_object::remove(name_.c_str());
+        }
+    }
+
+    std::size_t JobQueue::headerSize() {
+        return (sizeof(JobQueueHeader) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    }
+
+    JobQueue JobQueue::create(std::string_view name, std::size_t workerCount, std::size_t chunkSize, std::size_t slotCount) {
+        const std::string segmentName(name);
+
+        // A segment with this name belongs to a running daemon or was left behind by one
+        try {
+            shared_memory_object existing(open_only, segmentName.c_str(), read_only);
+            mapped_region mapping(existing, read_only);
+            const JobQueueHeader* header = static_cast<const JobQueueHeader*>(mapping.get_address());
+            if (mapping.get_size() >= sizeof(JobQueueHeader) and header->magic == JOB_QUEUE_MAGIC and alive(header->daemonPid)) {
+                throw std::runtime_error("A copy daemon is already running on " + segmentName);
+            }
+        } catch (const interprocess_exception&) {
+        }
+        shared_memory_object::remove(segmentName.c_str());
+
+        shared_memory_object object(create_only, segmentName.c_str(), read_write);
+        object.truncate(static_cast<offset_t>(headerSize() + workerCount * slotCount * chunkSize));
+        mapped_region region(object, read_write);
+
+        // Touching every page now keeps page faults out of the jobs
+        std::memset(region.get_address(), 0, region.get_size());
+
+        JobQueueHeader* header = new (region.get_address()) JobQueueHeader();
+        header->daemonPid = getpid();
+        header->stopping = false;
+        header->workerCount = workerCount;
+        header->chunkSize = chunkSize;
+        header->slotCount = slotCount;
+        header->pending.reset();
+        header->free.reset();
+        for (std::uint32_t index = 0; index < JOB_QUEUE_CAPACITY; ++index) {
+            header->jobs[index].state = EJobState::E_Free;
+            header->jobs[index].done.reset();
+            header->free.push(index);
+        }
+        header->pendingEvent.reset();
+        header->freeEvent.reset();
+        header->version = JOB_QUEUE_VERSION;
+        header->magic = JOB_QUEUE_MAGIC;
+
+        return JobQueue(segmentName, std::move(region), true);
+    }
+
+    JobQueue JobQueue::open(std::string_view name) {
+        const std::string segmentName(name);
+        try {
+            shared_memory_object object(open_only, segmentName.c_str(), read_write);
+            mapped_region region(object, read_write);
+
+            const JobQueueHeader* header = static_cast<const JobQueueHeader*>(region.get_address());
+            if (region.get_size() < headerSize() or header->magic != JOB_QUEUE_MAGIC) {
+                throw std::runtime_error(segmentName + " is not the queue of a copy daemon");
+            }
+            if (header->version != JOB_QUEUE_VERSION) {
+                throw std::runtime_error("The copy daemon on " + segmentName + " speaks version " + std::to_string(header->version)
+                    + ", expected " + std::to_string(JOB_QUEUE_VERSION));
+            }
+            if (!alive(header->daemonPid)) {
+                throw std::runtime_error("The copy daemon on " + segmentName + " is gone");
+            }
+            return JobQueue(segmentName, std::move(region), false);
+        } catch (const interprocess_exception& ex) {
+            throw std::runtime_error("No copy daemon is running on " + segmentName + ": " + ex.what());
+        }
+    }
+
+    JobQueueHeader& JobQueue::header() const {
+        return *static_cast<JobQueueHeader*>(region_.get_address());
+    }
+
+    std::span<char> JobQueue::slots(std::size_t worker) const {
+        const JobQueueHeader& queue = header();
+        const std::size_t size = queue.slotCount * queue.chunkSize;
+        return std::span<char>(static_cast<char*>(region_.get_address()) + headerSize() + worker * size, size);
+    }
+
+    JobResult JobQueue::submit(const JobRequest& request) {
+        JobQueueHeader& queue = header();
+        AdaptiveWaiter waiter;
+
+        // Nothing bounds a copy, so the waits only give up when the daemon is gone
+        auto wait = [&](FutexEvent& event, auto predicate) {
+            while (!waiter.wait(event, TRANSPORT_TIMEOUT, predicate)) {
+                if (!alive(queue.daemonPid)) {
+                    throw std::runtime_error("The copy daemon on " + name_ + " is gone");
+                }
+            }
+        };
+
+        std::uint32_t index = 0;
+        while (!queue.free.pop(index)) {
+            wait(queue.freeEvent, [&queue] { return !queue.free.empty(); });
+        }
+
+        JobRecord& job = queue.jobs[index];
+        try {
+            if (queue.stopping) {
+                throw std::runtime_error("The copy daemon on " + name_ + " is stopping");
+            }
+            copyPath(job.source, request.source);
+            copyPath(job.target, request.target);
+        } catch (const std::exception&) {
+            queue.free.push(index);
+            queue.freeEvent.notify();
+            throw;
+        }
+        job.verify = request.verify;
+        job.kernelOffload = request.kernelOffload;
+        job.recursive = request.recursive;
+        job.sparse = request.sparse;
+        job.durability = request.durability;
+        job.bytes = 0;
+        job.error[0] = '\0';
+        job.state = EJobState::E_Queued;
+
+        // Never full: there are as many cells as job records
+        queue.pending.push(index);
+        queue.pendingEvent.notify();
+
+        wait(job.done, [&job] {
+            EJobState state = job.state;
+            return state == EJobState::E_Done or state == EJobState::E_Failed;
+        });
+
+        JobResult result{job.state == EJobState::E_Done, job.bytes, job.error};
+        job.state = EJobState::E_Free;
+        queue.free.push(index);
+        queue.freeEvent.notify();
+        return result;
+    }
+
+} // namespace cp
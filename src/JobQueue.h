@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Constants.h"
+#include "Futex.h"
+#include "Durability.h"
+#include "Sparse.h"
+
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace cp {
+
+    enum class EJobState : std::uint32_t {
+        E_Free = 0,
+        E_Queued,
+        E_Running,
+        E_Done,
+        E_Failed
+    };
+
+    // What a client asks the daemon to do; paths are absolute, the daemon has its own working directory
+    struct JobRequest {
+        std::string source;
+        std::string target;
+        bool verify = false;
+        bool kernelOffload = true;
+        bool recursive = false;
+        ESparseMode sparse = ESparseMode::E_Auto;
+        EDurability durability = EDurability::E_End;
+    };
+
+    struct JobResult {
+        bool succeeded = false;
+        std::uint64_t bytes = 0;
+        std::string error;
+    };
+
+    // Bounded lock-free multi-producer / multi-consumer queue of indices in shared memory.
+    // Every cell carries a sequence number telling whether it is free for the push or the pop
+    // of the current round, so pushes and pops only contend on their own counter.
+    template <std::size_t Capacity>
+    class IndexQueue {
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+    public:
+        void reset() {
+            for (std::size_t index = 0; index < Capacity; ++index) {
+                cells_[index].sequence.store(index, std::memory_order_relaxed);
+            }
+            enqueue_.store(0, std::memory_order_relaxed);
+            dequeue_.store(0, std::memory_order_release);
+        }
+
+        bool push(std::uint32_t value) {
+            std::uint64_t position = enqueue_.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells_[position % Capacity];
+                const std::int64_t difference = static_cast<std::int64_t>(cell.sequence.load(std::memory_order_acquire) - position);
+                if (difference == 0) {
+                    if (enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        cell.value = value;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = enqueue_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool pop(std::uint32_t& value) {
+            std::uint64_t position = dequeue_.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells_[position % Capacity];
+                const std::int64_t difference = static_cast<std::int64_t>(cell.sequence.load(std::memory_order_acquire) - (position + 1));
+                if (difference == 0) {
+                    if (dequeue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        value = cell.value;
+                        cell.sequence.store(position + Capacity, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = dequeue_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool empty() const {
+            const std::uint64_t position = dequeue_.load(std::memory_order_acquire);
+            return cells_[position % Capacity].sequence.load(std::memory_order_acquire) != position + 1;
+        }
+
+    private:
+        struct alignas(64) Cell {
+            std::atomic<std::uint64_t> sequence;
+            std::uint32_t value;
+        };
+
+        alignas(64) std::atomic<std::uint64_t> enqueue_;
+        alignas(64) std::atomic<std::uint64_t> dequeue_;
+        Cell cells_[Capacity];
+    };
+
+    // One job, owned by a client from taking it off the free queue until it puts it back
+    struct JobRecord {
+        std::atomic<EJobState> state;
+        bool verify;
+        bool kernelOffload;
+        bool recursive;
+        ESparseMode sparse;
+        EDurability durability;
+        char source[PATH_MAX];
+        char target[PATH_MAX];
+        std::uint64_t bytes;
+        char error[256];
+        // Signalled when the job is done or failed
+        FutexEvent done;
+    };
+
+    // Segment of a copy daemon: this header, followed by the page aligned slot pool of the workers.
+    // Clients only ever touch the queues and their own job record.
+    struct JobQueueHeader {
+        // Written last by the daemon, so a client never sees a half initialized queue
+        std::atomic<std::uint32_t> magic;
+        std::uint32_t version;
+        std::int64_t daemonPid;
+        std::atomic<bool> stopping;
+        std::size_t workerCount;
+        std::size_t chunkSize;
+        std::size_t slotCount;
+        // Indices of queued jobs (workers pop) and of free records (clients pop)
+        IndexQueue<JOB_QUEUE_CAPACITY> pending;
+        IndexQueue<JOB_QUEUE_CAPACITY> free;
+        JobRecord jobs[JOB_QUEUE_CAPACITY];
+        // Signalled when a job is queued or the daemon stops (workers wait)
+        // and when a record is put back (clients wait)
+        FutexEvent pendingEvent;
+        FutexEvent freeEvent;
+    };
+
+    // Mapping of a daemon's segment, by the daemon itself or by a client
+    class JobQueue {
+    public:
+        // Creates the segment of a new daemon, replacing one left behind by a daemon that is gone.
+        // Every page is touched up front, so jobs never fault the slot pool in.
+        static JobQueue create(std::string_view name, std::size_t workerCount, std::size_t chunkSize, std::size_t slotCount);
+        // Attaches to the segment of a running daemon
+        static JobQueue open(std::string_view name);
+
+        JobQueue(JobQueue&& other) noexcept;
+        ~JobQueue();
+
+        JobQueueHeader& header() const;
+        // Slots of one worker
+        std::span<char> slots(std::size_t worker) const;
+
+        // Client side: queues the job and waits until the daemon has run it
+        JobResult submit(const JobRequest& request);
+
+    private:
+        JobQueue(std::string name, boost::interprocess::mapped_region region, bool owner);
+
+        static std::size_t headerSize();
+
+        std::string name_;
+        boost::interprocess::mapped_region region_;
+        // The daemon removes the segment when it stops
+        bool owner_;
+    };
+
+} // namespace cp
@@ -0,0 +1,137 @@
+#include "KernelCopy.h"
+#include "Sparse.h"
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+namespace cp {
+
+    namespace {
+
+        // Largest request handed to the kernel at once, so progress is reported regularly
+        constexpr std::uint64_t KERNEL_COPY_STEP = 64 * 1024 * 1024; // 64 MB
+
+        // Errors meaning "this method does not work for these files", as opposed to I/O errors
+        bool unsupported(int error) {
+            return error == EXDEV or error == EINVAL or error == EOPNOTSUPP or error == ENOTTY
+                or error == ENOSYS or error == EBADF or error == EPERM;
+        }
+
+        // Copies [0, size) in steps; with extents only the data is copied and the holes are skipped
+        template <typename Step>
+        bool copyLoop(std::uint64_t size, FileExtents* extents, std::uint64_t& copied,
+                      const std::function<void(std::uint64_t)>& progress, Step step) {
+            bool written = false;
+            while (copied < size) {
+                if (extents != nullptr) {
+                    if (std::uint64_t hole = extents->holeAt(copied)) {
+                        copied += hole;
+                        progress(copied);
+                        continue;
+                    }
+                }
+
+                std::uint64_t count = std::min(size - copied, KERNEL_COPY_STEP);
+                if (extents != nullptr) {
+                    count = std::min(count, std::max<std::uint64_t>(extents->dataAt(copied), 1));
+                }
+
+                ssize_t result = step(copied, count);
+                if (result < 0 and errno == EINTR) {
+                    continue;
+                }
+                if (result < 0) {
+                    if (!written and unsupported(errno)) {
+                        return false;
+                    }
+                    throw std::runtime_error(std::string("Kernel copy failed: ") + std::strerror(errno));
+                }
+                if (result == 0) {
+                    throw std::runtime_error("Source file shrank during kernel copy");
+                }
+                written = true;
+                copied += static_cast<std::uint64_t>(result);
+                progress(copied);
+            }
+            return true;
+        }
+
+    } // namespace
+
+    const char* toString(ECopyMethod method) {
+        switch (method) {
+            case ECopyMethod::E_Clone: return "reflink";
+            case ECopyMethod::E_CopyFileRange: return "copy_file_range";
+            case ECopyMethod::E_Sendfile: return "sendfile";
+            case ECopyMethod::E_None: break;
+        }
+        return "none";
+    }
+
+    std::optional<LocalFile> describeLocalFile(std::string_view path) {
+        struct stat status{};
+        if (stat(std::string(path).c_str(), &status) != 0 or !S_ISREG(status.st_mode)) {
+            return std::nullopt;
+        }
+
+        std::error_code error;
+        std::filesystem::path absolute = std::filesystem::absolute(path, error);
+        if (error) {
+            return std::nullopt;
+        }
+
+        return LocalFile{absolute.string(), static_cast<std::uint64_t>(status.st_dev),
+                         static_cast<std::uint64_t>(status.st_ino), static_cast<std::uint64_t>(status.st_size)};
+    }
+
+    ECopyMethod kernelCopy(int sourceFd, int targetFd, std::uint64_t size, bool sparse,
+                           const std::function<void(std::uint64_t)>& progress) {
+        if (ioctl(targetFd, FICLONE, sourceFd) == 0) {
+            progress(size);
+            return ECopyMethod::E_Clone;
+        }
+
+        std::optional<FileExtents> extents;
+        if (sparse) {
+            extents.emplace(sourceFd);
+        }
+
+        // Sized first, so holes at the end need no write
+        if (sparse and ftruncate(targetFd, static_cast<off_t>(size)) != 0) {
+            return ECopyMethod::E_None;
+        }
+
+        std::uint64_t copied = 0;
+        if (copyLoop(size, extents ? &*extents : nullptr, copied, progress, [&](std::uint64_t offset, std::uint64_t count) {
+                loff_t sourceOffset = static_cast<loff_t>(offset);
+                loff_t targetOffset = static_cast<loff_t>(offset);
+                return copy_file_range(sourceFd, &sourceOffset, targetFd, &targetOffset, count, 0);
+            })) {
+            return ECopyMethod::E_CopyFileRange;
+        }
+
+        copied = 0;
+        if (copyLoop(size, extents ? &*extents : nullptr, copied, progress, [&](std::uint64_t offset, std::uint64_t count) {
+                if (lseek(targetFd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+                    return ssize_t{-1};
+                }
+                off_t sourceOffset = static_cast<off_t>(offset);
+                return sendfile(targetFd, sourceFd, &sourceOffset, count);
+            })) {
+            return ECopyMethod::E_Sendfile;
+        }
+
+        return ECopyMethod::E_None;
+    }
+
+} // namespace cp
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "LocalFile.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+namespace cp {
+
+    enum class ECopyMethod {
+        E_None = 0,
+        E_Clone,
+        E_CopyFileRange,
+        E_Sendfile
+    };
+
+    const char* toString(ECopyMethod method);
+
+    // Describes path if it is a regular file, with an absolute path usable from another process
+    std::optional<LocalFile> describeLocalFile(std::string_view path);
+
+    // Copies size bytes from sourceFd to targetFd inside the kernel: reflink (FICLONE) first,
+    // then copy_file_range, then sendfile. With sparse only the data extents are copied,
+    // so holes of the source stay holes. progress is called with the bytes copied so far.
+    // Returns E_None, with no data written, if the kernel cannot copy between these files;
+    // throws if copying fails after data has been written.
+    ECopyMethod kernelCopy(int sourceFd, int targetFd, std::uint64_t size, bool sparse,
+                           const std::function<void(std::uint64_t)>& progress);
+
+} // namespace cp
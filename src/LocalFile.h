@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cp {
+
+    // A regular file on this host that the kernel could copy directly.
+    // Device and inode let the other process check that the path resolves to the same file.
+    struct LocalFile {
+        std::string path;
+        std::uint64_t device = 0;
+        std::uint64_t inode = 0;
+        std::uint64_t size = 0;
+    };
+
+} // namespace cp
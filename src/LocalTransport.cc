@@ -0,0 +1,204 @@
+#include "LocalTransport.h"
+
+#include <stdexcept>
+#include <utility>
+
+namespace cp {
+
+    LocalTransport::LocalTransport(std::vector<std::span<char>> buffers)
+        : state_(std::make_shared<State>()) {
+
+        if (buffers.empty()) {
+            throw std::invalid_argument("A local transport needs at least one buffer");
+        }
+        state_->slots.resize(buffers.size());
+        state_->buffers = std::move(buffers);
+    }
+
+    LocalTransport::LocalTransport(std::shared_ptr<State> state)
+        : state_(std::move(state)) {
+    }
+
+    LocalTransport::Ptr LocalTransport::connect() const {
+        return Ptr(new LocalTransport(state_));
+    }
+
+    void LocalTransport::abort() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->aborted = true;
+        state_->changed.notify_all();
+    }
+
+    template <typename Predicate>
+    void LocalTransport::wait(std::unique_lock<std::mutex>& lock, Predicate predicate) {
+        state_->changed.wait(lock, [this, &predicate] { return state_->aborted or predicate(); });
+        if (state_->aborted) {
+            throw std::runtime_error("Copy aborted by the other side");
+        }
+    }
+
+    std::span<char> LocalTransport::getBuffer() {
+        {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            wait(lock, [this] { return state_->claimed - state_->tail < state_->slots.size(); });
+        }
+        return tryGetBuffer();
+    }
+
+    std::span<char> LocalTransport::tryGetBuffer() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->claimed - state_->tail >= state_->slots.size()) {
+            return {};
+        }
+        return state_->buffers[state_->claimed++ % state_->slots.size()];
+    }
+
+    void LocalTransport::sendData(std::span<const char> buffer) {
+        publish(buffer, buffer.size(), 0, 0);
+    }
+
+    void LocalTransport::sendHole(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, 0, length, 0);
+    }
+
+    void LocalTransport::sendUnchanged(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, 0, 0, length);
+    }
+
+    void LocalTransport::sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) {
+        publish(buffer, buffer.size(), 0, 0, originalSize);
+    }
+
+    void LocalTransport::setChecksum(std::uint32_t checksum) {
+        checksum_ = checksum;
+    }
+
+    void LocalTransport::publish(std::span<const char> buffer, std::size_t size, std::uint64_t hole, std::uint64_t unchanged,
+                                 std::uint64_t original) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        const std::size_t index = state_->head % state_->slots.size();
+        if (state_->head == state_->claimed or buffer.data() != state_->buffers[index].data()) {
+            throw std::logic_error("Data sent out of order");
+        }
+
+        state_->slots[index] = Slot{size, hole, unchanged, original, std::exchange(checksum_, std::nullopt)};
+        ++state_->head;
+        state_->changed.notify_all();
+    }
+
+    std::span<const char> LocalTransport::receiveData() {
+        {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            wait(lock, [this] { return state_->head != state_->acquired or state_->finished; });
+        }
+        return tryReceiveData();
+    }
+
+    std::span<const char> LocalTransport::tryReceiveData() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->head == state_->acquired) {
+            return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        }
+        const std::size_t index = state_->acquired++ % state_->slots.size();
+        return std::span<const char>(state_->buffers[index].data(), state_->slots[index].size);
+    }
+
+    void LocalTransport::releaseData() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->tail == state_->acquired) {
+            throw std::logic_error("No data to release");
+        }
+        ++state_->tail;
+        state_->changed.notify_all();
+    }
+
+    const LocalTransport::Slot* LocalTransport::received() const {
+        // Only the consumer moves acquired, so reading the slot after unlocking is safe
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->acquired == state_->tail ? nullptr : &state_->slots[(state_->acquired - 1) % state_->slots.size()];
+    }
+
+    std::uint64_t LocalTransport::receivedHole() const {
+        const Slot* slot = received();
+        return slot ? slot->hole : 0;
+    }
+
+    std::uint64_t LocalTransport::receivedUnchanged() const {
+        const Slot* slot = received();
+        return slot ? slot->unchanged : 0;
+    }
+
+    std::uint64_t LocalTransport::receivedOriginalSize() const {
+        const Slot* slot = received();
+        return slot ? slot->original : 0;
+    }
+
+    std::optional<std::uint32_t> LocalTransport::receivedChecksum() const {
+        const Slot* slot = received();
+        return slot ? slot->checksum : std::nullopt;
+    }
+
+    bool LocalTransport::hasFinished() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->aborted) {
+            throw std::runtime_error("Copy aborted by the other side");
+        }
+        return state_->finished and state_->head == state_->acquired;
+    }
+
+    void LocalTransport::finish() {
+        // The buffers outlive both threads, so there is nothing to wait for
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->finished = true;
+        state_->changed.notify_all();
+    }
+
+    void LocalTransport::setTotalSize(std::optional<std::uint64_t> size) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->totalSize = size;
+    }
+
+    std::optional<std::uint64_t> LocalTransport::totalSize() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->totalSize;
+    }
+
+    bool LocalTransport::offerLocalFile(const std::optional<LocalFile>& file) {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->offer = file;
+        state_->offloadState = file ? EOffloadState::E_Offered : EOffloadState::E_NoOffer;
+        state_->changed.notify_all();
+        if (!file) {
+            return false;
+        }
+
+        wait(lock, [this] {
+            return state_->offloadState != EOffloadState::E_Offered and state_->offloadState != EOffloadState::E_Accepted;
+        });
+        if (state_->offloadState == EOffloadState::E_Failed) {
+            throw std::runtime_error("Writer failed to copy the file in the kernel");
+        }
+        return state_->offloadState == EOffloadState::E_Done;
+    }
+
+    std::optional<LocalFile> LocalTransport::offeredLocalFile() {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        wait(lock, [this] { return state_->offloadState != EOffloadState::E_Pending; });
+        return state_->offloadState == EOffloadState::E_Offered ? state_->offer : std::nullopt;
+    }
+
+    void LocalTransport::reportOffload(EOffloadState state, std::uint64_t /*progress*/) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->offloadState = state;
+        state_->changed.notify_all();
+    }
+
+    std::size_t LocalTransport::chunkSize() const {
+        return state_->buffers.front().size();
+    }
+
+    std::vector<std::span<char>> LocalTransport::buffers() {
+        return state_->buffers;
+    }
+
+} // namespace cp
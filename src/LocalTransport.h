@@ -0,0 +1,97 @@
+#pragma once
+
+#include "IDataTransport.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace cp {
+
+    // Ring between a reader and a writer thread of the same process, on buffers owned by the caller.
+    // Used by the daemon, which runs both ends of a copy itself. Waits have no timeout: a failing
+    // side calls abort, which makes every call on either end throw.
+    class LocalTransport final : public IDataTransport {
+    public:
+        using Ptr = std::unique_ptr<LocalTransport>;
+
+        explicit LocalTransport(std::vector<std::span<char>> buffers);
+
+        // Another end of the same ring, e.g. for the writer thread
+        Ptr connect() const;
+
+        void abort();
+
+        std::span<char> getBuffer() override;
+        std::span<char> tryGetBuffer() override;
+
+        void sendData(std::span<const char> buffer) override;
+        void sendHole(std::span<const char> buffer, std::uint64_t length) override;
+        void sendUnchanged(std::span<const char> buffer, std::uint64_t length) override;
+        void sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) override;
+        void setChecksum(std::uint32_t checksum) override;
+        std::span<const char> receiveData() override;
+        std::span<const char> tryReceiveData() override;
+        void releaseData() override;
+        std::uint64_t receivedHole() const override;
+        std::uint64_t receivedUnchanged() const override;
+        std::uint64_t receivedOriginalSize() const override;
+        std::optional<std::uint32_t> receivedChecksum() const override;
+
+        bool hasFinished() override;
+        void finish() override;
+
+        void setTotalSize(std::optional<std::uint64_t> size) override;
+        std::optional<std::uint64_t> totalSize() const override;
+
+        bool offerLocalFile(const std::optional<LocalFile>& file) override;
+        std::optional<LocalFile> offeredLocalFile() override;
+        void reportOffload(EOffloadState state, std::uint64_t progress) override;
+
+        std::size_t chunkSize() const override;
+        std::vector<std::span<char>> buffers() override;
+
+    private:
+        struct Slot {
+            std::size_t size = 0;
+            std::uint64_t hole = 0;
+            std::uint64_t unchanged = 0;
+            std::uint64_t original = 0;
+            std::optional<std::uint32_t> checksum;
+        };
+
+        // Shared by both ends; same cursors as the shared memory ring
+        struct State {
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::vector<std::span<char>> buffers;
+            std::vector<Slot> slots;
+            std::uint64_t claimed = 0;
+            std::uint64_t head = 0;
+            std::uint64_t acquired = 0;
+            std::uint64_t tail = 0;
+            bool finished = false;
+            bool aborted = false;
+            std::optional<std::uint64_t> totalSize;
+            EOffloadState offloadState = EOffloadState::E_Pending;
+            std::optional<LocalFile> offer;
+        };
+
+        explicit LocalTransport(std::shared_ptr<State> state);
+
+        void publish(std::span<const char> buffer, std::size_t size, std::uint64_t hole, std::uint64_t unchanged,
+                     std::uint64_t original = 0);
+        const Slot* received() const;
+
+        // Blocks until predicate holds; throws once the copy is aborted
+        template <typename Predicate>
+        void wait(std::unique_lock<std::mutex>& lock, Predicate predicate);
+
+        std::shared_ptr<State> state_;
+        std::optional<std::uint32_t> checksum_;
+    };
+
+} // namespace cp
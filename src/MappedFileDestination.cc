@@ -0,0 +1,102 @@
+#include "MappedFileDestination.h"
+#include "Constants.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp
+{
+    MappedFileDestination::MappedFileDestination(std::string_view filename, bool patch, EDurability durability)
+        : target_(filename, O_RDWR, patch, durability)
+        , offset_(0)
+        , window_(nullptr)
+        , windowOffset_(0)
+        , windowSize_(0) {
+    }
+
+    MappedFileDestination::~MappedFileDestination() {
+        unmapWindow();
+    }
+
+    void MappedFileDestination::reserve(std::uint64_t size) {
+        // The mapping can only cover what is part of the file
+        target_.resize(size);
+    }
+
+    void MappedFileDestination::mapWindow(std::uint64_t offset) {
+        unmapWindow();
+
+        windowOffset_ = offset / MAP_WINDOW_SIZE * MAP_WINDOW_SIZE;
+        if (offset >= target_.size()) {
+            // Unknown or exceeded size: grow the file to the end of this window
+            target_.resize(windowOffset_ + MAP_WINDOW_SIZE);
+        }
+        windowSize_ = static_cast<std::size_t>(std::min<std::uint64_t>(MAP_WINDOW_SIZE, target_.size() - windowOffset_));
+
+        // Allocate the blocks now so that stores into the mapping cannot hit ENOSPC as SIGBUS.
+        // Everything before offset is written or a hole already.
+        int error = posix_fallocate(target_.fd(), static_cast<off_t>(offset), static_cast<off_t>(windowOffset_ + windowSize_ - offset));
+        if (error != 0 and error != EOPNOTSUPP and error != EINVAL) {
+            throw std::runtime_error(std::string("Failed to allocate target file: ") + std::strerror(error));
+        }
+
+        void* window = mmap(nullptr, windowSize_, PROT_READ | PROT_WRITE, MAP_SHARED, target_.fd(), static_cast<off_t>(windowOffset_));
+        if (window == MAP_FAILED) {
+            throw std::runtime_error(std::string("Failed to map target file: ") + std::strerror(errno));
+        }
+        window_ = static_cast<char*>(window);
+        madvise(window_, windowSize_, MADV_SEQUENTIAL);
+    }
+
+    void MappedFileDestination::unmapWindow() {
+        if (window_ != nullptr) {
+            munmap(window_, windowSize_);
+            window_ = nullptr;
+        }
+    }
+
+    void MappedFileDestination::writeChunk(std::span<const char> buffer) {
+        while (!buffer.empty()) {
+            if (window_ == nullptr or offset_ >= windowOffset_ + windowSize_) {
+                mapWindow(offset_);
+            }
+
+            const std::size_t windowPosition = static_cast<std::size_t>(offset_ - windowOffset_);
+            const std::size_t count = std::min(buffer.size(), windowSize_ - windowPosition);
+            std::memcpy(window_ + windowPosition, buffer.data(), count);
+
+            buffer = buffer.subspan(count);
+            offset_ += count;
+        }
+        target_.advance(offset_);
+    }
+
+    void MappedFileDestination::writeHole(std::uint64_t length) {
+        // Blocks already allocated for the current window are given back
+        target_.writeHole(offset_, length);
+        offset_ += length;
+    }
+
+    void MappedFileDestination::skipUnchanged(std::uint64_t length) {
+        offset_ += length;
+        target_.advance(offset_);
+    }
+
+    std::optional<std::string> MappedFileDestination::localPath() const {
+        return target_.path();
+    }
+
+    void MappedFileDestination::finish() {
+        // The mapping goes before the file is cut to its final length
+        unmapWindow();
+        target_.finish();
+    }
+
+} // namespace cp
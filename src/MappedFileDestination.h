@@ -0,0 +1,41 @@
+#pragma once
+
+#include "IDataDestination.h"
+#include "TargetFile.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cp
+{
+    // Writes a file through a sliding memory mapped window. The file is sized up front
+    // when the total size is known, otherwise it grows one window at a time.
+    // Blocks are allocated one window at a time, so holes spanning whole windows stay holes.
+    class MappedFileDestination final : public IDataDestination {
+    public:
+
+        // With patch an existing file is overwritten in place instead of truncated
+        explicit MappedFileDestination(std::string_view filename, bool patch = false, EDurability durability = EDurability::E_End);
+        ~MappedFileDestination() override;
+
+        void reserve(std::uint64_t size) override;
+        void writeChunk(std::span<const char> buffer) override;
+        void writeHole(std::uint64_t length) override;
+        void skipUnchanged(std::uint64_t length) override;
+        std::optional<std::string> localPath() const override;
+        void finish() override;
+
+    private:
+        void mapWindow(std::uint64_t offset);
+        void unmapWindow();
+
+        // Pages dirtied through the mapping are written back like written ones
+        TargetFile target_;
+        std::uint64_t offset_;
+        char* window_;
+        std::uint64_t windowOffset_;
+        std::size_t windowSize_;
+    };
+
+} // namespace cp
@@ -0,0 +1,113 @@
+#include "MappedFileSource.h"
+#include "KernelCopy.h"
+#include "Constants.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp
+{
+    MappedFileSource::MappedFileSource(std::string_view filename)
+        : filename_(filename)
+        , fd_(open(filename_.c_str(), O_RDONLY | O_CLOEXEC))
+        , size_(0)
+        , offset_(0)
+        , window_(nullptr)
+        , windowOffset_(0)
+        , windowSize_(0) {
+
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open source file: " + std::string(filename) + ": " + std::strerror(errno));
+        }
+
+        struct stat status{};
+        if (fstat(fd_, &status) != 0 or !S_ISREG(status.st_mode)) {
+            close(fd_);
+            throw std::runtime_error("Source file cannot be memory mapped: " + std::string(filename));
+        }
+        size_ = static_cast<std::uint64_t>(status.st_size);
+    }
+
+    MappedFileSource::~MappedFileSource() {
+        unmapWindow();
+        close(fd_);
+    }
+
+    std::optional<LocalFile> MappedFileSource::localFile() const {
+        return describeLocalFile(filename_);
+    }
+
+    std::optional<std::uint64_t> MappedFileSource::size() const {
+        return size_;
+    }
+
+    std::uint64_t MappedFileSource::holeLength() {
+        if (!extents_) {
+            extents_.emplace(fd_);
+        }
+        return extents_->holeAt(offset_);
+    }
+
+    void MappedFileSource::skipHole() {
+        offset_ += holeLength();
+    }
+
+    void MappedFileSource::mapWindow(std::uint64_t offset) {
+        unmapWindow();
+
+        windowOffset_ = offset / MAP_WINDOW_SIZE * MAP_WINDOW_SIZE;
+        windowSize_ = static_cast<std::size_t>(std::min<std::uint64_t>(MAP_WINDOW_SIZE, size_ - windowOffset_));
+
+        void* window = mmap(nullptr, windowSize_, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(windowOffset_));
+        if (window == MAP_FAILED) {
+            throw std::runtime_error(std::string("Failed to map source file: ") + std::strerror(errno));
+        }
+        window_ = static_cast<char*>(window);
+
+        // Read ahead aggressively and drop pages behind us
+        madvise(window_, windowSize_, MADV_SEQUENTIAL);
+        madvise(window_, windowSize_, MADV_WILLNEED);
+    }
+
+    void MappedFileSource::unmapWindow() {
+        if (window_ != nullptr) {
+            munmap(window_, windowSize_);
+            window_ = nullptr;
+        }
+    }
+
+    bool MappedFileSource::readChunk(std::span<char> buffer, std::size_t& bytesRead) {
+        bytesRead = 0;
+
+        // Stop where the next hole starts, it is skipped rather than read
+        if (extents_) {
+            if (std::uint64_t data = extents_->dataAt(offset_)) {
+                buffer = buffer.first(static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), data)));
+            }
+        }
+
+        while (bytesRead < buffer.size() and offset_ < size_) {
+            if (window_ == nullptr or offset_ >= windowOffset_ + windowSize_) {
+                mapWindow(offset_);
+            }
+
+            const std::size_t windowPosition = static_cast<std::size_t>(offset_ - windowOffset_);
+            const std::size_t count = std::min(buffer.size() - bytesRead, windowSize_ - windowPosition);
+            std::memcpy(buffer.data() + bytesRead, window_ + windowPosition, count);
+
+            bytesRead += count;
+            offset_ += count;
+        }
+
+        return bytesRead > 0;
+    }
+
+} // namespace cp
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "IDataSource.h"
+#include "Sparse.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cp
+{
+    // Reads a file through a sliding memory mapped window, copying straight from the
+    // page cache into the transport buffer
+    class MappedFileSource final : public IDataSource {
+    public:
+
+        explicit MappedFileSource(std::string_view filename);
+        ~MappedFileSource() override;
+
+        bool readChunk(std::span<char> buffer, std::size_t& bytesRead) override;
+        std::optional<std::uint64_t> size() const override;
+        std::optional<LocalFile> localFile() const override;
+
+        std::uint64_t holeLength() override;
+        void skipHole() override;
+
+    private:
+        void mapWindow(std::uint64_t offset);
+        void unmapWindow();
+
+        std::string filename_;
+        int fd_;
+        std::uint64_t size_;
+        std::uint64_t offset_;
+        char* window_;
+        std::uint64_t windowOffset_;
+        std::size_t windowSize_;
+        std::optional<FileExtents> extents_;
+    };
+
+} // namespace cp
@@ -0,0 +1,427 @@
+#include "Options.h"
+
+#include <charconv>
+#include <stdexcept>
+#include <vector>
+
+namespace cp {
+
+    namespace {
+
+        std::size_t parseCount(std::string_view name, std::string_view value) {
+            std::size_t result = 0;
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+            if (ec != std::errc() or end != value.data() + value.size()) {
+                throw std::invalid_argument("Invalid value for " + std::string(name) + ": " + std::string(value));
+            }
+            return result;
+        }
+
+        EIoBackend parseIoBackend(std::string_view value) {
+            if (value == "stream") {
+                return EIoBackend::E_Stream;
+            }
+            if (value == "uring") {
+                return EIoBackend::E_Uring;
+            }
+            if (value == "mmap") {
+                return EIoBackend::E_Mmap;
+            }
+            throw std::invalid_argument("Unknown I/O backend: " + std::string(value));
+        }
+
+        ETransport parseTransport(std::string_view value) {
+            if (value == "shm") {
+                return ETransport::E_SharedMemory;
+            }
+            if (value == "unix") {
+                return ETransport::E_Unix;
+            }
+            if (value == "tcp") {
+                return ETransport::E_Tcp;
+            }
+            throw std::invalid_argument("Unknown transport: " + std::string(value));
+        }
+
+        ESparseMode parseSparseMode(std::string_view value) {
+            if (value == "never") {
+                return ESparseMode::E_Never;
+            }
+            if (value == "auto") {
+                return ESparseMode::E_Auto;
+            }
+            if (value == "always") {
+                return ESparseMode::E_Always;
+            }
+            throw std::invalid_argument("Unknown sparse mode: " + std::string(value));
+        }
+
+        EDurability parseDurability(std::string_view value) {
+            if (value == "none") {
+                return EDurability::E_None;
+            }
+            if (value == "end") {
+                return EDurability::E_End;
+            }
+            if (value == "periodic") {
+                return EDurability::E_Periodic;
+            }
+            throw std::invalid_argument("Unknown durability: " + std::string(value));
+        }
+
+        ECodec parseCodec(std::string_view value) {
+            if (value == "none") {
+                return ECodec::E_None;
+            }
+            if (value == "lz") {
+                return ECodec::E_Lz;
+            }
+            throw std::invalid_argument("Unknown codec: " + std::string(value));
+        }
+
+        EHugePages parseHugePages(std::string_view value) {
+            if (value == "off") {
+                return EHugePages::E_Off;
+            }
+            if (value == "2M") {
+                return EHugePages::E_2M;
+            }
+            if (value == "1G") {
+                return EHugePages::E_1G;
+            }
+            throw std::invalid_argument("Unknown huge page size: " + std::string(value));
+        }
+
+        IoPriority parseIoPriority(std::string_view value) {
+            if (value == "default") {
+                return {EIoClass::E_Default};
+            }
+            if (value == "idle") {
+                return {EIoClass::E_Idle};
+            }
+            if (value == "best-effort") {
+                return {EIoClass::E_BestEffort};
+            }
+            if (value.starts_with("best-effort:")) {
+                const std::size_t level = parseCount("--io-class", value.substr(12));
+                if (level > 7) {
+                    throw std::invalid_argument("Best effort levels go from 0 to 7: " + std::string(value));
+                }
+                return {EIoClass::E_BestEffort, static_cast<int>(level)};
+            }
+            throw std::invalid_argument("Unknown I/O class: " + std::string(value));
+        }
+
+        void parseNuma(std::string_view value, Options& options) {
+            if (value == "off") {
+                options.numa = ENumaPlacement::E_Off;
+            } else if (value == "source") {
+                options.numa = ENumaPlacement::E_Source;
+            } else if (value == "target") {
+                options.numa = ENumaPlacement::E_Target;
+            } else {
+                options.numa = ENumaPlacement::E_Node;
+                options.numaNode = static_cast<int>(parseCount("--numa", value));
+            }
+        }
+
+    } // namespace
+
+    std::optional<int> parseDescriptor(std::string_view path, int standard) {
+        if (path == "-") {
+            return standard;
+        }
+        if (!path.starts_with("fd:")) {
+            return std::nullopt;
+        }
+        return static_cast<int>(parseCount("descriptor", path.substr(3)));
+    }
+
+    std::size_t parseSize(std::string_view value) {
+        std::size_t digits = 0;
+        while (digits < value.size() and value[digits] >= '0' and value[digits] <= '9') {
+            ++digits;
+        }
+
+        std::size_t result = parseCount("size", value.substr(0, digits));
+
+        std::string_view suffix = value.substr(digits);
+        if (suffix.ends_with("B") or suffix.ends_with("b")) {
+            suffix.remove_suffix(1);
+        }
+
+        std::size_t multiplier = 1;
+        if (suffix == "K" or suffix == "k") {
+            multiplier = 1024;
+        } else if (suffix == "M" or suffix == "m") {
+            multiplier = 1024 * 1024;
+        } else if (suffix == "G" or suffix == "g") {
+            multiplier = 1024 * 1024 * 1024;
+        } else if (!suffix.empty()) {
+            throw std::invalid_argument("Invalid size suffix: " + std::string(value));
+        }
+
+        return result * multiplier;
+    }
+
+    Options parseOptions(int argc, char* argv[]) {
+        Options options;
+        std::vector<std::string_view> positional;
+
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+
+            if (arg == "-h" or arg == "--help") {
+                options.help = true;
+                return options;
+            }
+
+            if (arg == "-r" or arg == "--recursive") {
+                options.recursive = true;
+                continue;
+            }
+
+            if (!arg.starts_with("--")) {
+                positional.push_back(arg);
+                continue;
+            }
+
+            if (arg == "--direct") {
+                options.direct = true;
+                continue;
+            }
+
+            if (arg == "--verify") {
+                options.verify = true;
+                continue;
+            }
+
+            if (arg == "--delta") {
+                options.delta = true;
+                continue;
+            }
+
+            if (arg == "--resume") {
+                options.resume = true;
+                continue;
+            }
+
+            if (arg == "--daemon") {
+                options.mode = EMode::E_Daemon;
+                continue;
+            }
+
+            if (arg == "--submit") {
+                options.mode = EMode::E_Submit;
+                continue;
+            }
+
+            if (arg == "--stats") {
+                options.mode = EMode::E_Stats;
+                continue;
+            }
+
+            if (arg == "--no-offload") {
+                options.kernelOffload = false;
+                continue;
+            }
+
+            if (arg == "--no-tune") {
+                options.tune = false;
+                continue;
+            }
+
+            auto separator = arg.find('=');
+            std::string_view name = arg.substr(0, separator);
+            std::string_view value;
+            if (separator != std::string_view::npos) {
+                value = arg.substr(separator + 1);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                throw std::invalid_argument("Missing value for " + std::string(name));
+            }
+
+            if (name == "--chunk-size") {
+                options.chunkSize = parseSize(value);
+            } else if (name == "--slots") {
+                options.slotCount = parseCount(name, value);
+            } else if (name == "--streams") {
+                options.streamCount = parseCount(name, value);
+            } else if (name == "--writers") {
+                options.writerCount = parseCount(name, value);
+            } else if (name == "--transport") {
+                options.transport = parseTransport(value);
+            } else if (name == "--io") {
+                options.io = parseIoBackend(value);
+            } else if (name == "--sparse") {
+                options.sparse = parseSparseMode(value);
+            } else if (name == "--compress") {
+                options.codec = parseCodec(value);
+            } else if (name == "--max-rate") {
+                options.maxRate = parseSize(value);
+            } else if (name == "--io-class") {
+                options.ioPriority = parseIoPriority(value);
+            } else if (name == "--durability") {
+                options.durability = parseDurability(value);
+            } else if (name == "--huge-pages") {
+                options.hugePages = parseHugePages(value);
+            } else if (name == "--numa") {
+                parseNuma(value, options);
+            } else if (name == "--prefault") {
+                options.prefaultThreads = parseCount(name, value);
+            } else if (name == "--workers") {
+                options.daemonWorkers = parseCount(name, value);
+            } else if (name == "--queue-depth") {
+                options.queueDepth = parseCount(name, value);
+            } else {
+                throw std::invalid_argument("Unknown option: " + std::string(name));
+            }
+        }
+
+        // The socket carries a single ring to a single writer
+        const bool socket = options.transport != ETransport::E_SharedMemory;
+        if (socket and (options.streamCount > 1 or options.writerCount > 1 or options.mode != EMode::E_Copy)) {
+            throw std::invalid_argument("--transport=unix|tcp cannot be combined with --streams, --writers, --stats or the daemon");
+        }
+        if (socket and options.hugePages != EHugePages::E_Off) {
+            throw std::invalid_argument("--huge-pages needs the shared memory transport");
+        }
+
+        if (options.mode == EMode::E_Daemon) {
+            if (positional.size() != 1) {
+                throw std::invalid_argument("Expected the queue name of the daemon");
+            }
+            if (options.daemonWorkers == 0) {
+                throw std::invalid_argument("A daemon needs at least one worker");
+            }
+            if (options.streamCount > 1 or options.writerCount > 1 or options.delta or options.resume) {
+                throw std::invalid_argument("--daemon cannot be combined with --streams, --writers, --delta or --resume");
+            }
+            options.sharedMemoryName = positional[0];
+            return options;
+        }
+
+        if (options.mode == EMode::E_Stats) {
+            if (positional.size() != 1) {
+                throw std::invalid_argument("Expected the shared memory name of the copy");
+            }
+            options.sharedMemoryName = positional[0];
+            return options;
+        }
+
+        if (positional.size() != 3) {
+            throw std::invalid_argument(socket ? "Expected source file, target file and socket endpoint"
+                                               : "Expected source file, target file and shared memory name");
+        }
+
+        if (options.mode == EMode::E_Submit and (options.streamCount > 1 or options.writerCount > 1 or options.delta or options.resume)) {
+            throw std::invalid_argument("--submit cannot be combined with --streams, --writers, --delta or --resume");
+        }
+        if (options.mode == EMode::E_Submit and options.maxRate) {
+            throw std::invalid_argument("--max-rate is set on the daemon, not on --submit");
+        }
+
+        if (options.recursive and options.streamCount > 1) {
+            throw std::invalid_argument("--recursive cannot be combined with --streams");
+        }
+
+        // Every lane reads and writes its range with pread and pwrite
+        if (options.streamCount > 1 and options.io != EIoBackend::E_Stream) {
+            throw std::invalid_argument("--streams cannot be combined with --io=uring or --io=mmap");
+        }
+
+        if (options.delta and (options.recursive or options.streamCount > 1 or options.writerCount > 1)) {
+            throw std::invalid_argument("--delta cannot be combined with --recursive, --streams or --writers");
+        }
+
+        if (options.resume and (options.recursive or options.streamCount > 1 or options.writerCount > 1 or options.delta
+                                or options.io == EIoBackend::E_Mmap)) {
+            throw std::invalid_argument("--resume cannot be combined with --recursive, --streams, --writers, --delta or --io=mmap");
+        }
+
+        if (options.codec != ECodec::E_None and (options.streamCount > 1 or options.mode != EMode::E_Copy)) {
+            throw std::invalid_argument("--compress cannot be combined with --streams or the daemon");
+        }
+
+        options.source = positional[0];
+        options.target = positional[1];
+        options.sharedMemoryName = positional[2];
+
+        const bool streams = parseDescriptor(options.source, 0) or parseDescriptor(options.target, 1);
+        if (streams and (options.recursive or options.streamCount > 1 or options.delta or options.resume or options.mode != EMode::E_Copy)) {
+            throw std::invalid_argument("Standard streams and descriptors cannot be combined with --recursive, --streams, --delta, --resume or the daemon");
+        }
+
+        return options;
+    }
+
+    std::string usage(std::string_view program) {
+        return "Usage: " + std::string(program) + " [options] <source file> <target file> <shared memory name>\n"
+            "       source and target may be - for stdin/stdout or fd:<n> for an inherited descriptor\n"
+            "       " + std::string(program) + " --transport=unix|tcp [options] <source file> <target file> <socket path|host:port>\n"
+            "       " + std::string(program) + " --daemon [options] <queue name>\n"
+            "       " + std::string(program) + " --submit [options] <source file> <target file> <queue name>\n"
+            "       " + std::string(program) + " --stats [--max-rate=<size>] <shared memory name>\n"
+            "Options:\n"
+            "  --chunk-size=<size>  size of one shared memory slot, e.g. 256K, 16M (default 4M)\n"
+            "  --slots=<count>      number of slots in the ring (default 4)\n"
+            "  --streams=<count>    copy the file as this many ranges in parallel, each through its\n"
+            "                       own ring (default 1)\n"
+            "  --writers=<count>    broadcast: every chunk is read once and delivered to this many\n"
+            "                       writer processes, each with its own target (default 1)\n"
+            "  --transport=shm|unix|tcp\n"
+            "                       carry the chunks through shared memory (default), a Unix socket or\n"
+            "                       a TCP connection; the first process listens and reads\n"
+            "  --huge-pages=off|2M|1G\n"
+            "                       back the slots with huge pages from a hugetlbfs mount or a memfd\n"
+            "                       (default off)\n"
+            "  --numa=off|source|target|<node>\n"
+            "                       bind the slots to the NUMA node of the source's or the target's\n"
+            "                       device, or to the given node (default off)\n"
+            "  --prefault=<threads> fault the slots in with this many threads before the copy\n"
+            "                       (default 0: on first use)\n"
+            "  --io=stream|uring|mmap\n"
+            "                       file access backend (default stream); uring falls back to stream\n"
+            "                       when io_uring is unavailable\n"
+            "  --queue-depth=<n>    requests kept in flight by the uring backend (default 4)\n"
+            "  --direct             open files with O_DIRECT (uring backend)\n"
+            "  -r, --recursive      copy a directory tree, packing small files into shared chunks\n"
+            "  --sparse=auto|always|never\n"
+            "                       skip holes of the source (auto, default), also chunks of zeros\n"
+            "                       (always), or copy everything as data (never)\n"
+            "  --delta              patch an existing target in place: the writer hashes it in blocks of\n"
+            "                       the chunk size and only changed blocks are sent; implies --no-offload\n"
+            "  --resume             continue an interrupted copy: the writer checkpoints the target every\n"
+            "                       256 MiB, and the reader skips the prefix the checkpoint vouches for\n"
+            "                       once the writer has read it back; implies --no-offload\n"
+            "  --compress=none|lz   compress every chunk on the reader with a fast LZ codec before it is\n"
+            "                       published, on up to 4 threads (default none); chunks that do not\n"
+            "                       shrink are sent as they are\n"
+            "  --max-rate=<size>    read at most this many bytes per second, e.g. 200M, paced in 10 ms\n"
+            "                       pieces (default no cap); implies --no-offload. With --stats,\n"
+            "                       changes the cap of the running copy, 0 lifts it\n"
+            "  --io-class=default|best-effort[:<0-7>]|idle\n"
+            "                       I/O scheduling class of the process: best effort at the given\n"
+            "                       level (7, the lowest, if none), or only when the disk is idle\n"
+            "  --durability=none|end|periodic\n"
+            "                       sync the target before reporting success (end, default), also\n"
+            "                       every 256 MiB while writing (periodic), or leave it to the kernel\n"
+            "  --verify             checksum every chunk with CRC32C, verify it on the writer and print\n"
+            "                       the checksum of the whole copy; implies --no-offload\n"
+            "  --no-offload         always stream through shared memory, even when the kernel could\n"
+            "                       copy between the two files directly\n"
+            "  --no-tune            keep the chunk size and queue depth; by default the reader tries\n"
+            "                       smaller ones over the first few chunks of a file from 1 GiB on\n"
+            "                       and keeps the fastest\n"
+            "  --daemon             serve copy jobs from a long-lived process with pre-faulted slots\n"
+            "  --workers=<count>    jobs a daemon runs at the same time (default 4)\n"
+            "  --submit             hand the copy to the daemon on the queue and wait for it; the\n"
+            "                       daemon's geometry and backend are used\n"
+            "  --stats              print the progress and stage timings of the copy using the shared\n"
+            "                       memory every second, and which side limits it once it ends\n"
+            "Geometry and memory options are taken from the process that creates the shared memory,\n"
+            "or listens on the socket.\n";
+    }
+
+} // namespace cp
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Codec.h"
+#include "Constants.h"
+#include "Durability.h"
+#include "SlotMemory.h"
+#include "Sparse.h"
+#include "Throttle.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace cp {
+
+    enum class EMode {
+        E_Copy = 0,
+        // Serve copy jobs from a long-lived process
+        E_Daemon,
+        // Hand one copy to a running daemon
+        E_Submit,
+        // Watch the counters of a running copy through its shared memory
+        E_Stats
+    };
+
+    // How the chunks travel between the two processes
+    enum class ETransport {
+        E_SharedMemory = 0,
+        // Stream socket: a Unix socket path, or host:port over TCP
+        E_Unix,
+        E_Tcp
+    };
+
+    enum class EIoBackend {
+        E_Stream = 0,
+        E_Uring,
+        E_Mmap
+    };
+
+    // Where the slot memory is bound: nowhere, the node of the source's or the target's device, or a given node
+    enum class ENumaPlacement {
+        E_Off = 0,
+        E_Source,
+        E_Target,
+        E_Node
+    };
+
+    struct Options {
+        std::string source;
+        std::string target;
+        // Shared memory name, or the socket path / host:port of a socket transport
+        std::string sharedMemoryName;
+        ETransport transport = ETransport::E_SharedMemory;
+
+        // Geometry proposed to the shared segment; only used by the process that creates it
+        std::size_t chunkSize = DEFAULT_CHUNK_SIZE;
+        std::size_t slotCount = DEFAULT_SLOT_COUNT;
+        // Number of lanes copying separate ranges of the file in parallel
+        std::size_t streamCount = DEFAULT_LANE_COUNT;
+        // Number of writers every chunk is delivered to, each with its own target
+        std::size_t writerCount = 1;
+
+        // Placement of the slot memory; like the geometry only used by the process that creates the segment
+        EHugePages hugePages = EHugePages::E_Off;
+        ENumaPlacement numa = ENumaPlacement::E_Off;
+        int numaNode = -1;
+        std::size_t prefaultThreads = 0;
+
+        // How the source and target files are accessed
+        EIoBackend io = EIoBackend::E_Stream;
+        std::size_t queueDepth = DEFAULT_QUEUE_DEPTH;
+        bool direct = false;
+
+        // Copy a directory tree; both processes have to be started with it
+        bool recursive = false;
+
+        // Holes of the source are skipped (auto), zero chunks too (always), or copied as data (never)
+        ESparseMode sparse = ESparseMode::E_Auto;
+
+        // Patch an existing target, sending only the blocks that differ; both processes need it
+        bool delta = false;
+
+        // Keep a checkpoint next to the target and continue an interrupted copy after the prefix it
+        // vouches for; both processes need it
+        bool resume = false;
+
+        // When the writer syncs the target to the disk
+        EDurability durability = EDurability::E_End;
+
+        // How the reader compresses the chunks it sends; the writer decompresses whatever arrives
+        ECodec codec = ECodec::E_None;
+
+        // Try smaller chunks and read depths at the start of a large file and keep the fastest
+        bool tune = true;
+
+        // Bytes per second the reader reads at most; with --stats, the new cap of the running copy
+        std::optional<std::uint64_t> maxRate;
+        // I/O scheduling class of the process, whichever side it ends up on
+        IoPriority ioPriority;
+
+        // Checksum every chunk and verify it on the writer
+        bool verify = false;
+
+        // Let the kernel copy between local files (reflink, copy_file_range, sendfile)
+        bool kernelOffload = true;
+
+        EMode mode = EMode::E_Copy;
+        // Number of jobs a daemon runs at the same time
+        std::size_t daemonWorkers = DEFAULT_DAEMON_WORKERS;
+
+        bool help = false;
+    };
+
+    // Parses "<options> <source file> <target file> <shared memory name>",
+    // "--daemon <options> <queue name>" or "--stats <shared memory name>".
+    // Throws std::invalid_argument on malformed input.
+    Options parseOptions(int argc, char* argv[]);
+
+    // Descriptor named by a source or target: "-" for the standard stream, "fd:<n>" for an inherited one
+    std::optional<int> parseDescriptor(std::string_view path, int standard);
+
+    // Parses a byte count with an optional K/M/G suffix, e.g. "256K" or "64MB"
+    std::size_t parseSize(std::string_view value);
+
+    std::string usage(std::string_view program);
+
+} // namespace cp
@@ -0,0 +1,281 @@
+#include "ParallelCopyManager.h"
+#include "Checksum.h"
+#include "Constants.h"
+#include "Durability.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace cp {
+
+    namespace {
+
+        std::runtime_error systemError(const std::string& what) {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+        // Closes the descriptor when the copy leaves the scope, also on errors
+        struct FileDescriptor {
+            int fd;
+            ~FileDescriptor() {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        };
+
+    } // namespace
+
+    ParallelCopyManager::ParallelCopyManager(std::string_view source, std::string_view target,
+                                             SharedMemoryTransport::Ptr transport, CopySettings settings)
+        : source_(source)
+        , target_(target)
+        , transport_(std::move(transport))
+        , settings_(settings) {
+
+    }
+
+    void ParallelCopyManager::start() {
+        if (transport_->strategy() == EStrategy::E_Read) {
+            read();
+        } else {
+            write();
+        }
+    }
+
+    std::vector<ParallelCopyManager::Range> ParallelCopyManager::splitRanges(std::uint64_t size) const {
+        const Geometry geometry = transport_->geometry();
+
+        // Whole chunks per range, so only the last range ends with a partial chunk
+        const std::uint64_t chunks = (size + geometry.chunkSize - 1) / geometry.chunkSize;
+        const std::uint64_t rangeSize = (chunks + geometry.laneCount - 1) / geometry.laneCount * geometry.chunkSize;
+
+        std::vector<Range> ranges;
+        for (std::size_t index = 0; index < geometry.laneCount; ++index) {
+            const std::uint64_t begin = std::min(size, index * rangeSize);
+            ranges.push_back({begin, std::min(size, begin + rangeSize)});
+        }
+        return ranges;
+    }
+
+    std::uint32_t ParallelCopyManager::combine(const std::vector<Range>& ranges, const std::vector<std::uint32_t>& checksums) {
+        std::uint32_t digest = 0;
+        for (std::size_t index = 0; index < ranges.size(); ++index) {
+            digest = crc32cCombine(digest, checksums[index], ranges[index].end - ranges[index].begin);
+        }
+        return digest;
+    }
+
+    template <typename Task>
+    void ParallelCopyManager::runLanes(const std::vector<Range>& ranges, Task task) {
+        std::vector<std::exception_ptr> errors(ranges.size());
+        std::vector<std::thread> threads;
+
+        for (std::size_t index = 0; index < ranges.size(); ++index) {
+            SharedMemoryTransport::Ptr lane = transport_->lane(index);
+            threads.emplace_back([&task, &errors, &ranges, index, lane = std::move(lane)] {
+                try {
+                    task(*lane, index);
+                } catch (...) {
+                    errors[index] = std::current_exception();
+                }
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        for (const std::exception_ptr& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    void ParallelCopyManager::read() {
+        FileDescriptor file{open(source_.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (file.fd < 0) {
+            throw systemError("Failed to open source file " + source_);
+        }
+
+        struct stat status{};
+        if (fstat(file.fd, &status) != 0 or !S_ISREG(status.st_mode)) {
+            throw std::runtime_error("Parallel copy needs a regular source file: " + source_);
+        }
+        const std::uint64_t size = static_cast<std::uint64_t>(status.st_size);
+
+        // Several streams were asked for explicitly, so the data always goes through the lanes
+        transport_->setTotalSize(size);
+        transport_->offerLocalFile(std::nullopt);
+
+        const std::vector<Range> ranges = splitRanges(size);
+        std::vector<std::uint32_t> checksums(ranges.size());
+        // One cap for the whole file, shared by the lanes
+        RateLimiter limiter(settings_.maxRate, transport_->stats());
+        runLanes(ranges, [this, &ranges, &checksums, &limiter, fd = file.fd](IDataTransport& lane, std::size_t index) {
+            checksums[index] = readRange(lane, fd, ranges[index], limiter);
+        });
+
+        if (settings_.verify) {
+            std::cout << "Sent " << size << " bytes, " << formatChecksum(combine(ranges, checksums)) << std::endl;
+        }
+    }
+
+    std::uint32_t ParallelCopyManager::readRange(IDataTransport& lane, int fd, Range range, RateLimiter& limiter) const {
+        std::uint32_t digest = 0;
+        StageClock reading(lane.stats(), EStage::E_Read);
+        for (std::uint64_t offset = range.begin; offset < range.end;) {
+            std::span<char> buffer = lane.getBuffer();
+            buffer = buffer.first(std::min<std::uint64_t>(buffer.size(), range.end - offset));
+
+            // A capped chunk is read in pieces, each paced on its own
+            for (std::size_t done = 0; done < buffer.size();) {
+                const std::size_t piece = std::min(buffer.size() - done, limiter.pieceSize(buffer.size()));
+                limiter.take(piece);
+
+                reading.start();
+                for (const std::size_t end = done + piece; done < end;) {
+                    ssize_t result = pread(fd, buffer.data() + done, end - done, offset + done);
+                    if (result < 0 and errno == EINTR) {
+                        continue;
+                    }
+                    if (result < 0) {
+                        throw systemError("Failed to read source file");
+                    }
+                    if (result == 0) {
+                        throw std::runtime_error("Source file shrank during the copy");
+                    }
+                    done += static_cast<std::size_t>(result);
+                }
+                // The clock of the last piece is stopped by pass
+                if (done < buffer.size()) {
+                    reading.stop();
+                }
+            }
+            reading.pass();
+
+            if (settings_.verify) {
+                const std::uint32_t checksum = crc32c(0, buffer);
+                digest = crc32cCombine(digest, checksum, buffer.size());
+                lane.setChecksum(checksum);
+            }
+            lane.sendData(buffer);
+            offset += buffer.size();
+        }
+        lane.finish();
+        return digest;
+    }
+
+    void ParallelCopyManager::write() {
+        // Also waits until the reader has published the size
+        if (transport_->offeredLocalFile()) {
+            transport_->reportOffload(EOffloadState::E_Declined, 0);
+        }
+
+        std::optional<std::uint64_t> size = transport_->totalSize();
+        if (!size) {
+            throw std::runtime_error("Parallel copy needs the size of the source file");
+        }
+
+        FileDescriptor file{open(target_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, TARGET_FILE_MODE)};
+        if (file.fd < 0) {
+            throw systemError("Failed to open target file " + target_);
+        }
+
+        // Allocated once up front, the ranges only fill it in
+        if (ftruncate(file.fd, static_cast<off_t>(*size)) != 0) {
+            throw systemError("Failed to resize target file");
+        }
+        if (*size > 0) {
+            int error = posix_fallocate(file.fd, 0, static_cast<off_t>(*size));
+            if (error != 0 and error != EOPNOTSUPP and error != EINVAL) {
+                errno = error;
+                throw systemError("Failed to allocate target file");
+            }
+        }
+
+        const std::vector<Range> ranges = splitRanges(*size);
+        std::vector<std::uint32_t> checksums(ranges.size());
+        std::vector<char> verified(ranges.size());
+        runLanes(ranges, [this, &ranges, &checksums, &verified, fd = file.fd](IDataTransport& lane, std::size_t index) {
+            bool checked = false;
+            checksums[index] = writeRange(lane, fd, ranges[index], checked);
+            verified[index] = checked;
+        });
+
+        // Each lane wrote its range back as it went, one sync covers what is left
+        WriteBehind(file.fd, settings_.durability).finish();
+        if (settings_.durability != EDurability::E_None) {
+            syncDirectory(std::filesystem::absolute(target_).parent_path().string());
+        }
+
+        std::cout << "Copied " << *size << " bytes in " << ranges.size() << " streams" << std::endl;
+        if (std::find(verified.begin(), verified.end(), true) != verified.end()) {
+            std::cout << "Received " << *size << " bytes, " << formatChecksum(combine(ranges, checksums)) << " verified" << std::endl;
+        }
+    }
+
+    std::uint32_t ParallelCopyManager::writeRange(IDataTransport& lane, int fd, Range range, bool& verified) const {
+        std::uint64_t offset = range.begin;
+        std::uint32_t digest = 0;
+        // Periodic syncs cover the whole file, so with several lanes they happen more often
+        WriteBehind writeBehind(fd, settings_.durability, range.begin);
+
+        while (!lane.hasFinished()) {
+            std::span<const char> buffer = lane.receiveData();
+            if (buffer.empty()) {
+                continue;
+            }
+            if (buffer.size() > range.end - offset) {
+                throw std::runtime_error("Received more data than the range holds");
+            }
+            if (std::optional<std::uint32_t> expected = lane.receivedChecksum()) {
+                const std::uint32_t checksum = crc32c(0, buffer);
+                if (checksum != *expected) {
+                    throw std::runtime_error("Checksum mismatch in the chunk at offset " + std::to_string(offset)
+                        + ": expected " + formatChecksum(*expected) + ", got " + formatChecksum(checksum));
+                }
+                digest = crc32cCombine(digest, checksum, buffer.size());
+                verified = true;
+            }
+
+            {
+                ScopedStage writing(lane.stats(), EStage::E_Write);
+                for (std::size_t done = 0; done < buffer.size();) {
+                    ssize_t result = pwrite(fd, buffer.data() + done, buffer.size() - done, offset + done);
+                    if (result < 0 and errno == EINTR) {
+                        continue;
+                    }
+                    if (result < 0) {
+                        throw systemError("Failed to write target file");
+                    }
+                    done += static_cast<std::size_t>(result);
+                }
+            }
+
+            offset += buffer.size();
+            lane.releaseData();
+            writeBehind.advance(offset);
+        }
+
+        // A range only counts as landed once all of its bytes are written
+        if (offset != range.end) {
+            throw std::runtime_error("Range at offset " + std::to_string(range.begin) + " is incomplete: "
+                + std::to_string(offset - range.begin) + " of " + std::to_string(range.end - range.begin) + " bytes");
+        }
+        return digest;
+    }
+
+} // namespace cp
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "CopyManager.h"
+#include "SharedMemoryTransport.h"
+#include "Throttle.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cp {
+
+    // Copies a regular file as several offset ranges at once, one lane of the segment per range.
+    // Every range is read with pread and written with pwrite by its own thread on each side.
+    class ParallelCopyManager {
+    public:
+        ParallelCopyManager(
+            std::string_view source,
+            std::string_view target,
+            SharedMemoryTransport::Ptr transport,
+            CopySettings settings = {});
+
+        void start();
+
+    private:
+        struct Range {
+            std::uint64_t begin;
+            std::uint64_t end;
+        };
+
+        void read();
+        void write();
+
+        // Both sides split the file the same way, so no offsets travel through the rings
+        std::vector<Range> splitRanges(std::uint64_t size) const;
+
+        // Both return the checksum of the range, 0 if it was not checksummed
+        std::uint32_t readRange(IDataTransport& lane, int fd, Range range, RateLimiter& limiter) const;
+        std::uint32_t writeRange(IDataTransport& lane, int fd, Range range, bool& verified) const;
+
+        // Checksum of the whole file from the checksums of its ranges
+        static std::uint32_t combine(const std::vector<Range>& ranges, const std::vector<std::uint32_t>& checksums);
+
+        // Runs task(lane, index) for every lane on its own thread
+        // and rethrows the first failure once all of them are done
+        template <typename Task>
+        void runLanes(const std::vector<Range>& ranges, Task task);
+
+    private:
+        std::string source_;
+        std::string target_;
+        SharedMemoryTransport::Ptr transport_;
+        CopySettings settings_;
+    };
+
+} // namespace cp
@@ -0,0 +1,105 @@
+#include "PipeDestination.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace cp
+{
+    namespace {
+
+        std::runtime_error writeError(int fd) {
+            return std::runtime_error("Failed to write to descriptor " + std::to_string(fd) + ": " + std::strerror(errno));
+        }
+
+    } // namespace
+
+    PipeDestination::PipeDestination(int fd)
+        : fd_(fd)
+        , pipe_(false)
+        , spliced_(0) {
+
+        struct stat status{};
+        if (fstat(fd_, &status) != 0) {
+            throw std::runtime_error("Failed to open target descriptor " + std::to_string(fd_) + ": " + std::strerror(errno));
+        }
+        pipe_ = S_ISFIFO(status.st_mode);
+        if (pipe_) {
+            fcntl(fd_, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        }
+
+        // A reader that goes away shows up as EPIPE instead of killing the process
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    void PipeDestination::writeChunk(std::span<const char> buffer) {
+        while (!buffer.empty()) {
+            const ssize_t count = write(fd_, buffer.data(), buffer.size());
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw writeError(fd_);
+            }
+            buffer = buffer.subspan(static_cast<std::size_t>(count));
+        }
+    }
+
+    std::size_t PipeDestination::queueDepth() const {
+        // While one chunk drains from the pipe the next one is already being spliced
+        return pipe_ ? 2 : 1;
+    }
+
+    void PipeDestination::submitChunk(std::span<const char> buffer) {
+        if (!pipe_) {
+            writeChunk(buffer);
+            return;
+        }
+
+        while (!buffer.empty()) {
+            iovec vector{const_cast<char*>(buffer.data()), buffer.size()};
+            const ssize_t count = vmsplice(fd_, &vector, 1, 0);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw writeError(fd_);
+            }
+            buffer = buffer.subspan(static_cast<std::size_t>(count));
+            spliced_ += static_cast<std::uint64_t>(count);
+        }
+        ends_.push_back(spliced_);
+    }
+
+    std::uint64_t PipeDestination::pending() const {
+        int unread = 0;
+        if (ioctl(fd_, FIONREAD, &unread) != 0) {
+            throw writeError(fd_);
+        }
+        return static_cast<std::uint64_t>(unread);
+    }
+
+    void PipeDestination::completeChunk() {
+        if (ends_.empty()) {
+            return;
+        }
+
+        // The pipe still references the slot's pages until its reader has consumed them
+        const std::uint64_t end = ends_.front();
+        ends_.pop_front();
+        while (spliced_ - pending() < end) {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    }
+
+} // namespace cp
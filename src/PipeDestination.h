@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Constants.h"
+#include "IDataDestination.h"
+
+#include <cstdint>
+#include <deque>
+
+namespace cp
+{
+    // Writes to an inherited descriptor: stdout, a pipe or a socket. Into a pipe the slots are
+    // handed over with vmsplice, so the pages are referenced instead of copied; a slot is only
+    // completed once the pipe's reader has consumed all of it.
+    class PipeDestination : public IDataDestination {
+    public:
+
+        // The descriptor stays open, it belongs to the process
+        explicit PipeDestination(int fd);
+
+        void writeChunk(std::span<const char> buffer) override;
+
+        std::size_t queueDepth() const override;
+        void submitChunk(std::span<const char> buffer) override;
+        void completeChunk() override;
+
+    private:
+        // Bytes handed to the pipe and not yet read from it
+        std::uint64_t pending() const;
+
+        int fd_;
+        bool pipe_;
+        // Bytes spliced so far, and the end of each submitted chunk in that count
+        std::uint64_t spliced_;
+        std::deque<std::uint64_t> ends_;
+    };
+
+} // namespace cp
@@ -0,0 +1,53 @@
+#include "PipeSource.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp
+{
+    PipeSource::PipeSource(int fd)
+        : fd_(fd) {
+
+        struct stat status{};
+        if (fstat(fd_, &status) != 0) {
+            throw std::runtime_error("Failed to open source descriptor " + std::to_string(fd_) + ": " + std::strerror(errno));
+        }
+        if (S_ISREG(status.st_mode)) {
+            const off_t position = lseek(fd_, 0, SEEK_CUR);
+            size_ = static_cast<std::uint64_t>(status.st_size - std::max<off_t>(position, 0));
+        } else if (S_ISFIFO(status.st_mode)) {
+            // A larger pipe means fewer wake-ups of the writer feeding it; best effort
+            fcntl(fd_, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        }
+    }
+
+    std::optional<std::uint64_t> PipeSource::size() const {
+        return size_;
+    }
+
+    bool PipeSource::readChunk(std::span<char> buffer, std::size_t& bytesRead) {
+        bytesRead = 0;
+        while (bytesRead < buffer.size()) {
+            const ssize_t count = read(fd_, buffer.data() + bytesRead, buffer.size() - bytesRead);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Failed to read from descriptor " + std::to_string(fd_) + ": " + std::strerror(errno));
+            }
+            if (count == 0) {
+                break;
+            }
+            bytesRead += static_cast<std::size_t>(count);
+        }
+        return bytesRead > 0;
+    }
+
+} // namespace cp
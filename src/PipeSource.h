@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Constants.h"
+#include "IDataSource.h"
+
+#include <cstdint>
+
+namespace cp
+{
+    // Reads an inherited descriptor: stdin, a pipe or a socket. Every chunk is filled completely
+    // before it is handed on, so short pipe reads do not turn into small slots.
+    class PipeSource : public IDataSource {
+    public:
+
+        // The descriptor stays open, it belongs to the process
+        explicit PipeSource(int fd);
+
+        bool readChunk(std::span<char> buffer, std::size_t& bytesRead) override;
+        std::optional<std::uint64_t> size() const override;
+
+    private:
+        int fd_;
+        // Known when the descriptor is a regular file, e.g. stdin redirected from one
+        std::optional<std::uint64_t> size_;
+    };
+
+} // namespace cp
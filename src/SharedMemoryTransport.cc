@@ -1,140 +1,924 @@
 #include "SharedMemoryTransport.h"
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/interprocess/sync/named_mutex.hpp>
 
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <optional>
 #include <stdexcept>
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <cstring>
+#include <utility>
 
 namespace cp {
-    
+
     using namespace boost::interprocess;
-    
-    constexpr std::string namedMutex = "shm_init_mutex";
 
-    SharedMemoryTransport::SharedMemoryTransport(std::string_view name)
+    namespace {
+
+        constexpr std::uint32_t SEGMENT_MAGIC = 0x43505348; // "CPSH"
+        constexpr std::uint32_t SEGMENT_VERSION = 5;
+
+        // Creates the segment, or returns nothing when it already exists
+        std::optional<shared_memory_object> createExclusive(const std::string& name) {
+            try {
+                return shared_memory_object(create_only, name.c_str(), read_write);
+            } catch (const interprocess_exception& ex) {
+                if (ex.get_error_code() == already_exists_error) {
+                    return std::nullopt;
+                }
+                throw;
+            }
+        }
+
+        // The elapsed time runs from the first chunk published once every writer has attached
+        void startClock(CopyStats& stats) {
+            if (stats.startedAt.load(std::memory_order_relaxed) == 0) {
+                std::uint64_t unset = 0;
+                stats.startedAt.compare_exchange_strong(unset, monotonicNanoseconds(), std::memory_order_relaxed);
+            }
+        }
+
+        bool alive(std::int32_t pid) {
+            return kill(static_cast<pid_t>(pid), 0) == 0 or errno == EPERM;
+        }
+
+        // Identifies the PID namespace of this process, 0 if /proc does not tell
+        std::uint64_t pidNamespace() {
+            struct stat status{};
+            return stat("/proc/self/ns/pid", &status) == 0 ? static_cast<std::uint64_t>(status.st_ino) : 0;
+        }
+
+        void validate(Geometry geometry) {
+            if (geometry.chunkSize < MIN_CHUNK_SIZE or geometry.chunkSize > MAX_CHUNK_SIZE) {
+                throw std::invalid_argument("Chunk size must be between " + std::to_string(MIN_CHUNK_SIZE)
+                    + " and " + std::to_string(MAX_CHUNK_SIZE) + " bytes, got " + std::to_string(geometry.chunkSize));
+            }
+            if (geometry.chunkSize % SLOT_ALIGNMENT != 0) {
+                throw std::invalid_argument("Chunk size must be a multiple of " + std::to_string(SLOT_ALIGNMENT)
+                    + " bytes, got " + std::to_string(geometry.chunkSize));
+            }
+            if (geometry.slotCount == 0 or geometry.slotCount > MAX_SLOT_COUNT) {
+                throw std::invalid_argument("Slot count must be between 1 and " + std::to_string(MAX_SLOT_COUNT)
+                    + ", got " + std::to_string(geometry.slotCount));
+            }
+            if (geometry.laneCount == 0 or geometry.laneCount > MAX_LANE_COUNT) {
+                throw std::invalid_argument("Lane count must be between 1 and " + std::to_string(MAX_LANE_COUNT)
+                    + ", got " + std::to_string(geometry.laneCount));
+            }
+            if (geometry.consumerCount == 0 or geometry.consumerCount > MAX_CONSUMER_COUNT) {
+                throw std::invalid_argument("Writer count must be between 1 and " + std::to_string(MAX_CONSUMER_COUNT)
+                    + ", got " + std::to_string(geometry.consumerCount));
+            }
+        }
+
+    } // namespace
+
+    std::size_t SharedMemoryTransport::laneHeaderSize(Geometry geometry) {
+        const std::size_t headers = sizeof(Ring) + geometry.slotCount * sizeof(Slot);
+        return (headers + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    }
+
+    std::size_t SharedMemoryTransport::laneAreaSize(Geometry geometry, bool separateData) {
+        return laneHeaderSize(geometry) + (separateData ? 0 : geometry.slotCount * geometry.chunkSize);
+    }
+
+    std::size_t SharedMemoryTransport::headerSize() {
+        return (sizeof(SharedMemoryStructure) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    }
+
+    std::size_t SharedMemoryTransport::segmentSize(Geometry geometry, bool separateData) {
+        validate(geometry);
+        return headerSize() + geometry.laneCount * laneAreaSize(geometry, separateData);
+    }
+
+    SharedMemoryTransport::SharedMemoryTransport(std::string_view name, Geometry geometry, MemoryPolicy policy)
         : sharedMemoryName_(name)
         , strategy_(EStrategy::E_Read)
-        , segment_(std::make_shared<managed_shared_memory>(open_or_create, sharedMemoryName_.c_str(), sizeof(SharedMemoryStructure) * 1.1))
-        , sharedMemory_() {
+        , region_()
+        , sharedMemory_()
+        , ring_(nullptr)
+        , slots_(nullptr)
+        , data_(nullptr)
+        , consumer_(0)
+        , claimed_(0)
+        , head_(0)
+        , acquired_(0)
+        , tail_(0)
+        , trackPeers_(false) {
+        memoryInitialization(geometry, policy);
+    }
+
+    SharedMemoryTransport::SharedMemoryTransport(const SharedMemoryTransport& attached, std::size_t lane)
+        : sharedMemoryName_(attached.sharedMemoryName_)
+        , strategy_(attached.strategy_)
+        , region_(attached.region_)
+        , sharedMemory_(attached.sharedMemory_)
+        , slotMemory_(attached.slotMemory_)
+        , ring_(nullptr)
+        , slots_(nullptr)
+        , data_(nullptr)
+        , consumer_(attached.consumer_)
+        , claimed_(0)
+        , head_(0)
+        , acquired_(0)
+        , tail_(0)
+        , trackPeers_(attached.trackPeers_) {
+        attachLane(lane);
+    }
+
+    SharedMemoryTransport::Ptr SharedMemoryTransport::lane(std::size_t index) const {
+        if (index >= sharedMemory_->laneCount) {
+            throw std::out_of_range("Lane " + std::to_string(index) + " does not exist");
+        }
+        return Ptr(new SharedMemoryTransport(*this, index));
+    }
+
+    char* SharedMemoryTransport::laneAddress(std::size_t index) const {
+        return static_cast<char*>(region_->get_address()) + headerSize() + index * laneAreaSize(geometry(), slotMemory_ != nullptr);
+    }
+
+    void SharedMemoryTransport::attachLane(std::size_t index) {
+        const Geometry layout = geometry();
+        char* lane = laneAddress(index);
+        ring_ = reinterpret_cast<Ring*>(lane);
+        slots_ = reinterpret_cast<Slot*>(lane + sizeof(Ring));
+        data_ = slotMemory_ ? slotMemory_->data() + index * layout.slotCount * layout.chunkSize : lane + laneHeaderSize(layout);
+    }
+
+    void SharedMemoryTransport::placeSlots(char* lanes, Geometry geometry, const MemoryPolicy& policy) {
+        auto place = [&policy](char* data, std::size_t size, std::size_t pageSize) {
+            // Binding only applies to pages faulted in afterwards
+            if (policy.numaNode >= 0) {
+                bindToNode(data, size, policy.numaNode);
+            }
+            if (policy.prefaultThreads > 0) {
+                prefault(data, size, policy.prefaultThreads, pageSize);
+            }
+        };
+
+        // Huge page memory is placed as a whole, lane boundaries need not be huge page aligned
+        if (slotMemory_) {
+            place(slotMemory_->data(), slotMemory_->size(), hugePageSize(policy.hugePages));
+            return;
+        }
+        for (std::size_t index = 0; index < geometry.laneCount; ++index) {
+            place(lanes + index * laneAreaSize(geometry, false) + laneHeaderSize(geometry), geometry.slotCount * geometry.chunkSize,
+                  hugePageSize(EHugePages::E_Off));
+        }
+    }
+
+    SharedMemoryTransport::SharedMemoryStructure* SharedMemoryTransport::initialize(shared_memory_object& object, Geometry geometry,
+                                                                                    const MemoryPolicy& policy) {
+        const bool separateData = policy.hugePages != EHugePages::E_Off;
         try {
-            memoryInitialization();
-        } catch (const interprocess_exception& ex) {
+            object.truncate(static_cast<offset_t>(segmentSize(geometry, separateData)));
+            region_ = std::make_shared<mapped_region>(object, read_write);
+            if (separateData) {
+                slotMemory_ = HugePageMemory::create(sharedMemoryName_, geometry.laneCount * geometry.slotCount * geometry.chunkSize,
+                                                     policy.hugePages);
+            }
+            char* lanes = static_cast<char*>(region_->get_address()) + headerSize();
+            placeSlots(lanes, geometry, policy);
+
+            // The segment is fresh and zero filled, which is a valid E_Empty header. It must not be
+            // constructed over: an attacher may already be registered as a waiter on initEvent.
+            SharedMemoryStructure* header = static_cast<SharedMemoryStructure*>(region_->get_address());
+            new (&header->mutex) interprocess_mutex;
+
+            header->activeProcessCount = 0;
+            header->chunkSize = geometry.chunkSize;
+            header->slotCount = geometry.slotCount;
+            header->laneCount = geometry.laneCount;
+            header->consumerCount = geometry.consumerCount;
+            header->consumersJoined = 0;
+            for (std::atomic<EConsumerState>& consumer : header->consumers) {
+                consumer = EConsumerState::E_Waiting;
+            }
+            header->pidNamespace = pidNamespace();
+            header->producerPid = 0;
+            for (std::atomic<std::int32_t>& pid : header->consumerPids) {
+                pid = 0;
+            }
+            header->producerLeft = false;
+            header->totalSize = UNKNOWN_SIZE;
+            header->stats.totalBytes = UNKNOWN_TOTAL;
+            header->stats.maxRate = 0;
+            header->stats.readers = static_cast<std::uint32_t>(geometry.laneCount);
+            header->stats.writers = static_cast<std::uint32_t>(geometry.laneCount * geometry.consumerCount);
+            header->offloadState = EOffloadState::E_Pending;
+            header->offloadProgress = 0;
+            header->signatureState = ESignatureState::E_NotRequested;
+            header->signatureProgress = 0;
+            header->resumeState = EResumeState::E_NotRequested;
+            header->resumeProgress = 0;
+            header->resumeOffset = 0;
+            header->producerEvent.reset();
+            header->consumerEvent.reset();
+            header->hugePageSize = separateData ? hugePageSize(policy.hugePages) : 0;
+            std::strncpy(header->slotMemoryPath, separateData ? slotMemory_->path().c_str() : "", sizeof(header->slotMemoryPath) - 1);
+
+            // Only the ring and slot headers are initialized, the data pages are left to the policy
+            for (std::size_t index = 0; index < geometry.laneCount; ++index) {
+                char* lane = lanes + index * laneAreaSize(geometry, separateData);
+                Ring* ring = new (lane) Ring();
+                ring->producerEvent.reset();
+                ring->consumerEvent.reset();
+            }
+
+            header->version = SEGMENT_VERSION;
+            header->magic = SEGMENT_MAGIC;
+            header->initState.store(EInitState::E_Ready, std::memory_order_release);
+            header->initEvent.notify();
+            return header;
+        } catch (const std::exception&) {
+            // Send processes that already mapped the segment back to creating their own
+            if (region_) {
+                static_cast<SharedMemoryStructure*>(region_->get_address())->initState = EInitState::E_Closed;
+                static_cast<SharedMemoryStructure*>(region_->get_address())->initEvent.notify();
+                region_.reset();
+            }
+            if (slotMemory_) {
+                slotMemory_->remove();
+                slotMemory_.reset();
+            }
             shared_memory_object::remove(sharedMemoryName_.c_str());
-            named_mutex::remove(namedMutex.c_str());
             throw;
         }
     }
 
-    void SharedMemoryTransport::memoryInitialization() {
-        boost::interprocess::named_mutex init_mutex(boost::interprocess::open_or_create, namedMutex.c_str());
-        boost::interprocess::scoped_lock<boost::interprocess::named_mutex> namedLock(init_mutex);
+    SharedMemoryTransport::SharedMemoryStructure* SharedMemoryTransport::adopt(std::chrono::steady_clock::time_point deadline) {
+        std::optional<shared_memory_object> object;
+        try {
+            object.emplace(open_only, sharedMemoryName_.c_str(), read_write);
+        } catch (const interprocess_exception& ex) {
+            // Removed since we failed to create it
+            if (ex.get_error_code() == not_found_error) {
+                return nullptr;
+            }
+            throw;
+        }
+
+        // The creator sizes the segment right after creating it
+        offset_t size = 0;
+        while (!object->get_size(size) or static_cast<std::size_t>(size) < headerSize()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("Shared memory " + sharedMemoryName_ + " was not initialized in time");
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+        region_ = std::make_shared<mapped_region>(*object, read_write);
+
+        SharedMemoryStructure* header = static_cast<SharedMemoryStructure*>(region_->get_address());
+        const bool initialized = waiter_.wait(header->initEvent, deadline - std::chrono::steady_clock::now(), [header] {
+            return header->initState.load(std::memory_order_acquire) != EInitState::E_Empty;
+        });
+        if (!initialized) {
+            throw std::runtime_error("Shared memory " + sharedMemoryName_ + " was not initialized in time");
+        }
+        if (header->initState == EInitState::E_Closed) {
+            region_.reset();
+            return nullptr;
+        }
+        if (header->magic != SEGMENT_MAGIC) {
+            throw std::runtime_error("Shared memory " + sharedMemoryName_ + " does not belong to a copy");
+        }
+        if (header->version != SEGMENT_VERSION) {
+            throw std::runtime_error("Shared memory " + sharedMemoryName_ + " has layout version " + std::to_string(header->version)
+                + ", expected " + std::to_string(SEGMENT_VERSION));
+        }
+
+        // Adopt the geometry chosen by the creator
+        const Geometry adopted{header->chunkSize, header->slotCount, header->laneCount, header->consumerCount};
+        const bool separateData = header->hugePageSize != 0;
+        if (segmentSize(adopted, separateData) > region_->get_size()) {
+            throw std::runtime_error("Shared memory geometry does not fit the segment");
+        }
+        if (separateData) {
+            slotMemory_ = HugePageMemory::open(header->slotMemoryPath, adopted.laneCount * adopted.slotCount * adopted.chunkSize);
+        }
+        return header;
+    }
 
-        auto [rawPointer, size] = segment_->find<SharedMemoryStructure>("SharedMemoryStructure");
-            
-        if (rawPointer == nullptr) {
-            rawPointer = segment_->construct<SharedMemoryStructure>("SharedMemoryStructure")();
-            new (&rawPointer->mutex) interprocess_mutex;
-            new (&rawPointer->condition) interprocess_condition;
+    bool SharedMemoryTransport::join(SharedMemoryStructure* header) {
+        scoped_lock<interprocess_mutex> lock(header->mutex);
+        // The last user is tearing the segment down, its name is about to go away
+        if (header->initState == EInitState::E_Closed) {
+            lock.unlock();
+            slotMemory_.reset();
+            region_.reset();
+            return false;
+        }
 
-            rawPointer->finished = false;
-            rawPointer->dataReady = false;
-            rawPointer->size1 = 0;
-            rawPointer->size2 = 0;
-            rawPointer->activeDataBlock = false;
-            rawPointer->activeProcessCount = 0;
+        // Every process that joined died without leaving, so nobody else is going to remove it
+        trackPeers_ = header->pidNamespace == pidNamespace();
+        auto gone = [](std::int32_t pid) { return pid != 0 and !alive(pid); };
+        bool abandoned = trackPeers_ and header->activeProcessCount > 0 and (header->producerLeft or gone(header->producerPid));
+        for (std::size_t index = 0; abandoned and index < header->consumersJoined; ++index) {
+            abandoned = header->consumers[index] != EConsumerState::E_Attached or gone(header->consumerPids[index]);
+        }
+        if (abandoned) {
+            header->initState = EInitState::E_Closed;
+            header->initEvent.notify();
+            lock.unlock();
+            std::cout << "Removing shared memory " << sharedMemoryName_ << " left behind by processes that are gone" << std::endl;
+            if (slotMemory_) {
+                slotMemory_->remove();
+                slotMemory_.reset();
+            }
+            region_.reset();
+            shared_memory_object::remove(sharedMemoryName_.c_str());
+            return false;
         }
-        
-        namedLock.unlock();
 
-        auto deleter = [segment = segment_, smName = sharedMemoryName_](SharedMemoryStructure* ptr){
+        // Set once this process has joined as a writer or as the reader, so that its departure is recorded
+        auto joined = std::make_shared<std::optional<std::size_t>>();
+        auto producer = std::make_shared<bool>(false);
+
+        auto deleter = [region = region_, smName = sharedMemoryName_, joined, producer, slotMemory = slotMemory_](SharedMemoryStructure* ptr){
             scoped_lock<interprocess_mutex> lock(ptr->mutex);
-            if (--ptr->activeProcessCount == 0) {
+            // A peer that took this process for dead has already recorded its departure
+            bool counted = true;
+            if (*joined) {
+                counted = ptr->consumers[**joined].exchange(EConsumerState::E_Left) != EConsumerState::E_Left;
+            } else if (*producer) {
+                counted = !ptr->producerLeft.exchange(true);
+            }
+            if (*joined) {
+                // The reader may be waiting for this writer's slots on any lane
+                const Geometry layout{ptr->chunkSize, ptr->slotCount, ptr->laneCount, ptr->consumerCount};
+                char* lanes = static_cast<char*>(region->get_address()) + headerSize();
+                for (std::size_t index = 0; index < layout.laneCount; ++index) {
+                    reinterpret_cast<Ring*>(lanes + index * laneAreaSize(layout, slotMemory != nullptr))->producerEvent.notify();
+                }
+            }
+            if (counted and --ptr->activeProcessCount == 0) {
+                ptr->stats.endedAt = monotonicNanoseconds();
+                ptr->initState = EInitState::E_Closed;
                 lock.unlock();
-                
-                segment->destroy<SharedMemoryStructure>("SharedMemoryStructure");
+
+                if (slotMemory) {
+                    slotMemory->remove();
+                }
                 shared_memory_object::remove(smName.c_str());
-                named_mutex::remove(namedMutex.c_str());
             }
         };
-        sharedMemory_ = SharedMemoryStructurePtr(rawPointer, deleter);
 
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
-        if (++sharedMemory_->activeProcessCount > 2) {
-            throw std::runtime_error("Reader and Writer already exist");
-        }
+        ++header->activeProcessCount;
+        sharedMemory_ = SharedMemoryStructurePtr(header, deleter);
+        attachLane(0);
+        const std::int32_t pid = trackPeers_ ? static_cast<std::int32_t>(getpid()) : 0;
+
+        if (sharedMemory_->activeProcessCount > 1 or sharedMemory_->consumersJoined > 0) {
+            if (sharedMemory_->consumersJoined >= sharedMemory_->consumerCount) {
+                throw std::runtime_error("Reader and Writer already exist");
+            }
 
-        if (sharedMemory_->activeProcessCount > 1) {
             strategy_ = EStrategy::E_Write;
+            consumer_ = sharedMemory_->consumersJoined++;
+            *joined = consumer_;
+            sharedMemory_->consumerPids[consumer_] = pid;
+            sharedMemory_->consumers[consumer_] = EConsumerState::E_Attached;
+            // Chunks the reader published while waiting for this writer start the clock now
+            if (writersJoined() and sharedMemory_->stats.sent.chunks > 0) {
+                startClock(sharedMemory_->stats);
+            }
+            // Wake up readers waiting in getBuffer() or finish() on any lane
+            for (std::size_t index = 0; index < sharedMemory_->laneCount; ++index) {
+                reinterpret_cast<Ring*>(laneAddress(index))->producerEvent.notify();
+            }
+        } else {
+            *producer = true;
+            sharedMemory_->producerPid = pid;
         }
+        return true;
     }
-    
-    std::span<char> SharedMemoryTransport::getBuffer() {
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
 
-        boost::posix_time::ptime timeout = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(10);
-        if (!sharedMemory_->condition.timed_wait(lock, timeout, [this] { return !sharedMemory_->dataReady; })) {
+    void SharedMemoryTransport::memoryInitialization(Geometry geometry, const MemoryPolicy& policy) {
+        validate(geometry);
+
+        const auto deadline = std::chrono::steady_clock::now() + TRANSPORT_TIMEOUT;
+        while (true) {
+            SharedMemoryStructure* header = nullptr;
+            if (std::optional<shared_memory_object> object = createExclusive(sharedMemoryName_)) {
+                header = initialize(*object, geometry, policy);
+            } else {
+                header = adopt(deadline);
+            }
+            if (header != nullptr and join(header)) {
+                return;
+            }
+
+            // A previous copy with the same name is still removing its segment
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("Shared memory " + sharedMemoryName_ + " is still being removed by a previous copy");
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    bool SharedMemoryTransport::peersAlive() {
+        if (!trackPeers_) {
+            return false;
+        }
+        SharedMemoryStructure& header = *sharedMemory_;
+
+        if (strategy_ == EStrategy::E_Write) {
+            const std::int32_t pid = header.producerPid;
+            if (pid != 0 and !header.producerLeft and !alive(pid)) {
+                scoped_lock<interprocess_mutex> lock(header.mutex);
+                if (!header.producerLeft.exchange(true)) {
+                    --header.activeProcessCount;
+                }
+                throw std::runtime_error("Reader (pid " + std::to_string(pid) + ") died before the copy was complete");
+            }
+            if (header.producerLeft) {
+                throw std::runtime_error("Reader left before the copy was complete");
+            }
+            return pid != 0;
+        }
+
+        // A writer that died is treated like one that left: its slots are no longer kept
+        const std::size_t joined = std::min<std::size_t>(header.consumersJoined, header.consumerCount);
+        bool known = true;
+        bool anyAlive = false;
+        for (std::size_t index = 0; index < joined; ++index) {
+            const std::int32_t pid = header.consumerPids[index];
+            const EConsumerState state = header.consumers[index];
+            if (state == EConsumerState::E_Left) {
+                continue;
+            }
+            // Still joining, or in another PID namespace
+            if (state == EConsumerState::E_Waiting or pid == 0) {
+                known = false;
+                anyAlive = true;
+                continue;
+            }
+            if (alive(pid)) {
+                anyAlive = true;
+                continue;
+            }
+
+            scoped_lock<interprocess_mutex> lock(header.mutex);
+            EConsumerState attached = EConsumerState::E_Attached;
+            if (header.consumers[index].compare_exchange_strong(attached, EConsumerState::E_Left)) {
+                --header.activeProcessCount;
+            }
+        }
+        if (joined == header.consumerCount and !anyAlive) {
+            throw std::runtime_error("Every writer left before the copy was complete");
+        }
+        return joined == header.consumerCount and known;
+    }
+
+    template <typename Predicate>
+    bool SharedMemoryTransport::waitFor(FutexEvent& event, Predicate predicate) {
+        // A peer that is alive may take as long as it needs, e.g. to sync or check a large target
+        auto deadline = std::chrono::steady_clock::now() + TRANSPORT_TIMEOUT;
+        while (!waiter_.wait(event, LIVENESS_INTERVAL, predicate)) {
+            bool waiting = false;
+            try {
+                waiting = peersAlive();
+            } catch (const std::runtime_error&) {
+                // The peer may have done what was waited for right before it left
+                if (predicate()) {
+                    return true;
+                }
+                throw;
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            if (waiting) {
+                deadline = now + TRANSPORT_TIMEOUT;
+            } else if (now >= deadline) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename Predicate>
+    bool SharedMemoryTransport::waitFor(FutexEvent& event, Predicate predicate, EStage stage) {
+        if (predicate()) {
+            return true;
+        }
+        ScopedStage waiting(&sharedMemory_->stats, stage);
+        return waitFor(event, predicate);
+    }
+
+    SharedMemoryTransport::Slot& SharedMemoryTransport::slot(std::uint64_t index) {
+        return slots_[index % sharedMemory_->slotCount];
+    }
+
+    const SharedMemoryTransport::Slot& SharedMemoryTransport::slot(std::uint64_t index) const {
+        return slots_[index % sharedMemory_->slotCount];
+    }
+
+    char* SharedMemoryTransport::slotData(std::uint64_t index) {
+        return data_ + (index % sharedMemory_->slotCount) * sharedMemory_->chunkSize;
+    }
+
+    void SharedMemoryTransport::setTotalSize(std::optional<std::uint64_t> size) {
+        sharedMemory_->totalSize = size.value_or(UNKNOWN_SIZE);
+        sharedMemory_->stats.totalBytes = size.value_or(UNKNOWN_TOTAL);
+    }
+
+    std::optional<std::uint64_t> SharedMemoryTransport::totalSize() const {
+        std::uint64_t size = sharedMemory_->totalSize;
+        return size == UNKNOWN_SIZE ? std::nullopt : std::optional<std::uint64_t>(size);
+    }
+
+    bool SharedMemoryTransport::offerLocalFile(const std::optional<LocalFile>& file) {
+        // Only a single writer can take over the copy
+        if (!file or file->path.size() >= sizeof(sharedMemory_->offeredPath) or sharedMemory_->consumerCount > 1) {
+            sharedMemory_->offloadState = EOffloadState::E_NoOffer;
+            sharedMemory_->consumerEvent.notify();
+            return false;
+        }
+
+        std::memcpy(sharedMemory_->offeredPath, file->path.c_str(), file->path.size() + 1);
+        sharedMemory_->offeredDevice = file->device;
+        sharedMemory_->offeredInode = file->inode;
+        sharedMemory_->offeredSize = file->size;
+        sharedMemory_->offloadState = EOffloadState::E_Offered;
+        sharedMemory_->consumerEvent.notify();
+
+        // The timeout restarts whenever the writer reports progress
+        std::uint64_t progress = 0;
+        while (true) {
+            bool answered = waitFor(sharedMemory_->producerEvent, [this, progress] {
+                EOffloadState state = sharedMemory_->offloadState;
+                return (state != EOffloadState::E_Offered and state != EOffloadState::E_Accepted)
+                    or sharedMemory_->offloadProgress != progress;
+            });
+
+            switch (sharedMemory_->offloadState.load()) {
+                case EOffloadState::E_Done:
+                    return true;
+                case EOffloadState::E_Declined:
+                    return false;
+                case EOffloadState::E_Failed:
+                    throw std::runtime_error("Writer failed to copy the file in the kernel");
+                default:
+                    break;
+            }
+
+            if (!answered) {
+                throw std::runtime_error("Timeout waiting for writer to copy the file");
+            }
+            progress = sharedMemory_->offloadProgress;
+        }
+    }
+
+    std::optional<LocalFile> SharedMemoryTransport::offeredLocalFile() {
+        if (!waitFor(sharedMemory_->consumerEvent, [this] { return sharedMemory_->offloadState != EOffloadState::E_Pending; })) {
+            throw std::runtime_error("Timeout waiting for reader to start");
+        }
+
+        if (sharedMemory_->offloadState != EOffloadState::E_Offered) {
+            return std::nullopt;
+        }
+        return LocalFile{sharedMemory_->offeredPath, sharedMemory_->offeredDevice, sharedMemory_->offeredInode, sharedMemory_->offeredSize};
+    }
+
+    void SharedMemoryTransport::reportOffload(EOffloadState state, std::uint64_t progress) {
+        sharedMemory_->offloadProgress = progress;
+        sharedMemory_->offloadState = state;
+        sharedMemory_->producerEvent.notify();
+    }
+
+    void SharedMemoryTransport::requestSignature() {
+        sharedMemory_->signatureState = ESignatureState::E_Requested;
+    }
+
+    std::optional<BlockSignature> SharedMemoryTransport::receivedSignature() {
+        // Like the offload, the timeout restarts whenever the writer reports progress
+        std::uint64_t progress = 0;
+        while (sharedMemory_->signatureState == ESignatureState::E_Requested) {
+            bool answered = waitFor(sharedMemory_->producerEvent, [this, progress] {
+                return sharedMemory_->signatureState != ESignatureState::E_Requested
+                    or sharedMemory_->signatureProgress != progress;
+            });
+            if (!answered) {
+                throw std::runtime_error("Timeout waiting for writer to hash the target");
+            }
+            progress = sharedMemory_->signatureProgress;
+        }
+
+        if (sharedMemory_->signatureState != ESignatureState::E_Ready) {
+            return std::nullopt;
+        }
+
+        // Copied out before the slots are claimed for data
+        const std::uint64_t* hashes = reinterpret_cast<const std::uint64_t*>(slotData(0));
+        BlockSignature signature;
+        signature.fileSize = sharedMemory_->signatureFileSize;
+        signature.blockSize = sharedMemory_->chunkSize;
+        signature.hashes.assign(hashes, hashes + sharedMemory_->signatureBlockCount);
+        return signature;
+    }
+
+    bool SharedMemoryTransport::signatureRequested() const {
+        return sharedMemory_->signatureState == ESignatureState::E_Requested;
+    }
+
+    bool SharedMemoryTransport::sendSignature(const std::optional<BlockSignature>& signature) {
+        // The producer does not claim any slot before the answer, so the hashes borrow them
+        const std::size_t capacity = sharedMemory_->slotCount * sharedMemory_->chunkSize / sizeof(std::uint64_t);
+        const bool fits = signature and signature->blockSize == sharedMemory_->chunkSize and signature->hashes.size() <= capacity;
+        if (fits) {
+            std::memcpy(slotData(0), signature->hashes.data(), signature->hashes.size() * sizeof(std::uint64_t));
+            sharedMemory_->signatureFileSize = signature->fileSize;
+            sharedMemory_->signatureBlockCount = signature->hashes.size();
+        }
+
+        sharedMemory_->signatureState = fits ? ESignatureState::E_Ready : ESignatureState::E_Declined;
+        sharedMemory_->producerEvent.notify();
+        return fits;
+    }
+
+    void SharedMemoryTransport::reportSignatureProgress(std::uint64_t blocks) {
+        sharedMemory_->signatureProgress = blocks;
+        sharedMemory_->producerEvent.notify();
+    }
+
+    void SharedMemoryTransport::requestResume() {
+        sharedMemory_->resumeState = EResumeState::E_Requested;
+    }
+
+    std::uint64_t SharedMemoryTransport::receivedResumeOffset() {
+        // Like the signature, the timeout restarts whenever the writer reports progress
+        std::uint64_t progress = 0;
+        while (sharedMemory_->resumeState == EResumeState::E_Requested) {
+            bool answered = waitFor(sharedMemory_->producerEvent, [this, progress] {
+                return sharedMemory_->resumeState != EResumeState::E_Requested
+                    or sharedMemory_->resumeProgress != progress;
+            });
+            if (!answered) {
+                throw std::runtime_error("Timeout waiting for writer to check the target");
+            }
+            progress = sharedMemory_->resumeProgress;
+        }
+        return sharedMemory_->resumeState == EResumeState::E_Answered ? sharedMemory_->resumeOffset.load() : 0;
+    }
+
+    bool SharedMemoryTransport::resumeRequested() const {
+        return sharedMemory_->resumeState == EResumeState::E_Requested;
+    }
+
+    void SharedMemoryTransport::sendResumeOffset(std::uint64_t offset) {
+        sharedMemory_->resumeOffset = offset;
+        sharedMemory_->resumeState = EResumeState::E_Answered;
+        sharedMemory_->producerEvent.notify();
+    }
+
+    void SharedMemoryTransport::reportResumeProgress(std::uint64_t bytes) {
+        sharedMemory_->resumeProgress = bytes;
+        sharedMemory_->producerEvent.notify();
+    }
+
+    std::size_t SharedMemoryTransport::chunkSize() const {
+        return sharedMemory_->chunkSize;
+    }
+
+    std::vector<std::span<char>> SharedMemoryTransport::buffers() {
+        std::vector<std::span<char>> result;
+        for (std::size_t index = 0; index < sharedMemory_->slotCount; ++index) {
+            result.emplace_back(slotData(index), sharedMemory_->chunkSize);
+        }
+        return result;
+    }
+
+    CopyStats* SharedMemoryTransport::stats() {
+        return &sharedMemory_->stats;
+    }
+
+    std::shared_ptr<SharedMemoryTransport::SharedMemoryStructure> SharedMemoryTransport::mapHeader(std::string_view name, bool writable) {
+        const std::string objectName(name);
+        const boost::interprocess::mode_t mode = writable ? read_write : read_only;
+        std::optional<shared_memory_object> object;
+        try {
+            object.emplace(open_only, objectName.c_str(), mode);
+        } catch (const interprocess_exception& ex) {
+            if (ex.get_error_code() == not_found_error) {
+                throw std::runtime_error("No copy is using shared memory " + objectName);
+            }
+            throw;
+        }
+
+        offset_t size = 0;
+        if (!object->get_size(size) or static_cast<std::size_t>(size) < headerSize()) {
+            throw std::runtime_error("Shared memory " + objectName + " is not initialized yet");
+        }
+        // Only the header is mapped, the slots are none of the observer's business
+        auto region = std::make_shared<mapped_region>(*object, mode, 0, headerSize());
+        SharedMemoryStructure* header = static_cast<SharedMemoryStructure*>(region->get_address());
+        if (header->initState.load(std::memory_order_acquire) == EInitState::E_Empty) {
+            throw std::runtime_error("Shared memory " + objectName + " is not initialized yet");
+        }
+        if (header->magic != SEGMENT_MAGIC) {
+            throw std::runtime_error("Shared memory " + objectName + " does not belong to a copy");
+        }
+        if (header->version != SEGMENT_VERSION) {
+            throw std::runtime_error("Shared memory " + objectName + " has layout version " + std::to_string(header->version)
+                + ", expected " + std::to_string(SEGMENT_VERSION));
+        }
+        // Keeps the mapping alive as long as the header is looked at
+        return std::shared_ptr<SharedMemoryStructure>(region, header);
+    }
+
+    std::shared_ptr<const CopyStats> SharedMemoryTransport::openStats(std::string_view name) {
+        std::shared_ptr<const SharedMemoryStructure> header = mapHeader(name, false);
+        return std::shared_ptr<const CopyStats>(header, &header->stats);
+    }
+
+    void SharedMemoryTransport::setMaxRate(std::string_view name, std::uint64_t rate) {
+        mapHeader(name, true)->stats.maxRate.store(rate, std::memory_order_relaxed);
+    }
+
+    std::uint64_t SharedMemoryTransport::releasedSlots() const {
+        std::uint64_t released = claimed_;
+        for (std::size_t index = 0; index < sharedMemory_->consumerCount; ++index) {
+            if (sharedMemory_->consumers[index] != EConsumerState::E_Left) {
+                released = std::min<std::uint64_t>(released, ring_->tails[index].value);
+            }
+        }
+        return released;
+    }
+
+    bool SharedMemoryTransport::drained() const {
+        if (!writersJoined()) {
+            return false;
+        }
+        for (std::size_t index = 0; index < sharedMemory_->consumerCount; ++index) {
+            if (sharedMemory_->consumers[index] != EConsumerState::E_Left and ring_->tails[index].value != head_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool SharedMemoryTransport::writersJoined() const {
+        return sharedMemory_->consumersJoined >= sharedMemory_->consumerCount;
+    }
+
+    std::span<char> SharedMemoryTransport::getBuffer() {
+        const std::size_t slotCount = sharedMemory_->slotCount;
+        auto available = [this, slotCount] { return claimed_ - releasedSlots() < slotCount; };
+        // Waiting for a writer that has not attached yet is not time the hand-off costs
+        const bool waited = writersJoined() ? waitFor(ring_->producerEvent, available, EStage::E_WaitForSlot)
+                                            : waitFor(ring_->producerEvent, available);
+        if (!waited) {
             throw std::runtime_error("Timeout waiting for data to be read");
         }
 
-        // Return the next writable buffer
-        char* targetData = sharedMemory_->activeDataBlock ? sharedMemory_->data2 : sharedMemory_->data1;
-        size_t& size = sharedMemory_->activeDataBlock ? sharedMemory_->size2 : sharedMemory_->size1;
+        const std::size_t consumerCount = sharedMemory_->consumerCount;
+        if (std::all_of(sharedMemory_->consumers, sharedMemory_->consumers + consumerCount,
+                        [](const std::atomic<EConsumerState>& consumer) { return consumer == EConsumerState::E_Left; })) {
+            throw std::runtime_error("Every writer left before the copy was complete");
+        }
+
+        return tryGetBuffer();
+    }
+
+    std::span<char> SharedMemoryTransport::tryGetBuffer() {
+        if (claimed_ - releasedSlots() >= sharedMemory_->slotCount) {
+            return {};
+        }
 
-        // Reset size since the buffer is for new data
-        size = 0;
-        
-        return std::span<char>(targetData, BUFFER_SIZE);
+        // Return the next writable slot, owned by the producer until it is published
+        slot(claimed_).size = 0;
+        return std::span<char>(slotData(claimed_++), sharedMemory_->chunkSize);
     }
 
     void SharedMemoryTransport::sendData(std::span<const char> buffer) {
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
+        publish(buffer, buffer.size(), 0, 0);
+    }
+
+    void SharedMemoryTransport::sendHole(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, 0, length, 0);
+    }
+
+    void SharedMemoryTransport::sendUnchanged(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, 0, 0, length);
+    }
 
-        size_t& size = sharedMemory_->activeDataBlock ? sharedMemory_->size2 : sharedMemory_->size1;
-        size = buffer.size();
-        
-        sharedMemory_->activeDataBlock = ~sharedMemory_->activeDataBlock;
-        
-        sharedMemory_->dataReady = true;
-        sharedMemory_->condition.notify_all();
+    void SharedMemoryTransport::sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) {
+        publish(buffer, buffer.size(), 0, 0, originalSize);
     }
-    
+
+    void SharedMemoryTransport::publish(std::span<const char> buffer, std::size_t size, std::uint64_t hole, std::uint64_t unchanged,
+                                        std::uint64_t original) {
+        // Slots are published in the order they were claimed
+        if (head_ == claimed_ or buffer.data() != slotData(head_)) {
+            throw std::logic_error("Data sent out of order");
+        }
+
+        Slot& published = slot(head_);
+        published.size = size;
+        published.hole = hole;
+        published.unchanged = unchanged;
+        published.original = original;
+        published.checksum = checksum_.value_or(0);
+        published.hasChecksum = std::exchange(checksum_, std::nullopt).has_value();
+
+        CopyStats& stats = sharedMemory_->stats;
+        stats.sent.chunks.fetch_add(1);
+        if (writersJoined()) {
+            startClock(stats);
+        }
+        stats.sent.bytes.fetch_add((original > 0 ? original : size) + hole + unchanged, std::memory_order_relaxed);
+        if (original > 0) {
+            stats.compressed.chunks.fetch_add(1, std::memory_order_relaxed);
+            stats.compressed.bytes.fetch_add(original, std::memory_order_relaxed);
+            stats.compressedSize.fetch_add(size, std::memory_order_relaxed);
+        }
+
+        ring_->head.store(++head_);
+        ring_->consumerEvent.notify();
+    }
+
+    void SharedMemoryTransport::setChecksum(std::uint32_t checksum) {
+        checksum_ = checksum;
+    }
+
     std::span<const char> SharedMemoryTransport::receiveData() {
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
-        
-        boost::posix_time::ptime timeout = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(10);
-        if (!sharedMemory_->condition.timed_wait(lock, timeout, [this] { return sharedMemory_->dataReady or sharedMemory_->finished; })) {
+        if (!waitFor(ring_->consumerEvent, [this] { return ring_->head != acquired_ or ring_->finished; }, EStage::E_WaitForData)) {
             throw std::runtime_error("Timeout waiting for data to be written");
         }
-        
-        if (sharedMemory_->dataReady) {
-            const char* sourceData = sharedMemory_->activeDataBlock ? sharedMemory_->data1 : sharedMemory_->data2;
-            const size_t& size = sharedMemory_->activeDataBlock ? sharedMemory_->size1 : sharedMemory_->size2;
 
-            sharedMemory_->dataReady = false;
-            sharedMemory_->condition.notify_all();
-            return std::span<const char>(sourceData, size);
+        return tryReceiveData();
+    }
+
+    std::span<const char> SharedMemoryTransport::tryReceiveData() {
+        if (ring_->head == acquired_) {
+            return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        }
+
+        // The slot stays with the consumer until releaseData
+        const std::size_t size = slot(acquired_).size;
+        return std::span<const char>(slotData(acquired_++), size);
+    }
+
+    void SharedMemoryTransport::releaseData() {
+        if (tail_ == acquired_) {
+            throw std::logic_error("No data to release");
         }
 
-        return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        const Slot& released = slot(tail_);
+        sharedMemory_->stats.written.chunks.fetch_add(1, std::memory_order_relaxed);
+        const std::uint64_t size = released.original > 0 ? released.original : released.size;
+        sharedMemory_->stats.written.bytes.fetch_add(size + released.hole + released.unchanged, std::memory_order_relaxed);
+
+        ring_->tails[consumer_].value.store(++tail_);
+        ring_->producerEvent.notify();
+    }
+
+    std::uint64_t SharedMemoryTransport::receivedHole() const {
+        return acquired_ == tail_ ? 0 : slot(acquired_ - 1).hole;
+    }
+
+    std::uint64_t SharedMemoryTransport::receivedUnchanged() const {
+        return acquired_ == tail_ ? 0 : slot(acquired_ - 1).unchanged;
+    }
+
+    std::uint64_t SharedMemoryTransport::receivedOriginalSize() const {
+        return acquired_ == tail_ ? 0 : slot(acquired_ - 1).original;
+    }
+
+    std::optional<std::uint32_t> SharedMemoryTransport::receivedChecksum() const {
+        if (acquired_ == tail_ or !slot(acquired_ - 1).hasChecksum) {
+            return std::nullopt;
+        }
+        return slot(acquired_ - 1).checksum;
     }
 
     bool SharedMemoryTransport::hasFinished() {
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
-        return sharedMemory_->finished and !sharedMemory_->dataReady;
+        return ring_->finished and ring_->head == acquired_;
     }
 
     void SharedMemoryTransport::finish() {
-        scoped_lock<interprocess_mutex> lock(sharedMemory_->mutex);
-        sharedMemory_->finished = true;
-        sharedMemory_->condition.notify_all();
+        ring_->finished = true;
+        ring_->consumerEvent.notify();
+
+        // Keep the segment alive until every writer has attached and drained the ring
+        waitFor(ring_->producerEvent, [this] { return drained(); });
 
-        boost::posix_time::ptime timeout = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(10);
-        sharedMemory_->condition.timed_wait(lock, timeout, [this] { return !sharedMemory_->dataReady; });
+        if (!writersJoined()) {
+            throw std::runtime_error("Timeout waiting for writer to attach");
+        }
+        for (std::size_t index = 0; index < sharedMemory_->consumerCount; ++index) {
+            if (sharedMemory_->consumers[index] == EConsumerState::E_Left and ring_->tails[index].value != head_) {
+                throw std::runtime_error("Writer " + std::to_string(index + 1) + " left before the copy was complete");
+            }
+        }
     }
 
-    
-} // namespace cp
\ No newline at end of file
+
+} // namespace cp
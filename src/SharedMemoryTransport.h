@@ -2,64 +2,288 @@
 
 #include "IDataTransport.h"
 #include "Constants.h"
+#include "Futex.h"
+#include "SlotMemory.h"
 
-#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/interprocess_condition.hpp>
 
-#include <functional>
+#include <climits>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 
 namespace cp {
-    
-    enum class EStrategy {
-       E_Read = 0,
-       E_Write 
-    };
 
-    class SharedMemoryTransport : public IDataTransport {
+    class SharedMemoryTransport final : public IDataTransport {
         public:
             using Ptr = std::unique_ptr<SharedMemoryTransport>;
 
-            SharedMemoryTransport(std::string_view name);
+            // Attaches to the segment and works on its first lane. Like the geometry, the memory
+            // policy is only applied by the process that creates the segment.
+            SharedMemoryTransport(std::string_view name, Geometry geometry = {}, MemoryPolicy policy = {});
             virtual ~SharedMemoryTransport() = default;
 
+            // Another view of the same attachment working on the given lane. Views are
+            // independent ends of their rings and may be used from different threads.
+            Ptr lane(std::size_t index) const;
+
             std::span<char> getBuffer() override;
+            std::span<char> tryGetBuffer() override;
 
             void sendData(std::span<const char> buffer) override;
+            void sendHole(std::span<const char> buffer, std::uint64_t length) override;
+            void sendUnchanged(std::span<const char> buffer, std::uint64_t length) override;
+            void sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) override;
+            void setChecksum(std::uint32_t checksum) override;
             std::span<const char> receiveData() override;
-            
+            std::span<const char> tryReceiveData() override;
+            void releaseData() override;
+            std::uint64_t receivedHole() const override;
+            std::uint64_t receivedUnchanged() const override;
+            std::uint64_t receivedOriginalSize() const override;
+            std::optional<std::uint32_t> receivedChecksum() const override;
+
             bool hasFinished() override;
             void finish() override;
-                
+
+            void setTotalSize(std::optional<std::uint64_t> size) override;
+            std::optional<std::uint64_t> totalSize() const override;
+
+            bool offerLocalFile(const std::optional<LocalFile>& file) override;
+            std::optional<LocalFile> offeredLocalFile() override;
+            void reportOffload(EOffloadState state, std::uint64_t progress) override;
+
+            void requestSignature() override;
+            std::optional<BlockSignature> receivedSignature() override;
+            bool signatureRequested() const override;
+            bool sendSignature(const std::optional<BlockSignature>& signature) override;
+            void reportSignatureProgress(std::uint64_t blocks) override;
+
+            void requestResume() override;
+            std::uint64_t receivedResumeOffset() override;
+            bool resumeRequested() const override;
+            void sendResumeOffset(std::uint64_t offset) override;
+            void reportResumeProgress(std::uint64_t bytes) override;
+
+            std::size_t chunkSize() const override;
+            std::vector<std::span<char>> buffers() override;
+            CopyStats* stats() override;
+
+            // Maps the statistics of the copy using the named segment read-only, without joining it:
+            // the copy neither waits for nor notices the observer. Valid after the copy has ended.
+            static std::shared_ptr<const CopyStats> openStats(std::string_view name);
+            // Changes the rate cap of the reader of the copy using the named segment, 0 lifts it
+            static void setMaxRate(std::string_view name, std::uint64_t rate);
+
+            [[nodiscard]]
+            inline Geometry geometry() const {
+                return {sharedMemory_->chunkSize, sharedMemory_->slotCount, sharedMemory_->laneCount, sharedMemory_->consumerCount};
+            }
+
             [[nodiscard]]
             inline EStrategy strategy() {
                 return strategy_;
             }
 
         private:
-            
-            void memoryInitialization();
 
+            SharedMemoryTransport(const SharedMemoryTransport& attached, std::size_t lane);
+
+            struct SharedMemoryStructure;
+
+            // Creates or attaches to the segment and joins it as the reader or a writer
+            void memoryInitialization(Geometry geometry, const MemoryPolicy& policy);
+            // Lays out a segment this process created
+            SharedMemoryStructure* initialize(boost::interprocess::shared_memory_object& object, Geometry geometry,
+                                              const MemoryPolicy& policy);
+            // Maps a segment created by another process once it is initialized; nullptr if it is going away
+            SharedMemoryStructure* adopt(std::chrono::steady_clock::time_point deadline);
+            // Registers this process; false if the segment is being torn down, or was left behind by
+            // processes that are all gone and has been removed
+            bool join(SharedMemoryStructure* header);
+            // Binds and pre-faults the slot data of every lane
+            void placeSlots(char* lanes, Geometry geometry, const MemoryPolicy& policy);
+            char* laneAddress(std::size_t index) const;
+            void attachLane(std::size_t index);
+
+            // Maps only the header of an initialized segment, without joining it
+            static std::shared_ptr<SharedMemoryStructure> mapHeader(std::string_view name, bool writable);
+            static std::size_t headerSize();
+            static std::size_t laneHeaderSize(Geometry geometry);
+            // The slot data is part of the lane area unless it lives in huge page memory
+            static std::size_t laneAreaSize(Geometry geometry, bool separateData);
+            static std::size_t segmentSize(Geometry geometry, bool separateData);
+
+            // Slots released by every writer that is still attached
+            std::uint64_t releasedSlots() const;
+            // Every writer has joined the segment, whether it is still attached or not
+            bool writersJoined() const;
+            // Every writer has attached and either released everything published or left
+            bool drained() const;
+
+            struct Slot;
+            void publish(std::span<const char> buffer, std::size_t size, std::uint64_t hole, std::uint64_t unchanged,
+                         std::uint64_t original = 0);
+
+            Slot& slot(std::uint64_t index);
+            const Slot& slot(std::uint64_t index) const;
+            char* slotData(std::uint64_t index);
+
+            // Records the departure of peers that died without leaving and throws if the copy cannot go
+            // on without them. True once every peer has joined and the ones still attached can be
+            // checked: waiting for them is safe however long it takes.
+            bool peersAlive();
+
+            // Blocks until predicate holds, checking on the peers every LIVENESS_INTERVAL. Gives up
+            // after TRANSPORT_TIMEOUT only while a peer has not joined yet.
+            template <typename Predicate>
+            bool waitFor(FutexEvent& event, Predicate predicate);
+            // Like waitFor, recording the time blocked as a pass through stage
+            template <typename Predicate>
+            bool waitFor(FutexEvent& event, Predicate predicate, EStage stage);
+
+            enum class ESignatureState : std::uint32_t {
+                E_NotRequested = 0,
+                E_Requested,    // the producer waits, the consumer may be hashing its target
+                E_Ready,        // the hashes are in the slots of the first lane
+                E_Declined
+            };
+
+            enum class EResumeState : std::uint32_t {
+                E_NotRequested = 0,
+                E_Requested,    // the producer waits, the consumer may be checking the kept prefix
+                E_Answered
+            };
+
+            enum class EConsumerState : std::uint32_t {
+                E_Waiting = 0,  // not attached yet; slots are kept for it
+                E_Attached,
+                E_Left          // detached; slots are no longer kept for it
+            };
+
+            enum class EInitState : std::uint32_t {
+                E_Empty = 0,    // created, the creator is still laying it out
+                E_Ready,
+                E_Closed        // the last user left or the creator failed; the name is about to be removed
+            };
+
+            // Header shared by all lanes, at the start of the segment. The segment is this header
+            // rounded up to a page, followed by the lanes: nothing else, no allocator.
             struct SharedMemoryStructure {
+                // Kept first in every layout version, so that any attacher can check them
+                std::atomic<std::uint32_t> magic;
+                std::uint32_t version;
+                std::atomic<EInitState> initState;
+                // Signalled when initState leaves E_Empty
+                FutexEvent initEvent;
+                // Only guards attach/detach; the data path is lock free
                 boost::interprocess::interprocess_mutex mutex;
-                boost::interprocess::interprocess_condition condition;
                 int activeProcessCount;
-                bool finished;
-                bool dataReady;
-                bool activeDataBlock; // false for data1, true for data2
-                size_t size1;
-                size_t size2;
-                char data1[BUFFER_SIZE] = {0};
-                char data2[BUFFER_SIZE] = {0};
+                std::size_t chunkSize;
+                std::size_t slotCount;
+                std::size_t laneCount;
+                std::size_t consumerCount;
+                // Page size of the huge page memory holding the slot data, 0 when it is in the lanes
+                std::size_t hugePageSize;
+                char slotMemoryPath[PATH_MAX];
+                // Writers join in order and get the index of their cursors; a writer that
+                // attached before and already left still counts
+                std::atomic<std::size_t> consumersJoined;
+                std::atomic<EConsumerState> consumers[MAX_CONSUMER_COUNT];
+                // Processes that joined, so that a peer that died is noticed instead of waited for. Pids
+                // are only comparable within the PID namespace of the creator; others record 0.
+                std::uint64_t pidNamespace;
+                std::atomic<std::int32_t> producerPid;
+                std::atomic<std::int32_t> consumerPids[MAX_CONSUMER_COUNT];
+                std::atomic<bool> producerLeft;
+                // UNKNOWN_SIZE until the producer knows what it is going to send
+                std::atomic<std::uint64_t> totalSize;
+                // Kernel offload negotiation, see IDataTransport::offerLocalFile
+                std::atomic<EOffloadState> offloadState;
+                std::atomic<std::uint64_t> offloadProgress;
+                std::uint64_t offeredDevice;
+                std::uint64_t offeredInode;
+                std::uint64_t offeredSize;
+                char offeredPath[PATH_MAX];
+                // Delta negotiation, see IDataTransport::requestSignature
+                std::atomic<ESignatureState> signatureState;
+                std::atomic<std::uint64_t> signatureProgress;
+                std::uint64_t signatureFileSize;
+                std::uint64_t signatureBlockCount;
+                // Resume negotiation, see IDataTransport::requestResume
+                std::atomic<EResumeState> resumeState;
+                std::atomic<std::uint64_t> resumeProgress;
+                std::atomic<std::uint64_t> resumeOffset;
+                // Signalled for the offload, signature and resume answers (producer waits) and the offer (consumer waits)
+                FutexEvent producerEvent;
+                FutexEvent consumerEvent;
+                // Recorded by both sides, read by copy --stats
+                CopyStats stats;
+            };
+
+            // Single producer / multiple consumer ring of one lane.
+            // head counts published slots, each writer's tail counts the slots it released,
+            // so a writer has nothing to read when head == tail and the ring is full when
+            // head - tail == slotCount for the slowest writer still attached.
+            // Each side may hold several slots at once: the producer claims slots ahead of head
+            // and a consumer acquires published slots ahead of its tail.
+            // Lanes are placed on page boundaries, so the alignment below holds.
+            struct alignas(64) Ring {
+                alignas(64) std::atomic<std::uint64_t> head;
+                struct alignas(64) Cursor {
+                    std::atomic<std::uint64_t> value;
+                };
+                Cursor tails[MAX_CONSUMER_COUNT];
+                alignas(64) std::atomic<bool> finished;
+                // Signalled when a tail moves or a writer attaches or leaves (producer waits)
+                // and when head moves (consumer waits)
+                FutexEvent producerEvent;
+                FutexEvent consumerEvent;
+            };
+
+            // Each lane starts with its ring and slot headers, followed by page aligned
+            // chunks of chunkSize bytes so that the data can be used for O_DIRECT I/O.
+            // With huge pages the chunks of all lanes are in the huge page memory instead.
+            struct alignas(64) Slot {
+                std::size_t size;
+                // Length of the zeros the slot stands for instead of data
+                std::uint64_t hole;
+                // Length of the target the consumer keeps as it is, for a delta copy
+                std::uint64_t unchanged;
+                // Size of the data before it was compressed, 0 if it is not
+                std::uint64_t original;
+                std::uint32_t checksum;
+                bool hasChecksum;
             };
 
-            using SharedMemoryStructurePtr = std::unique_ptr<SharedMemoryStructure, std::function<void(SharedMemoryStructure*)>>;
+            static constexpr std::uint64_t UNKNOWN_SIZE = ~std::uint64_t{0};
+
+            // Shared between the lane views of one attachment; the last one detaches
+            using SharedMemoryStructurePtr = std::shared_ptr<SharedMemoryStructure>;
 
             std::string sharedMemoryName_;
             EStrategy strategy_;
-            std::shared_ptr<boost::interprocess::managed_shared_memory> segment_;
+            std::shared_ptr<boost::interprocess::mapped_region> region_;
             SharedMemoryStructurePtr sharedMemory_;
+            HugePageMemory::Ptr slotMemory_;
+            Ring* ring_;
+            Slot* slots_;
+            char* data_;
+            // Index of this writer's tails, set once it has joined
+            std::size_t consumer_;
+            // Local cursors: claimed_ >= head_ on the producer side, acquired_ >= tail_ on the consumer side
+            std::uint64_t claimed_;
+            std::uint64_t head_;
+            std::uint64_t acquired_;
+            std::uint64_t tail_;
+            std::optional<std::uint32_t> checksum_;
+            // Whether this process shares the PID namespace of the segment and may check on its peers
+            bool trackPeers_;
+            AdaptiveWaiter waiter_;
     };
 
 
-} // namespace cp
\ No newline at end of file
+} // namespace cp
@@ -0,0 +1,238 @@
+#include "SlotMemory.h"
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace cp {
+
+    namespace fs = std::filesystem;
+
+    namespace {
+
+        std::string describe(EHugePages pages) {
+            return pages == EHugePages::E_1G ? "1G" : "2M";
+        }
+
+        // Default page size of hugetlbfs mounts without a pagesize option
+        std::size_t defaultHugePageSize() {
+            std::ifstream meminfo("/proc/meminfo");
+            std::string line;
+            while (std::getline(meminfo, line)) {
+                std::size_t kilobytes = 0;
+                if (std::sscanf(line.c_str(), "Hugepagesize: %zu kB", &kilobytes) == 1) {
+                    return kilobytes * 1024;
+                }
+            }
+            return 0;
+        }
+
+        std::size_t parsePageSize(const std::string& value) {
+            std::size_t size = std::stoull(value);
+            switch (value.empty() ? '\0' : value.back()) {
+                case 'K': case 'k': return size * 1024;
+                case 'M': case 'm': return size * 1024 * 1024;
+                case 'G': case 'g': return size * 1024 * 1024 * 1024;
+                default: return size;
+            }
+        }
+
+        std::optional<std::string> hugetlbfsMount(std::size_t pageSize) {
+            std::ifstream mounts("/proc/mounts");
+            std::string line;
+            while (std::getline(mounts, line)) {
+                std::istringstream fields(line);
+                std::string device, mountPoint, type, options;
+                if (!(fields >> device >> mountPoint >> type >> options) or type != "hugetlbfs") {
+                    continue;
+                }
+                std::size_t size = defaultHugePageSize();
+                const std::size_t option = options.find("pagesize=");
+                if (option != std::string::npos) {
+                    size = parsePageSize(options.substr(option + 9, options.find(',', option) - option - 9));
+                }
+                if (size == pageSize and access(mountPoint.c_str(), W_OK) == 0) {
+                    return mountPoint;
+                }
+            }
+            return std::nullopt;
+        }
+
+        std::system_error failure(const std::string& what) {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+    } // namespace
+
+    std::size_t hugePageSize(EHugePages pages) {
+        switch (pages) {
+            case EHugePages::E_2M: return 2 * 1024 * 1024;
+            case EHugePages::E_1G: return 1024 * 1024 * 1024;
+            default: return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        }
+    }
+
+    HugePageMemory::HugePageMemory(int fd, std::string path, std::size_t size, bool file)
+        : fd_(fd)
+        , path_(std::move(path))
+        , size_(size)
+        , data_(nullptr)
+        , file_(file) {
+
+        void* address = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (address == MAP_FAILED) {
+            const int error = errno;
+            close(fd_);
+            if (error == ENOMEM) {
+                throw std::runtime_error("Not enough free huge pages for " + std::to_string(size_)
+                    + " bytes of slots, see /sys/kernel/mm/hugepages");
+            }
+            errno = error;
+            throw failure("Failed to map " + path_);
+        }
+        data_ = static_cast<char*>(address);
+    }
+
+    HugePageMemory::~HugePageMemory() {
+        munmap(data_, size_);
+        close(fd_);
+    }
+
+    HugePageMemory::Ptr HugePageMemory::create(std::string_view name, std::size_t size, EHugePages pages) {
+        const std::size_t pageSize = hugePageSize(pages);
+        size = (size + pageSize - 1) / pageSize * pageSize;
+
+        int fd = -1;
+        std::string path;
+        bool file = false;
+        if (std::optional<std::string> mount = hugetlbfsMount(pageSize)) {
+            path = *mount + "/" + std::string(name);
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            file = true;
+        } else {
+            const unsigned int flags = MFD_CLOEXEC | MFD_HUGETLB | (pages == EHugePages::E_1G ? MFD_HUGE_1GB : MFD_HUGE_2MB);
+            fd = memfd_create(std::string(name).c_str(), flags);
+            path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd);
+        }
+        if (fd == -1) {
+            throw failure("Failed to create " + describe(pages) + " huge page memory for " + std::string(name));
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            const int error = errno;
+            close(fd);
+            if (file) {
+                unlink(path.c_str());
+            }
+            errno = error;
+            throw failure("Failed to size huge page memory " + path);
+        }
+
+        try {
+            return Ptr(new HugePageMemory(fd, path, size, file));
+        } catch (...) {
+            if (file) {
+                unlink(path.c_str());
+            }
+            throw;
+        }
+    }
+
+    HugePageMemory::Ptr HugePageMemory::open(const std::string& path, std::size_t size) {
+        const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd == -1) {
+            throw failure("Failed to open huge page memory " + path);
+        }
+        // A memfd goes away with its last mapping, a hugetlbfs file has to be unlinked
+        return Ptr(new HugePageMemory(fd, path, size, !path.starts_with("/proc/")));
+    }
+
+    void HugePageMemory::remove() {
+        if (file_) {
+            unlink(path_.c_str());
+            file_ = false;
+        }
+    }
+
+    void bindToNode(void* address, std::size_t size, int node) {
+        constexpr std::size_t bits = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask(static_cast<std::size_t>(node) / bits + 1);
+        mask[node / bits] |= 1UL << (node % bits);
+        if (syscall(SYS_mbind, address, size, MPOL_BIND, mask.data(), mask.size() * bits + 1, 0) != 0) {
+            throw failure("Failed to bind the slots to NUMA node " + std::to_string(node));
+        }
+    }
+
+    void prefault(char* address, std::size_t size, std::size_t threads, std::size_t pageSize) {
+        const std::size_t pages = (size + pageSize - 1) / pageSize;
+        threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(pages, 1));
+        const std::size_t share = (pages + threads - 1) / threads * pageSize;
+
+        auto touch = [pageSize](char* begin, char* end) {
+            // Fall back to writing one byte per page on kernels without MADV_POPULATE_WRITE
+            if (madvise(begin, end - begin, MADV_POPULATE_WRITE) != 0) {
+                for (volatile char* page = begin; page < end; page += pageSize) {
+                    *page = 0;
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (std::size_t offset = share; offset < size; offset += share) {
+            workers.emplace_back(touch, address + offset, address + std::min(size, offset + share));
+        }
+        touch(address, address + std::min(size, share));
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int deviceNode(const std::string& path) {
+        // A target that does not exist yet ends up on the device of its directory
+        fs::path existing = fs::absolute(path);
+        struct stat status {};
+        while (stat(existing.c_str(), &status) != 0) {
+            if (!existing.has_relative_path()) {
+                return -1;
+            }
+            existing = existing.parent_path();
+        }
+
+        std::error_code error;
+        const std::string device = std::to_string(major(status.st_dev)) + ":" + std::to_string(minor(status.st_dev));
+        fs::path directory = fs::canonical("/sys/dev/block/" + device, error);
+        if (error) {
+            return -1;
+        }
+
+        // Partitions and virtual block devices inherit the node of the controller they sit on
+        for (; directory.has_relative_path() and directory != "/sys/devices"; directory = directory.parent_path()) {
+            for (const fs::path& candidate : {directory / "device" / "numa_node", directory / "numa_node"}) {
+                std::ifstream file(candidate);
+                int node = -1;
+                if (file >> node and node >= 0) {
+                    return node;
+                }
+            }
+        }
+        return -1;
+    }
+
+} // namespace cp
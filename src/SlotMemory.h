@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace cp {
+
+    enum class EHugePages {
+        E_Off = 0,
+        E_2M,
+        E_1G
+    };
+
+    // How the creator of a segment places the memory of its slots
+    struct MemoryPolicy {
+        EHugePages hugePages = EHugePages::E_Off;
+        // NUMA node the slot memory is bound to, -1 for no binding
+        int numaNode = -1;
+        // Threads touching the slot memory before the copy starts, 0 to fault it in lazily
+        std::size_t prefaultThreads = 0;
+    };
+
+    std::size_t hugePageSize(EHugePages pages);
+
+    // Slot data kept outside the segment, on huge pages. It lives in a file on a hugetlbfs mount
+    // with the right page size, or in a memfd that other processes open through /proc when no
+    // such mount exists. Attachers find it through path().
+    class HugePageMemory {
+    public:
+        using Ptr = std::shared_ptr<HugePageMemory>;
+
+        static Ptr create(std::string_view name, std::size_t size, EHugePages pages);
+        static Ptr open(const std::string& path, std::size_t size);
+
+        ~HugePageMemory();
+
+        HugePageMemory(const HugePageMemory&) = delete;
+        HugePageMemory& operator=(const HugePageMemory&) = delete;
+
+        char* data() const {
+            return data_;
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        const std::string& path() const {
+            return path_;
+        }
+
+        // Unlinks the hugetlbfs file; the mapping stays valid
+        void remove();
+
+    private:
+        HugePageMemory(int fd, std::string path, std::size_t size, bool file);
+
+        int fd_;
+        std::string path_;
+        std::size_t size_;
+        char* data_;
+        // Created on a hugetlbfs mount, as opposed to a memfd
+        bool file_;
+    };
+
+    // Binds the pages of [address, address + size) that are not faulted in yet to a NUMA node
+    void bindToNode(void* address, std::size_t size, int node);
+
+    // Faults [address, address + size) in for writing, splitting the range between threads
+    void prefault(char* address, std::size_t size, std::size_t threads, std::size_t pageSize);
+
+    // NUMA node of the block device holding the file or directory, -1 if it has none
+    int deviceNode(const std::string& path);
+
+} // namespace cp
@@ -0,0 +1,712 @@
+#include "SocketTransport.h"
+
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace cp {
+
+    namespace {
+
+        constexpr std::uint32_t PROTOCOL_VERSION = 3;
+
+        // Frame flags
+        constexpr std::uint32_t FRAME_CHECKSUM = 1;     // checksum is set
+        constexpr std::uint32_t FRAME_SIGNATURE = 2;    // the reader wants the signature of the target
+        constexpr std::uint32_t FRAME_DECLINED = 4;     // the writer has no signature to send
+        constexpr std::uint32_t FRAME_RESUME = 8;       // the reader continues an interrupted copy
+
+        constexpr std::uint64_t UNKNOWN_SIZE = ~std::uint64_t{0};
+
+        // Below this the page pinning of MSG_ZEROCOPY costs more than the copy it saves
+        constexpr std::size_t ZEROCOPY_MIN_SIZE = 64 * 1024;
+
+        // How long a socket file may refuse connections before it is taken for a leftover
+        constexpr std::chrono::milliseconds STALE_SOCKET_DELAY{100};
+
+        std::system_error failure(const std::string& what) {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        void validate(Geometry geometry) {
+            if (geometry.chunkSize < MIN_CHUNK_SIZE or geometry.chunkSize > MAX_CHUNK_SIZE
+                or geometry.chunkSize % SLOT_ALIGNMENT != 0) {
+                throw std::invalid_argument("Chunk size must be a multiple of " + std::to_string(SLOT_ALIGNMENT) + " between "
+                    + std::to_string(MIN_CHUNK_SIZE) + " and " + std::to_string(MAX_CHUNK_SIZE) + " bytes, got "
+                    + std::to_string(geometry.chunkSize));
+            }
+            if (geometry.slotCount == 0 or geometry.slotCount > MAX_SLOT_COUNT) {
+                throw std::invalid_argument("Slot count must be between 1 and " + std::to_string(MAX_SLOT_COUNT)
+                    + ", got " + std::to_string(geometry.slotCount));
+            }
+            if (geometry.laneCount != 1 or geometry.consumerCount != 1) {
+                throw std::invalid_argument("A socket carries a single stream to a single writer");
+            }
+        }
+
+        // Address of a Unix socket path or a host:port endpoint
+        struct Address {
+            sockaddr_storage storage{};
+            socklen_t length = 0;
+            int family = AF_UNSPEC;
+        };
+
+        Address resolve(ESocketFamily family, const std::string& endpoint) {
+            Address address;
+            if (family == ESocketFamily::E_Unix) {
+                sockaddr_un* local = reinterpret_cast<sockaddr_un*>(&address.storage);
+                if (endpoint.empty() or endpoint.size() >= sizeof(local->sun_path)) {
+                    throw std::invalid_argument("Socket path must have between 1 and " + std::to_string(sizeof(local->sun_path) - 1)
+                        + " characters: " + endpoint);
+                }
+                local->sun_family = AF_UNIX;
+                std::memcpy(local->sun_path, endpoint.c_str(), endpoint.size() + 1);
+                address.length = sizeof(sockaddr_un);
+                address.family = AF_UNIX;
+                return address;
+            }
+
+            // host:port, with the host in brackets for an IPv6 address
+            const std::size_t colon = endpoint.rfind(':');
+            if (colon == std::string::npos or colon + 1 == endpoint.size()) {
+                throw std::invalid_argument("TCP endpoint must be host:port, got " + endpoint);
+            }
+            std::string host = endpoint.substr(0, colon);
+            const std::string port = endpoint.substr(colon + 1);
+            if (host.size() >= 2 and host.front() == '[' and host.back() == ']') {
+                host = host.substr(1, host.size() - 2);
+            }
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* results = nullptr;
+            const int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results);
+            if (status != 0) {
+                throw std::runtime_error("Failed to resolve " + endpoint + ": " + gai_strerror(status));
+            }
+            std::memcpy(&address.storage, results->ai_addr, results->ai_addrlen);
+            address.length = results->ai_addrlen;
+            address.family = results->ai_family;
+            freeaddrinfo(results);
+            return address;
+        }
+
+        int openSocket(const Address& address) {
+            const int fd = socket(address.family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd == -1) {
+                throw failure("Failed to create socket");
+            }
+            return fd;
+        }
+
+        void setTimeout(int fd, int option) {
+            timeval timeout{};
+            timeout.tv_sec = TRANSPORT_TIMEOUT.count();
+            setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+        }
+
+        // The host of a TCP peer can go away without closing the connection: keepalive probes
+        // notice it while the connection is idle, the user timeout while data is unacknowledged
+        void watchPeer(int fd) {
+            const int enable = 1;
+            const int idle = static_cast<int>(TCP_PEER_TIMEOUT.count()) / 2;
+            const int interval = 1;
+            const int probes = idle / interval;
+            const unsigned timeout = static_cast<unsigned>(std::chrono::milliseconds(TCP_PEER_TIMEOUT).count());
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+            setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+        }
+
+        // Whether the connection still stands. A peer that exits closes it, one that stops answering
+        // over TCP fails it, so a connected peer is alive and may take as long as it needs.
+        bool connected(int fd) {
+            // Not POLLERR: zero-copy completions are reported through the error queue as well
+            pollfd state{fd, POLLRDHUP, 0};
+            int error = 0;
+            socklen_t length = sizeof(error);
+            return poll(&state, 1, 0) >= 0 and (state.revents & (POLLHUP | POLLRDHUP)) == 0
+                and getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 and error == 0;
+        }
+
+    } // namespace
+
+    SocketTransport::SocketTransport(ESocketFamily family, std::string_view endpoint, Geometry geometry)
+        : fd_(-1)
+        , strategy_(EStrategy::E_Read)
+        , geometry_(geometry)
+        , memory_(nullptr, std::free)
+        , zeroCopy_(false)
+        , claimed_(0)
+        , sent_(0)
+        , released_(0)
+        , nextZeroCopyId_(0)
+        , completed_(0)
+        , signatureRequested_(false)
+        , resumeRequested_(false)
+        , started_(false)
+        , acquired_(0)
+        , tail_(0)
+        , received_{}
+        , finished_(false)
+        , done_(false) {
+
+        validate(geometry_);
+        connectOrListen(family, std::string(endpoint));
+
+        try {
+            setTimeout(fd_, SO_RCVTIMEO);
+            setTimeout(fd_, SO_SNDTIMEO);
+            if (family == ESocketFamily::E_Tcp) {
+                const int enable = 1;
+                setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                watchPeer(fd_);
+            }
+
+            if (strategy_ == EStrategy::E_Read) {
+                // Not supported on Unix sockets, where the data is copied once anyway
+                const int enable = 1;
+                zeroCopy_ = family == ESocketFamily::E_Tcp and geometry_.chunkSize >= ZEROCOPY_MIN_SIZE
+                    and setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+
+                Frame hello{EFrameType::E_Hello, PROTOCOL_VERSION, 0, 0, 0, geometry_.chunkSize, geometry_.slotCount};
+                sendFrame(hello);
+            } else {
+                const Frame hello = receiveFrame("reader to start");
+                if (hello.type != EFrameType::E_Hello or hello.flags != PROTOCOL_VERSION) {
+                    throw std::runtime_error("The other end of the socket is not a reader of this version");
+                }
+                geometry_ = Geometry{hello.first, hello.second, 1, 1};
+                validate(geometry_);
+            }
+
+            if (family == ESocketFamily::E_Unix) {
+                // Lets a whole chunk be queued at once; the kernel caps it at net.core.wmem_max
+                const int size = static_cast<int>(std::min<std::size_t>(geometry_.chunkSize, INT32_MAX));
+                setsockopt(fd_, SOL_SOCKET, strategy_ == EStrategy::E_Read ? SO_SNDBUF : SO_RCVBUF, &size, sizeof(size));
+            }
+            allocateBuffers();
+        } catch (...) {
+            close(fd_);
+            throw;
+        }
+    }
+
+    SocketTransport::~SocketTransport() {
+        close(fd_);
+    }
+
+    void SocketTransport::connectOrListen(ESocketFamily family, const std::string& endpoint) {
+        const Address address = resolve(family, endpoint);
+        const auto deadline = std::chrono::steady_clock::now() + TRANSPORT_TIMEOUT;
+        std::optional<std::chrono::steady_clock::time_point> refusedSince;
+
+        // The first process to arrive listens and reads, the second one connects and writes
+        while (true) {
+            const int fd = openSocket(address);
+            if (connect(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == 0) {
+                fd_ = fd;
+                strategy_ = EStrategy::E_Write;
+                return;
+            }
+            const int error = errno;
+            close(fd);
+
+            // A socket file nobody listens on is left over from a copy that died, unless its
+            // owner is between bind and listen
+            if (error == ECONNREFUSED and family == ESocketFamily::E_Unix) {
+                const auto now = std::chrono::steady_clock::now();
+                if (!refusedSince) {
+                    refusedSince = now;
+                }
+                if (now - *refusedSince < STALE_SOCKET_DELAY) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    continue;
+                }
+                unlink(endpoint.c_str());
+            } else if (error != ECONNREFUSED and error != ENOENT) {
+                errno = error;
+                throw failure("Failed to connect to " + endpoint);
+            }
+
+            const int listener = openSocket(address);
+            const int enable = 1;
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            if (bind(listener, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == 0
+                and listen(listener, 1) == 0) {
+                pollfd waiting{listener, POLLIN, 0};
+                const int ready = poll(&waiting, 1, static_cast<int>(std::chrono::milliseconds(TRANSPORT_TIMEOUT).count()));
+                fd_ = ready > 0 ? accept4(listener, nullptr, nullptr, SOCK_CLOEXEC) : -1;
+                const int acceptError = ready == 0 ? ETIMEDOUT : errno;
+                close(listener);
+                // The writer is connected, nobody else may find the path
+                if (family == ESocketFamily::E_Unix) {
+                    unlink(endpoint.c_str());
+                }
+                if (fd_ == -1) {
+                    if (acceptError == ETIMEDOUT) {
+                        throw std::runtime_error("Timeout waiting for writer to attach");
+                    }
+                    errno = acceptError;
+                    throw failure("Failed to accept the writer on " + endpoint);
+                }
+                strategy_ = EStrategy::E_Read;
+                return;
+            }
+            const int bindError = errno;
+            close(listener);
+
+            // Someone else was faster and listens now
+            if (bindError != EADDRINUSE or std::chrono::steady_clock::now() > deadline) {
+                errno = bindError;
+                throw failure("Failed to listen on " + endpoint);
+            }
+            refusedSince.reset();
+        }
+    }
+
+    void SocketTransport::allocateBuffers() {
+        memory_.reset(static_cast<char*>(std::aligned_alloc(SLOT_ALIGNMENT, geometry_.chunkSize * geometry_.slotCount)));
+        if (!memory_) {
+            throw std::bad_alloc();
+        }
+        for (std::size_t index = 0; index < geometry_.slotCount; ++index) {
+            buffers_.emplace_back(memory_.get() + index * geometry_.chunkSize, geometry_.chunkSize);
+        }
+        headers_.resize(geometry_.slotCount);
+    }
+
+    void SocketTransport::sendFrame(Frame frame, std::span<const char> payload) {
+        frame.payload = payload.size();
+        iovec vectors[2] = {
+            {&frame, sizeof(frame)},
+            {const_cast<char*>(payload.data()), payload.size()}
+        };
+        sendAll(vectors, payload.empty() ? 1 : 2, false);
+    }
+
+    void SocketTransport::sendAll(iovec* vectors, int count, bool zeroCopy) {
+        while (count > 0) {
+            msghdr message{};
+            message.msg_iov = vectors;
+            message.msg_iovlen = static_cast<std::size_t>(count);
+            const ssize_t sent = sendmsg(fd_, &message, MSG_NOSIGNAL | (zeroCopy ? MSG_ZEROCOPY : 0));
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Out of memory for pinning pages: this part is copied instead
+                if (errno == ENOBUFS and zeroCopy) {
+                    zeroCopy = false;
+                    continue;
+                }
+                // The timeout restarts while the peer is connected, e.g. syncing a large target
+                if ((errno == EAGAIN or errno == EWOULDBLOCK) and connected(fd_)) {
+                    continue;
+                }
+                if (errno == EAGAIN or errno == EWOULDBLOCK or errno == EPIPE or errno == ECONNRESET) {
+                    throw std::runtime_error(strategy_ == EStrategy::E_Read ? "Writer left before the copy was complete"
+                                                                            : "Reader left before the copy was complete");
+                }
+                throw failure("Failed to send to the socket");
+            }
+            if (zeroCopy) {
+                ++nextZeroCopyId_;
+            }
+
+            std::size_t remaining = static_cast<std::size_t>(sent);
+            while (count > 0 and remaining >= vectors->iov_len) {
+                remaining -= vectors->iov_len;
+                ++vectors;
+                --count;
+            }
+            if (count > 0) {
+                vectors->iov_base = static_cast<char*>(vectors->iov_base) + remaining;
+                vectors->iov_len -= remaining;
+            }
+        }
+    }
+
+    SocketTransport::Frame SocketTransport::receiveFrame(std::string_view awaited) {
+        Frame frame{};
+        receiveAll(reinterpret_cast<char*>(&frame), sizeof(frame), awaited);
+        return frame;
+    }
+
+    void SocketTransport::receiveAll(char* data, std::size_t size, std::string_view awaited) {
+        while (size > 0) {
+            const ssize_t received = recv(fd_, data, size, MSG_WAITALL);
+            if (received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Like a send, waiting for the awaited step goes on while the peer is connected
+                if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                    if (connected(fd_)) {
+                        continue;
+                    }
+                    throw std::runtime_error("Lost the connection waiting for " + std::string(awaited));
+                }
+                if (errno != ECONNRESET) {
+                    throw failure("Failed to receive from the socket");
+                }
+            }
+            if (received <= 0) {
+                throw std::runtime_error(strategy_ == EStrategy::E_Read ? "Writer left before the copy was complete"
+                                                                        : "Reader left before the copy was complete");
+            }
+            data += received;
+            size -= static_cast<std::size_t>(received);
+        }
+    }
+
+    std::span<char> SocketTransport::getBuffer() {
+        if (claimed_ - sent_ >= geometry_.slotCount) {
+            throw std::logic_error("Every buffer is claimed");
+        }
+        while (claimed_ - released_ >= geometry_.slotCount) {
+            reapCompletions(true);
+        }
+        return tryGetBuffer();
+    }
+
+    std::span<char> SocketTransport::tryGetBuffer() {
+        if (claimed_ - released_ >= geometry_.slotCount) {
+            reapCompletions(false);
+            if (claimed_ - released_ >= geometry_.slotCount) {
+                return {};
+            }
+        }
+        return buffers_[claimed_++ % geometry_.slotCount];
+    }
+
+    void SocketTransport::sendData(std::span<const char> buffer) {
+        publish(buffer, Frame{EFrameType::E_Data, 0, 0, 0, 0, 0, 0});
+    }
+
+    void SocketTransport::sendHole(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, Frame{EFrameType::E_Hole, 0, 0, 0, 0, length, 0});
+    }
+
+    void SocketTransport::sendUnchanged(std::span<const char> buffer, std::uint64_t length) {
+        publish(buffer, Frame{EFrameType::E_Unchanged, 0, 0, 0, 0, length, 0});
+    }
+
+    void SocketTransport::sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) {
+        publish(buffer, Frame{EFrameType::E_Compressed, 0, 0, 0, 0, originalSize, 0});
+    }
+
+    void SocketTransport::publish(std::span<const char> buffer, Frame frame) {
+        // Buffers are sent in the order they were claimed
+        if (sent_ == claimed_ or buffer.data() != buffers_[sent_ % geometry_.slotCount].data()) {
+            throw std::logic_error("Data sent out of order");
+        }
+
+        if (checksum_) {
+            frame.flags |= FRAME_CHECKSUM;
+            frame.checksum = *std::exchange(checksum_, std::nullopt);
+        }
+        const bool data = frame.type == EFrameType::E_Data or frame.type == EFrameType::E_Compressed;
+        const std::span<const char> payload = data ? buffer : std::span<const char>();
+        Frame& header = headers_[sent_ % geometry_.slotCount];
+        header = frame;
+        header.payload = payload.size();
+        iovec vectors[2] = {
+            {&header, sizeof(header)},
+            {const_cast<char*>(payload.data()), payload.size()}
+        };
+        sendAll(vectors, payload.empty() ? 1 : 2, zeroCopy_ and payload.size() >= ZEROCOPY_MIN_SIZE);
+        ++sent_;
+
+        // Released once the kernel is done with every zero-copy send so far
+        inFlight_.push_back(nextZeroCopyId_);
+        reapCompletions(false);
+    }
+
+    void SocketTransport::reapCompletions(bool wait) {
+        // Only buffers sent with MSG_ZEROCOPY are held after their send
+        while (completed_ != nextZeroCopyId_) {
+            char control[128];
+            msghdr message{};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (recvmsg(fd_, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR) {
+                    throw failure("Failed to read zero-copy completions");
+                }
+                if (!wait) {
+                    break;
+                }
+                // The error queue signals POLLERR, whatever events are asked for
+                pollfd waiting{fd_, 0, 0};
+                if (poll(&waiting, 1, static_cast<int>(std::chrono::milliseconds(TRANSPORT_TIMEOUT).count())) == 0
+                    and !connected(fd_)) {
+                    throw std::runtime_error("Writer left before the copy was complete");
+                }
+                continue;
+            }
+            // Something completed; whatever else is queued is read without waiting
+            wait = false;
+
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+                const bool error = (header->cmsg_level == SOL_IP and header->cmsg_type == IP_RECVERR)
+                    or (header->cmsg_level == SOL_IPV6 and header->cmsg_type == IPV6_RECVERR);
+                const sock_extended_err* extended = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(header));
+                if (!error or extended->ee_errno != 0 or extended->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                for (std::uint32_t id = extended->ee_info; id != extended->ee_data + 1; ++id) {
+                    completedIds_.insert(id);
+                }
+                // The kernel copied after all, e.g. over loopback: pinning the pages only costs
+                if (extended->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    zeroCopy_ = false;
+                }
+            }
+            while (completedIds_.erase(completed_) > 0) {
+                ++completed_;
+            }
+        }
+
+        while (!inFlight_.empty() and static_cast<std::int32_t>(inFlight_.front() - completed_) <= 0) {
+            inFlight_.pop_front();
+            ++released_;
+        }
+    }
+
+    void SocketTransport::setChecksum(std::uint32_t checksum) {
+        checksum_ = checksum;
+    }
+
+    void SocketTransport::awaitStart() {
+        if (started_) {
+            return;
+        }
+        const Frame start = receiveFrame("reader to start");
+        if (start.type != EFrameType::E_Start) {
+            throw std::runtime_error("Unexpected frame from the reader before the start of the copy");
+        }
+        totalSize_ = start.first == UNKNOWN_SIZE ? std::nullopt : std::optional<std::uint64_t>(start.first);
+        signatureRequested_ = (start.flags & FRAME_SIGNATURE) != 0;
+        resumeRequested_ = (start.flags & FRAME_RESUME) != 0;
+        started_ = true;
+    }
+
+    std::span<const char> SocketTransport::receiveData() {
+        if (finished_ or acquired_ - tail_ >= geometry_.slotCount) {
+            return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        }
+        return receiveNext();
+    }
+
+    std::span<const char> SocketTransport::tryReceiveData() {
+        pollfd waiting{fd_, POLLIN, 0};
+        if (finished_ or acquired_ - tail_ >= geometry_.slotCount or poll(&waiting, 1, 0) <= 0) {
+            return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        }
+        return receiveNext();
+    }
+
+    std::span<const char> SocketTransport::receiveNext() {
+        awaitStart();
+        const Frame frame = receiveFrame("data to be written");
+        if (frame.type == EFrameType::E_Finish) {
+            finished_ = true;
+            reportDone();
+            return std::span<const char>(static_cast<const char*>(nullptr), 0);
+        }
+        const bool data = frame.type == EFrameType::E_Data or frame.type == EFrameType::E_Compressed;
+        if ((!data and frame.type != EFrameType::E_Hole and frame.type != EFrameType::E_Unchanged)
+            or frame.payload > geometry_.chunkSize or (!data and frame.payload != 0)
+            or (frame.type == EFrameType::E_Compressed and (frame.first == 0 or frame.first > geometry_.chunkSize))) {
+            throw std::runtime_error("Malformed frame from the reader");
+        }
+
+        // The buffer stays with the consumer until releaseData
+        std::span<char> buffer = buffers_[acquired_ % geometry_.slotCount];
+        receiveAll(buffer.data(), frame.payload, "data to be written");
+        received_ = frame;
+        ++acquired_;
+        return std::span<const char>(buffer.data(), frame.payload);
+    }
+
+    void SocketTransport::releaseData() {
+        if (tail_ == acquired_) {
+            throw std::logic_error("No data to release");
+        }
+        ++tail_;
+        reportDone();
+    }
+
+    void SocketTransport::reportDone() {
+        if (finished_ and !done_ and tail_ == acquired_) {
+            done_ = true;
+            sendFrame(Frame{EFrameType::E_Done, 0, 0, 0, 0, 0, 0});
+        }
+    }
+
+    std::uint64_t SocketTransport::receivedHole() const {
+        return acquired_ == tail_ or received_.type != EFrameType::E_Hole ? 0 : received_.first;
+    }
+
+    std::uint64_t SocketTransport::receivedUnchanged() const {
+        return acquired_ == tail_ or received_.type != EFrameType::E_Unchanged ? 0 : received_.first;
+    }
+
+    std::uint64_t SocketTransport::receivedOriginalSize() const {
+        return acquired_ == tail_ or received_.type != EFrameType::E_Compressed ? 0 : received_.first;
+    }
+
+    std::optional<std::uint32_t> SocketTransport::receivedChecksum() const {
+        if (acquired_ == tail_ or (received_.flags & FRAME_CHECKSUM) == 0) {
+            return std::nullopt;
+        }
+        return received_.checksum;
+    }
+
+    bool SocketTransport::hasFinished() {
+        return finished_;
+    }
+
+    void SocketTransport::finish() {
+        sendFrame(Frame{EFrameType::E_Finish, 0, 0, 0, 0, 0, 0});
+
+        // The socket stays open until the writer has written everything
+        const Frame done = receiveFrame("writer to finish");
+        if (done.type != EFrameType::E_Done) {
+            throw std::runtime_error("Unexpected frame from the writer at the end of the copy");
+        }
+    }
+
+    void SocketTransport::setTotalSize(std::optional<std::uint64_t> size) {
+        totalSize_ = size;
+    }
+
+    std::optional<std::uint64_t> SocketTransport::totalSize() const {
+        return totalSize_;
+    }
+
+    bool SocketTransport::offerLocalFile(const std::optional<LocalFile>& /*file*/) {
+        // The writer may be on another host, so the data always goes through the socket
+        const std::uint32_t flags = (signatureRequested_ ? FRAME_SIGNATURE : 0) | (resumeRequested_ ? FRAME_RESUME : 0);
+        Frame start{EFrameType::E_Start, flags, 0, 0, 0, totalSize_.value_or(UNKNOWN_SIZE), 0};
+        sendFrame(start);
+        started_ = true;
+        return false;
+    }
+
+    std::optional<LocalFile> SocketTransport::offeredLocalFile() {
+        awaitStart();
+        return std::nullopt;
+    }
+
+    void SocketTransport::requestSignature() {
+        signatureRequested_ = true;
+    }
+
+    std::optional<BlockSignature> SocketTransport::receivedSignature() {
+        if (!signatureRequested_) {
+            return std::nullopt;
+        }
+
+        // Progress reports of the writer hashing the target come first
+        Frame frame = receiveFrame("writer to hash the target");
+        while (frame.type == EFrameType::E_Progress) {
+            frame = receiveFrame("writer to hash the target");
+        }
+        if (frame.type != EFrameType::E_Signature or frame.payload != frame.second * sizeof(std::uint64_t)) {
+            throw std::runtime_error("Unexpected frame from the writer instead of the signature");
+        }
+        if (frame.flags & FRAME_DECLINED) {
+            return std::nullopt;
+        }
+
+        BlockSignature signature;
+        signature.fileSize = frame.first;
+        signature.blockSize = geometry_.chunkSize;
+        signature.hashes.resize(frame.second);
+        receiveAll(reinterpret_cast<char*>(signature.hashes.data()), frame.payload, "writer to send the signature");
+        return signature;
+    }
+
+    bool SocketTransport::signatureRequested() const {
+        return signatureRequested_;
+    }
+
+    bool SocketTransport::sendSignature(const std::optional<BlockSignature>& signature) {
+        // Unlike the slots of the shared memory, the socket fits a signature of any length
+        const bool fits = signature and signature->blockSize == geometry_.chunkSize;
+        if (!fits) {
+            sendFrame(Frame{EFrameType::E_Signature, FRAME_DECLINED, 0, 0, 0, 0, 0});
+            return false;
+        }
+
+        const std::span<const std::uint64_t> hashes(signature->hashes);
+        Frame frame{EFrameType::E_Signature, 0, 0, 0, 0, signature->fileSize, hashes.size()};
+        sendFrame(frame, std::span<const char>(reinterpret_cast<const char*>(hashes.data()), hashes.size_bytes()));
+        return true;
+    }
+
+    void SocketTransport::reportSignatureProgress(std::uint64_t blocks) {
+        sendFrame(Frame{EFrameType::E_Progress, 0, 0, 0, 0, blocks, 0});
+    }
+
+    void SocketTransport::requestResume() {
+        resumeRequested_ = true;
+    }
+
+    std::uint64_t SocketTransport::receivedResumeOffset() {
+        if (!resumeRequested_) {
+            return 0;
+        }
+
+        // Like the signature, progress reports come first
+        Frame frame = receiveFrame("writer to check the target");
+        while (frame.type == EFrameType::E_Progress) {
+            frame = receiveFrame("writer to check the target");
+        }
+        if (frame.type != EFrameType::E_Resumed or frame.payload != 0) {
+            throw std::runtime_error("Unexpected frame from the writer instead of the resume offset");
+        }
+        return frame.first;
+    }
+
+    bool SocketTransport::resumeRequested() const {
+        return resumeRequested_;
+    }
+
+    void SocketTransport::sendResumeOffset(std::uint64_t offset) {
+        sendFrame(Frame{EFrameType::E_Resumed, 0, 0, 0, 0, offset, 0});
+    }
+
+    void SocketTransport::reportResumeProgress(std::uint64_t bytes) {
+        sendFrame(Frame{EFrameType::E_Progress, 0, 0, 0, 0, bytes, 0});
+    }
+
+    std::size_t SocketTransport::chunkSize() const {
+        return geometry_.chunkSize;
+    }
+
+    std::vector<std::span<char>> SocketTransport::buffers() {
+        return buffers_;
+    }
+
+} // namespace cp
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "IDataTransport.h"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+
+namespace cp {
+
+    enum class ESocketFamily {
+        E_Unix = 0,
+        E_Tcp
+    };
+
+    // Stream socket between the two processes, for hosts or containers that share no memory.
+    // Chunks travel as frames (see Frame) and are received straight into local buffers; the
+    // producer keeps several in flight and, where the kernel supports it, sends them with
+    // MSG_ZEROCOPY, reusing a buffer once its completion has arrived.
+    class SocketTransport : public IDataTransport {
+        public:
+            using Ptr = std::unique_ptr<SocketTransport>;
+
+            // Connects to the endpoint, a socket path or host:port. If nobody listens there yet this
+            // process listens and waits for the other one: like with the shared memory, the process
+            // that comes first is the reader and its geometry is used.
+            SocketTransport(ESocketFamily family, std::string_view endpoint, Geometry geometry = {});
+            ~SocketTransport() override;
+
+            SocketTransport(const SocketTransport&) = delete;
+            SocketTransport& operator=(const SocketTransport&) = delete;
+
+            std::span<char> getBuffer() override;
+            std::span<char> tryGetBuffer() override;
+
+            void sendData(std::span<const char> buffer) override;
+            void sendHole(std::span<const char> buffer, std::uint64_t length) override;
+            void sendUnchanged(std::span<const char> buffer, std::uint64_t length) override;
+            void sendCompressed(std::span<const char> buffer, std::uint64_t originalSize) override;
+            void setChecksum(std::uint32_t checksum) override;
+            std::span<const char> receiveData() override;
+            std::span<const char> tryReceiveData() override;
+            void releaseData() override;
+            std::uint64_t receivedHole() const override;
+            std::uint64_t receivedUnchanged() const override;
+            std::uint64_t receivedOriginalSize() const override;
+            std::optional<std::uint32_t> receivedChecksum() const override;
+
+            bool hasFinished() override;
+            void finish() override;
+
+            void setTotalSize(std::optional<std::uint64_t> size) override;
+            std::optional<std::uint64_t> totalSize() const override;
+
+            bool offerLocalFile(const std::optional<LocalFile>& file) override;
+            std::optional<LocalFile> offeredLocalFile() override;
+
+            void requestSignature() override;
+            std::optional<BlockSignature> receivedSignature() override;
+            bool signatureRequested() const override;
+            bool sendSignature(const std::optional<BlockSignature>& signature) override;
+            void reportSignatureProgress(std::uint64_t blocks) override;
+
+            void requestResume() override;
+            std::uint64_t receivedResumeOffset() override;
+            bool resumeRequested() const override;
+            void sendResumeOffset(std::uint64_t offset) override;
+            void reportResumeProgress(std::uint64_t bytes) override;
+
+            std::size_t chunkSize() const override;
+            std::vector<std::span<char>> buffers() override;
+
+            [[nodiscard]]
+            inline Geometry geometry() const {
+                return geometry_;
+            }
+
+            [[nodiscard]]
+            inline EStrategy strategy() const {
+                return strategy_;
+            }
+
+        private:
+            enum class EFrameType : std::uint32_t {
+                E_Hello = 1,    // reader, first: first = chunk size, second = slot count, flags = protocol version
+                E_Start,        // reader, once before any data: first = total size, flags = FRAME_SIGNATURE, FRAME_RESUME
+                E_Progress,     // writer, while hashing its target or checking the kept prefix: first = blocks or bytes
+                E_Signature,    // writer: first = file size, second = block count, payload = hashes; flags = FRAME_DECLINED
+                E_Data,         // reader: payload = chunk
+                E_Hole,         // reader: first = length of zeros
+                E_Unchanged,    // reader: first = length the target keeps
+                E_Finish,       // reader, after the last chunk
+                E_Done,         // writer, once everything is written
+                E_Compressed,   // reader: payload = compressed chunk, first = its size before compression
+                E_Resumed       // writer, after the signature if any: first = bytes kept at the start of the target
+            };
+
+            // Fixed size header of every frame, in host byte order
+            struct Frame {
+                EFrameType type;
+                std::uint32_t flags;
+                std::uint32_t checksum;
+                std::uint32_t reserved;
+                std::uint64_t payload;
+                std::uint64_t first;
+                std::uint64_t second;
+            };
+
+            void connectOrListen(ESocketFamily family, const std::string& endpoint);
+            void allocateBuffers();
+
+            // Sends a frame with an optional payload
+            void sendFrame(Frame frame, std::span<const char> payload = {});
+            void sendAll(iovec* vectors, int count, bool zeroCopy);
+            // Waits as long as the connection stands; throws naming what was awaited when it is lost
+            Frame receiveFrame(std::string_view awaited);
+            void receiveAll(char* data, std::size_t size, std::string_view awaited);
+
+            // Producer side: sends the oldest claimed buffer
+            void publish(std::span<const char> buffer, Frame frame);
+            // Producer side: reads zero-copy completions, waiting for one if asked to, and hands
+            // back the buffers the kernel no longer references
+            void reapCompletions(bool wait);
+
+            // Consumer side: reads the start frame once, before anything else
+            void awaitStart();
+            // Consumer side: reads the next data, hole or finish frame into the next buffer
+            std::span<const char> receiveNext();
+            // Consumer side: tells the reader everything is written, once
+            void reportDone();
+
+            int fd_;
+            EStrategy strategy_;
+            Geometry geometry_;
+            std::unique_ptr<char, void (*)(void*)> memory_;
+            std::vector<std::span<char>> buffers_;
+            // Header sent with each buffer: with MSG_ZEROCOPY the kernel may read it after the send
+            // returns, like the payload, so it lives as long as the buffer is held
+            std::vector<Frame> headers_;
+            bool zeroCopy_;
+
+            // Producer: claimed_ >= sent_ >= released_. Every sent buffer that is not released yet waits
+            // for the zero-copy sends below the id recorded for it; completed_ is the first send that has
+            // not completed, later ones that have are in completedIds_.
+            std::uint64_t claimed_;
+            std::uint64_t sent_;
+            std::uint64_t released_;
+            std::deque<std::uint32_t> inFlight_;
+            std::uint32_t nextZeroCopyId_;
+            std::uint32_t completed_;
+            std::set<std::uint32_t> completedIds_;
+            std::optional<std::uint32_t> checksum_;
+            std::optional<std::uint64_t> totalSize_;
+            bool signatureRequested_;
+            bool resumeRequested_;
+            bool started_;
+
+            // Consumer: acquired_ >= tail_
+            std::uint64_t acquired_;
+            std::uint64_t tail_;
+            Frame received_;
+            bool finished_;
+            bool done_;
+    };
+
+} // namespace cp
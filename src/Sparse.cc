@@ -0,0 +1,111 @@
+#include "Sparse.h"
+
+#include <immintrin.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace cp {
+
+    namespace {
+
+        bool isZeroScalar(const char* data, std::size_t size) {
+            for (; size >= 8; data += 8, size -= 8) {
+                std::uint64_t word;
+                std::memcpy(&word, data, 8);
+                if (word != 0) {
+                    return false;
+                }
+            }
+            for (; size > 0; ++data, --size) {
+                if (*data != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        __attribute__((target("avx2")))
+        bool isZeroAvx2(const char* data, std::size_t size) {
+            // Four vectors per test, so the loop is bound by loads rather than branches
+            for (; size >= 128; data += 128, size -= 128) {
+                __m256i any = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)),
+                                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32))),
+                    _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 64)),
+                                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 96))));
+                if (!_mm256_testz_si256(any, any)) {
+                    return false;
+                }
+            }
+            return isZeroScalar(data, size);
+        }
+
+        using Check = bool (*)(const char*, std::size_t);
+
+        Check selectCheck() {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? isZeroAvx2 : isZeroScalar;
+        }
+
+    } // namespace
+
+    bool isZero(std::span<const char> data) {
+        static const Check check = selectCheck();
+        return check(data.data(), data.size());
+    }
+
+    FileExtents::FileExtents(int fd)
+        : fd_(fd)
+        , size_(0)
+        , from_(0)
+        , dataStart_(0)
+        , dataEnd_(0) {
+
+        struct stat status{};
+        if (fstat(fd_, &status) == 0) {
+            size_ = static_cast<std::uint64_t>(status.st_size);
+        }
+        locate(0);
+    }
+
+    void FileExtents::locate(std::uint64_t offset) {
+        from_ = offset;
+
+        off_t data = lseek(fd_, static_cast<off_t>(offset), SEEK_DATA);
+        if (data < 0) {
+            // ENXIO: only a hole is left up to the end; anything else: no hole support
+            dataStart_ = errno == ENXIO ? size_ : offset;
+            dataEnd_ = size_;
+            return;
+        }
+        dataStart_ = std::min(static_cast<std::uint64_t>(data), size_);
+
+        off_t hole = lseek(fd_, data, SEEK_HOLE);
+        dataEnd_ = hole < 0 ? size_ : std::min(static_cast<std::uint64_t>(hole), size_);
+    }
+
+    std::uint64_t FileExtents::holeAt(std::uint64_t offset) {
+        if (offset >= size_) {
+            return 0;
+        }
+        if (offset < from_ or offset >= dataEnd_) {
+            locate(offset);
+        }
+        return offset < dataStart_ ? dataStart_ - offset : 0;
+    }
+
+    std::uint64_t FileExtents::dataAt(std::uint64_t offset) {
+        if (offset >= size_) {
+            return 0;
+        }
+        if (offset < from_ or offset >= dataEnd_) {
+            locate(offset);
+        }
+        return offset >= dataStart_ ? dataEnd_ - offset : 0;
+    }
+
+} // namespace cp
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+namespace cp {
+
+    enum class ESparseMode {
+        E_Never = 0,    // holes are read and written as zeros
+        E_Auto,         // holes reported by the file system are skipped
+        E_Always        // chunks that are all zeros are skipped as well
+    };
+
+    // True if every byte is zero; uses AVX2 when the CPU has it
+    bool isZero(std::span<const char> data);
+
+    // Data and holes of a regular file, found with SEEK_DATA/SEEK_HOLE.
+    // On file systems without hole support the whole file is data.
+    class FileExtents {
+    public:
+        explicit FileExtents(int fd);
+
+        // Length of the hole starting at offset, 0 if data or the end of the file starts there
+        std::uint64_t holeAt(std::uint64_t offset);
+        // Bytes of data from offset up to the next hole or the end of the file, 0 inside a hole
+        std::uint64_t dataAt(std::uint64_t offset);
+
+    private:
+        // Finds the data extent at or after offset
+        void locate(std::uint64_t offset);
+
+        int fd_;
+        std::uint64_t size_;
+        // [from_, dataStart_) is a hole, [dataStart_, dataEnd_) is data
+        std::uint64_t from_;
+        std::uint64_t dataStart_;
+        std::uint64_t dataEnd_;
+    };
+
+} // namespace cp
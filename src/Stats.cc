@@ -0,0 +1,219 @@
+#include "Stats.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace cp {
+
+    namespace {
+
+        std::size_t bucketIndex(std::uint64_t nanoseconds) {
+            if (nanoseconds < HISTOGRAM_SUB_BUCKETS) {
+                return nanoseconds;
+            }
+            const unsigned exponent = std::bit_width(nanoseconds) - 1;
+            if (exponent > HISTOGRAM_MAX_EXPONENT) {
+                return HISTOGRAM_BUCKETS - 1;
+            }
+            const std::uint64_t sub = (nanoseconds >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) - HISTOGRAM_SUB_BUCKETS;
+            return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+        }
+
+        std::uint64_t bucketLowerBound(std::size_t index) {
+            if (index < HISTOGRAM_SUB_BUCKETS) {
+                return index;
+            }
+            const unsigned exponent = index / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+            const std::uint64_t sub = index % HISTOGRAM_SUB_BUCKETS;
+            return (HISTOGRAM_SUB_BUCKETS + sub) << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+        }
+
+        std::uint64_t elapsed(const CopyStats& stats, std::uint64_t now) {
+            const std::uint64_t started = stats.startedAt.load(std::memory_order_relaxed);
+            const std::uint64_t ended = stats.endedAt.load(std::memory_order_relaxed);
+            const std::uint64_t end = ended != 0 ? ended : now;
+            return started == 0 or end <= started ? 0 : end - started;
+        }
+
+        std::string formatDuration(std::uint64_t nanoseconds) {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(1);
+            if (nanoseconds < 1000) {
+                out << nanoseconds << " ns";
+            } else if (nanoseconds < 1000 * 1000) {
+                out << nanoseconds / 1e3 << " us";
+            } else if (nanoseconds < 1000 * 1000 * 1000) {
+                out << nanoseconds / 1e6 << " ms";
+            } else {
+                out << nanoseconds / 1e9 << " s";
+            }
+            return out.str();
+        }
+
+        std::string formatRate(std::uint64_t bytes, std::uint64_t nanoseconds) {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << (nanoseconds > 0 ? static_cast<double>(bytes) / nanoseconds : 0.0) << " GB/s";
+            return out.str();
+        }
+
+    } // namespace
+
+    const char* toString(EStage stage) {
+        switch (stage) {
+            case EStage::E_Read: return "read";
+            case EStage::E_Write: return "write";
+            case EStage::E_WaitForSlot: return "wait for slot";
+            case EStage::E_WaitForData: return "wait for data";
+            case EStage::E_Compress: return "compress";
+            case EStage::E_Decompress: return "decompress";
+            case EStage::E_Throttle: return "throttle";
+            case EStage::E_Count: break;
+        }
+        return "unknown";
+    }
+
+    bool readerStage(EStage stage) {
+        return stage == EStage::E_Read or stage == EStage::E_WaitForSlot or stage == EStage::E_Compress
+            or stage == EStage::E_Throttle;
+    }
+
+    const char* toString(EBottleneck bottleneck) {
+        switch (bottleneck) {
+            case EBottleneck::E_Reader: return "reader disk";
+            case EBottleneck::E_Writer: return "writer disk";
+            case EBottleneck::E_HandOff: return "hand-off between the processes";
+            case EBottleneck::E_RateCap: return "rate cap";
+            case EBottleneck::E_None: break;
+        }
+        return "none, nothing went through the shared memory";
+    }
+
+    std::uint64_t monotonicNanoseconds() {
+        // The same clock in every process, unlike the start of steady_clock's epoch on other platforms
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<std::uint64_t>(now.tv_sec) * 1000000000 + static_cast<std::uint64_t>(now.tv_nsec);
+    }
+
+    void StageHistogram::record(std::uint64_t nanoseconds) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        buckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+        std::uint64_t max = maxNanoseconds.load(std::memory_order_relaxed);
+        while (nanoseconds > max and !maxNanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t StageHistogram::percentile(double fraction) const {
+        // Summed from the buckets rather than taken from count, which an observer may see ahead of them
+        std::uint64_t total = 0;
+        for (const std::atomic<std::uint64_t>& bucket : buckets) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(fraction * total)));
+        std::uint64_t seen = 0;
+        for (std::size_t index = 0; index < HISTOGRAM_BUCKETS; ++index) {
+            seen += buckets[index].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return bucketLowerBound(index);
+            }
+        }
+        return bucketLowerBound(HISTOGRAM_BUCKETS - 1);
+    }
+
+    std::uint64_t writtenBytes(const CopyStats& stats) {
+        // The counter is summed over the writers of a broadcast
+        const std::uint64_t consumers = std::max<std::uint32_t>(stats.writers, 1) / std::max<std::uint32_t>(stats.readers, 1);
+        return stats.written.bytes.load(std::memory_order_relaxed) / std::max<std::uint64_t>(consumers, 1);
+    }
+
+    double stageShare(const CopyStats& stats, EStage stage, std::uint64_t now) {
+        const std::uint64_t time = elapsed(stats, now);
+        if (time == 0) {
+            return 0;
+        }
+        const std::uint32_t threads = std::max<std::uint32_t>(readerStage(stage) ? stats.readers : stats.writers, 1);
+        const double spent = static_cast<double>(stats.stage(stage).totalNanoseconds.load(std::memory_order_relaxed));
+        // The first read happens before the clock starts
+        return std::min(1.0, spent / threads / time);
+    }
+
+    EBottleneck bottleneck(const CopyStats& stats, std::uint64_t now) {
+        if (stats.sent.chunks.load(std::memory_order_relaxed) == 0) {
+            return EBottleneck::E_None;
+        }
+        if (stageShare(stats, EStage::E_Throttle, now) >= 0.5) {
+            return EBottleneck::E_RateCap;
+        }
+        const double reading = stageShare(stats, EStage::E_Read, now);
+        const double writing = stageShare(stats, EStage::E_Write, now);
+        if (std::max(reading, writing) < 0.5) {
+            return EBottleneck::E_HandOff;
+        }
+        return reading >= writing ? EBottleneck::E_Reader : EBottleneck::E_Writer;
+    }
+
+    void printProgress(std::ostream& out, const CopyStats& stats, std::uint64_t now, std::uint64_t previousBytes,
+                       std::uint64_t previousTime) {
+        const std::uint64_t written = writtenBytes(stats);
+        const std::uint64_t total = stats.totalBytes.load(std::memory_order_relaxed);
+
+        out << std::fixed << std::setprecision(1) << elapsed(stats, now) / 1e9 << " s: " << written << " bytes";
+        if (total != UNKNOWN_TOTAL and total > 0) {
+            out << " of " << total << " (" << 100.0 * written / total << "%)";
+        }
+        out << ", " << formatRate(written >= previousBytes ? written - previousBytes : 0, now - previousTime);
+        out << "; reading " << 100 * stageShare(stats, EStage::E_Read, now) << "%"
+            << ", writing " << 100 * stageShare(stats, EStage::E_Write, now) << "%"
+            << ", reader waiting " << 100 * stageShare(stats, EStage::E_WaitForSlot, now) << "%"
+            << ", writer waiting " << 100 * stageShare(stats, EStage::E_WaitForData, now) << "%";
+        if (const std::uint64_t rate = stats.maxRate.load(std::memory_order_relaxed); rate > 0) {
+            out << ", capped at " << formatRate(rate, 1000000000);
+        }
+        out << std::endl;
+    }
+
+    void printSummary(std::ostream& out, const CopyStats& stats, std::uint64_t now) {
+        out << std::left << std::setw(15) << "Stage" << std::right << std::setw(10) << "count" << std::setw(8) << "share"
+            << std::setw(11) << "p50" << std::setw(11) << "p99" << std::setw(11) << "max" << "\n";
+        for (std::size_t index = 0; index < static_cast<std::size_t>(EStage::E_Count); ++index) {
+            const EStage stage = static_cast<EStage>(index);
+            const StageHistogram& histogram = stats.stage(stage);
+            // The codec stages only matter when the copy is compressed, and the throttle when it is capped
+            const bool optional = stage == EStage::E_Compress or stage == EStage::E_Decompress or stage == EStage::E_Throttle;
+            if (optional and histogram.count.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            std::ostringstream share;
+            share << std::fixed << std::setprecision(1) << 100 * stageShare(stats, stage, now) << "%";
+            out << std::left << std::setw(15) << toString(stage) << std::right
+                << std::setw(10) << histogram.count.load(std::memory_order_relaxed) << std::setw(8) << share.str()
+                << std::setw(11) << formatDuration(histogram.percentile(0.5))
+                << std::setw(11) << formatDuration(histogram.percentile(0.99))
+                << std::setw(11) << formatDuration(histogram.maxNanoseconds.load(std::memory_order_relaxed)) << "\n";
+        }
+
+        const std::uint64_t time = elapsed(stats, now);
+        const std::uint64_t sent = stats.sent.bytes.load(std::memory_order_relaxed);
+        out << "Sent " << stats.sent.chunks.load(std::memory_order_relaxed) << " chunks, " << sent << " bytes in "
+            << formatDuration(time) << " (" << formatRate(sent, time) << "), written " << writtenBytes(stats) << " bytes\n";
+        if (const std::uint64_t original = stats.compressed.bytes.load(std::memory_order_relaxed); original > 0) {
+            const std::uint64_t size = stats.compressedSize.load(std::memory_order_relaxed);
+            out << "Compressed " << stats.compressed.chunks.load(std::memory_order_relaxed) << " chunks, " << original
+                << " bytes to " << size << " (" << std::fixed << std::setprecision(1) << 100.0 * size / original << "%)\n";
+        }
+        out << "Bottleneck: " << toString(bottleneck(stats, now)) << std::endl;
+    }
+
+} // namespace cp
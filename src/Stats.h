@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace cp {
+
+    // Stages of a copy whose duration is recorded: the reader's and the writer's file I/O, the
+    // time each side is blocked on the other in the transport, the codec and the rate cap
+    enum class EStage : std::uint32_t {
+        E_Read = 0,     // in the source: submitting and completing reads
+        E_Write,        // in the destination: writes, holes and unchanged ranges
+        E_WaitForSlot,  // reader blocked in getBuffer, every slot is still held by a writer
+        E_WaitForData,  // writer blocked in receiveData, nothing is published
+        E_Compress,     // reader blocked on the compression workers
+        E_Decompress,   // writer decompressing chunks
+        E_Throttle,     // reader held back by the rate cap
+        E_Count
+    };
+
+    const char* toString(EStage stage);
+
+    // Whether the reader records the stage, as opposed to the writers
+    bool readerStage(EStage stage);
+
+    // Durations are bucketed log-linearly like an HDR histogram: every power of two is split into
+    // HISTOGRAM_SUB_BUCKETS equal buckets, so a percentile is off by at most 1/8 of its value.
+    constexpr unsigned HISTOGRAM_SUB_BUCKET_BITS = 3;
+    constexpr std::size_t HISTOGRAM_SUB_BUCKETS = std::size_t{1} << HISTOGRAM_SUB_BUCKET_BITS;
+    // Durations from 2^42 ns (73 minutes) on share the last power of two
+    constexpr unsigned HISTOGRAM_MAX_EXPONENT = 42;
+    constexpr std::size_t HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKETS;
+
+    // Histogram of one stage. Lives in shared memory: zero filled is empty, and it is updated
+    // with relaxed atomics so that an observer can read it while the copy runs.
+    struct alignas(64) StageHistogram {
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> totalNanoseconds;
+        std::atomic<std::uint64_t> maxNanoseconds;
+        std::atomic<std::uint64_t> buckets[HISTOGRAM_BUCKETS];
+
+        void record(std::uint64_t nanoseconds);
+        // Lower bound of the bucket holding the given fraction of the recorded durations, 0 if empty
+        std::uint64_t percentile(double fraction) const;
+    };
+
+    constexpr std::uint64_t UNKNOWN_TOTAL = ~std::uint64_t{0};
+
+    // Counters of a copy, kept in the shared segment header. Reader and writer update different
+    // cache lines. Timestamps are CLOCK_MONOTONIC nanoseconds, comparable between processes.
+    struct CopyStats {
+        // First chunk published, and the last process detached from the segment; 0 until then
+        std::atomic<std::uint64_t> startedAt;
+        std::atomic<std::uint64_t> endedAt;
+        // Bytes the reader is going to send, UNKNOWN_TOTAL if it does not know
+        std::atomic<std::uint64_t> totalBytes;
+        // Threads recording each side's stages: one per lane, times the writers for the writer side
+        std::uint32_t readers;
+        std::uint32_t writers;
+
+        struct alignas(64) Counters {
+            std::atomic<std::uint64_t> chunks;
+            // Data, holes and unchanged ranges alike
+            std::atomic<std::uint64_t> bytes;
+        };
+        // Published by the reader, and released by the writers (summed over them)
+        Counters sent;
+        Counters written;
+        // Chunks the reader published compressed with their size before compression, and the bytes they took
+        Counters compressed;
+        std::atomic<std::uint64_t> compressedSize;
+
+        // Cap on the rate the reader reads at in bytes per second, 0 for none. Set by the reader
+        // when it starts and changed by copy --max-rate --stats while the copy runs.
+        std::atomic<std::uint64_t> maxRate;
+
+        StageHistogram stages[static_cast<std::size_t>(EStage::E_Count)];
+
+        StageHistogram& stage(EStage stage) {
+            return stages[static_cast<std::size_t>(stage)];
+        }
+        const StageHistogram& stage(EStage stage) const {
+            return stages[static_cast<std::size_t>(stage)];
+        }
+    };
+
+    std::uint64_t monotonicNanoseconds();
+
+    // Records the lifetime of the scope as one pass through a stage; does nothing without stats
+    class ScopedStage {
+    public:
+        ScopedStage(CopyStats* stats, EStage stage)
+            : histogram_(stats ? &stats->stage(stage) : nullptr)
+            , started_(histogram_ ? monotonicNanoseconds() : 0) {
+        }
+
+        ~ScopedStage() {
+            if (histogram_) {
+                histogram_->record(monotonicNanoseconds() - started_);
+            }
+        }
+
+        ScopedStage(const ScopedStage&) = delete;
+        ScopedStage& operator=(const ScopedStage&) = delete;
+
+    private:
+        StageHistogram* histogram_;
+        std::uint64_t started_;
+    };
+
+    // Time a thread spends in a stage over several calls per chunk, e.g. submitting a request and
+    // later completing it. Time between start and stop adds up until pass records it for one chunk.
+    class StageClock {
+    public:
+        StageClock(CopyStats* stats, EStage stage)
+            : histogram_(stats ? &stats->stage(stage) : nullptr)
+            , started_(0)
+            , pending_(0) {
+        }
+
+        void start() {
+            if (histogram_) {
+                started_ = monotonicNanoseconds();
+            }
+        }
+
+        void stop() {
+            if (histogram_) {
+                pending_ += monotonicNanoseconds() - started_;
+            }
+        }
+
+        // Stops the clock and records everything since the previous pass
+        void pass() {
+            if (histogram_) {
+                stop();
+                histogram_->record(pending_);
+                pending_ = 0;
+            }
+        }
+
+    private:
+        StageHistogram* histogram_;
+        std::uint64_t started_;
+        std::uint64_t pending_;
+    };
+
+    // Side of the copy that limited it, judged by the share of the time each side spent in its
+    // file I/O: the reader's disk, the writer's disk, or, if neither was busy half of the time,
+    // the hand-off between them. A reader held back by the rate cap half of the time was capped.
+    enum class EBottleneck {
+        E_None = 0,     // nothing went through the transport
+        E_Reader,
+        E_Writer,
+        E_HandOff,
+        E_RateCap
+    };
+
+    const char* toString(EBottleneck bottleneck);
+
+    // Bytes written by every writer so far
+    std::uint64_t writtenBytes(const CopyStats& stats);
+
+    // Share of the elapsed time one thread of the side spent in the stage, on average
+    double stageShare(const CopyStats& stats, EStage stage, std::uint64_t now);
+    EBottleneck bottleneck(const CopyStats& stats, std::uint64_t now);
+
+    // One line of progress since the previous snapshot, for watching a running copy
+    void printProgress(std::ostream& out, const CopyStats& stats, std::uint64_t now, std::uint64_t previousBytes,
+                       std::uint64_t previousTime);
+    // Per stage counts, shares and percentiles, followed by the bottleneck
+    void printSummary(std::ostream& out, const CopyStats& stats, std::uint64_t now);
+
+} // namespace cp
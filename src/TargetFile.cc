@@ -0,0 +1,109 @@
+#include "TargetFile.h"
+#include "Constants.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace cp
+{
+    TargetFile::TargetFile(std::string_view filename, int flags, bool patch, EDurability durability, bool flush)
+        : path_(std::filesystem::absolute(filename).string())
+        , patch_(patch and std::filesystem::is_regular_file(path_))
+        , durability_(durability)
+        , flush_(flush)
+        , fd_(open(path_.c_str(), flags | O_CREAT | (patch_ ? 0 : O_TRUNC) | O_CLOEXEC, TARGET_FILE_MODE))
+        , size_(0)
+        , allocated_(0)
+        , written_(0)
+        , finished_(false)
+        , writeBehind_(fd_, durability, 0, flush) {
+
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open target file: " + std::string(filename) + ": " + std::strerror(errno));
+        }
+
+        struct stat status{};
+        if (patch_ and fstat(fd_, &status) == 0) {
+            size_ = static_cast<std::uint64_t>(status.st_size);
+        }
+    }
+
+    TargetFile::~TargetFile() {
+        // Preallocated blocks past the end of the file go with a truncation to its size
+        if (!finished_ and !patch_ and std::max(allocated_, size_) > written_
+            and ftruncate(fd_, static_cast<off_t>(written_)) != 0) {
+            std::cerr << "Failed to release the blocks of target file: " << std::strerror(errno) << std::endl;
+        }
+        close(fd_);
+    }
+
+    void TargetFile::reserve(std::uint64_t size) {
+        if (patch_) {
+            resize(size);
+            return;
+        }
+        preallocate(fd_, size);
+        allocated_ = size;
+    }
+
+    void TargetFile::resize(std::uint64_t size) {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error(std::string("Failed to resize target file: ") + std::strerror(errno));
+        }
+        size_ = size;
+    }
+
+    void TargetFile::writeHole(std::uint64_t offset, std::uint64_t length) {
+        const std::uint64_t end = offset + length;
+        const std::uint64_t allocated = std::max(allocated_, size_);
+        if (end > size_ and ftruncate(fd_, static_cast<off_t>(end)) != 0) {
+            throw std::runtime_error(std::string("Failed to skip a hole in target file: ") + std::strerror(errno));
+        }
+        if (offset < allocated) {
+            punchHole(fd_, offset, std::min(end, allocated) - offset);
+        }
+        advance(end);
+    }
+
+    void TargetFile::advance(std::uint64_t offset) {
+        written_ = offset;
+        size_ = std::max(size_, offset);
+        writeBehind_.advance(offset);
+    }
+
+    void TargetFile::resume(std::uint64_t offset) {
+        if (ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+            throw std::runtime_error(std::string("Failed to truncate target file: ") + std::strerror(errno));
+        }
+        size_ = offset;
+        written_ = offset;
+        patch_ = false;
+        writeBehind_ = WriteBehind(fd_, durability_, offset, flush_);
+    }
+
+    void TargetFile::sync() {
+        writeBehind_.sync();
+    }
+
+    void TargetFile::finish() {
+        // The final length has to be part of what is synced
+        if (size_ > written_) {
+            resize(written_);
+        }
+        writeBehind_.finish();
+        // A new file is only found after a crash once its name is durable too
+        if (durability_ != EDurability::E_None and !patch_) {
+            syncDirectory(std::filesystem::path(path_).parent_path().string());
+        }
+        finished_ = true;
+    }
+
+} // namespace cp
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Durability.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cp
+{
+    // The target file of the stream, uring and mmap destinations, which only differ in how they
+    // write data into it. Owns the descriptor and everything else about the file: whether it is
+    // created or patched, its length and preallocated blocks, holes, resuming and durability.
+    class TargetFile {
+    public:
+
+        // With patch an existing regular file is overwritten in place instead of truncated;
+        // flags are added to O_CREAT and, for a new file, O_TRUNC
+        TargetFile(std::string_view filename, int flags, bool patch, EDurability durability, bool flush = true);
+        // An interrupted copy gives back what was reserved beyond the data it got to, unless it
+        // was patching a file whose old contents are still there
+        ~TargetFile();
+
+        TargetFile(const TargetFile&) = delete;
+        TargetFile& operator=(const TargetFile&) = delete;
+
+        int fd() const {
+            return fd_;
+        }
+
+        const std::string& path() const {
+            return path_;
+        }
+
+        // Length of the file as far as it was set or written through this target
+        std::uint64_t size() const {
+            return size_;
+        }
+
+        // The copy is going to be size bytes long: a new file has its blocks allocated, a patched one
+        // takes the length, as its blocks are allocated already
+        void reserve(std::uint64_t size);
+
+        // Sets the length, e.g. for a mapping to cover it
+        void resize(std::uint64_t size);
+
+        // [offset, offset + length) stays a hole: the file is extended over it first, as punching
+        // past its end is a no-op on some file systems, and blocks allocated in it are given back
+        void writeHole(std::uint64_t offset, std::uint64_t length);
+
+        // Everything before offset is written, as data, a hole or unchanged
+        void advance(std::uint64_t offset);
+
+        // Nothing after the prefix is trusted, and from here on the file is written like a new one
+        void resume(std::uint64_t offset);
+
+        void sync();
+
+        // Everything is written: the length becomes final, and the data and, for a new file, its
+        // name durable as the policy says
+        void finish();
+
+    private:
+        std::string path_;
+        bool patch_;
+        EDurability durability_;
+        bool flush_;
+        int fd_;
+        std::uint64_t size_;
+        // End of the blocks allocated by reserve, 0 if none
+        std::uint64_t allocated_;
+        std::uint64_t written_;
+        bool finished_;
+        WriteBehind writeBehind_;
+    };
+
+} // namespace cp
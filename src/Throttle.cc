@@ -0,0 +1,93 @@
+#include "Throttle.h"
+#include "Constants.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <thread>
+
+namespace cp {
+
+    namespace {
+
+        std::system_error failure(const std::string& what) {
+            return std::system_error(errno, std::generic_category(), what);
+        }
+
+        // From linux/ioprio.h, which older toolchains lack
+        constexpr int IOPRIO_WHO_PROCESS = 1;
+        constexpr int IOPRIO_CLASS_SHIFT = 13;
+        constexpr int IOPRIO_CLASS_BE = 2;
+        constexpr int IOPRIO_CLASS_IDLE = 3;
+
+        std::uint64_t nanoseconds(std::chrono::nanoseconds duration) {
+            return static_cast<std::uint64_t>(duration.count());
+        }
+
+    } // namespace
+
+    void setIoPriority(IoPriority priority) {
+        int value = 0;
+        switch (priority.ioClass) {
+            case EIoClass::E_Default:
+                return;
+            case EIoClass::E_BestEffort:
+                value = IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | std::clamp(priority.level, 0, 7);
+                break;
+            case EIoClass::E_Idle:
+                value = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+                break;
+        }
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) != 0) {
+            throw failure("Failed to set the I/O priority");
+        }
+    }
+
+    RateLimiter::RateLimiter(std::uint64_t rate, CopyStats* stats)
+        : stats_(stats)
+        , rate_(rate)
+        , next_(0) {
+        if (stats_ and rate > 0) {
+            stats_->maxRate.store(rate, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t RateLimiter::rate() const {
+        return stats_ ? stats_->maxRate.load(std::memory_order_relaxed) : rate_;
+    }
+
+    std::size_t RateLimiter::pieceSize(std::size_t chunkSize) const {
+        const std::uint64_t rate = this->rate();
+        if (rate == 0) {
+            return chunkSize;
+        }
+        const std::uint64_t piece = rate * nanoseconds(RATE_PACING_INTERVAL) / 1000000000 / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+        return static_cast<std::size_t>(std::clamp<std::uint64_t>(piece, std::min(RATE_MIN_PIECE, chunkSize), chunkSize));
+    }
+
+    void RateLimiter::take(std::size_t bytes) {
+        const std::uint64_t rate = this->rate();
+        if (rate == 0) {
+            return;
+        }
+
+        std::uint64_t wait = 0;
+        {
+            std::lock_guard lock(mutex_);
+            const std::uint64_t now = monotonicNanoseconds();
+            next_ = std::max(next_, now - std::min(now, nanoseconds(RATE_PACING_INTERVAL)));
+            wait = next_ > now ? next_ - now : 0;
+            next_ += static_cast<std::uint64_t>(static_cast<double>(bytes) * 1e9 / static_cast<double>(rate));
+        }
+        if (wait > 0) {
+            ScopedStage throttled(stats_, EStage::E_Throttle);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+    }
+
+} // namespace cp
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Stats.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace cp {
+
+    // I/O scheduling class of the process, see ioprio_set(2). Only honoured by schedulers that
+    // schedule by priority, such as BFQ.
+    enum class EIoClass {
+        E_Default = 0,  // whatever the process inherited
+        E_BestEffort,   // shares the disk by level, 0 (highest) to 7
+        E_Idle          // only gets the disk when nobody else uses it
+    };
+
+    struct IoPriority {
+        EIoClass ioClass = EIoClass::E_Default;
+        int level = 7;
+    };
+
+    // Applies the class to the calling thread and the threads it starts afterwards
+    void setIoPriority(IoPriority priority);
+
+    // Paces reads to a rate in bytes per second. Reads are cut into pieces of RATE_PACING_INTERVAL
+    // worth of bytes and each one waits for its turn, so the disk sees a steady stream of small
+    // reads rather than a burst of chunks followed by silence. Time left unused does not pile up
+    // beyond one interval. Safe to share between threads.
+    class RateLimiter {
+    public:
+        // With stats the rate is kept in the shared header, where copy --max-rate --stats changes
+        // it during the copy; a rate of 0 leaves what is there
+        RateLimiter(std::uint64_t rate, CopyStats* stats = nullptr);
+
+        // Bytes per second, 0 if unlimited
+        std::uint64_t rate() const;
+
+        // Largest read that fits into one interval at the current rate, up to chunkSize
+        std::size_t pieceSize(std::size_t chunkSize) const;
+
+        // Waits until bytes may be read, recorded as E_Throttle
+        void take(std::size_t bytes);
+
+    private:
+        CopyStats* stats_;
+        std::uint64_t rate_;
+        std::mutex mutex_;
+        // When the next piece is due, in monotonic nanoseconds
+        std::uint64_t next_;
+    };
+
+} // namespace cp
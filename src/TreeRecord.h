@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cp {
+
+    // Framed records used to copy a directory tree. Every chunk holds as many complete records
+    // as fit; a file larger than the free space is split into fragments across chunks.
+    //
+    //   [TreeRecordHeader][path, pathLength bytes][payload, length bytes][padding to 8 bytes]
+    //
+    // Paths are relative to the copied directory and use '/' as separator.
+    enum class ETreeRecordType : std::uint16_t {
+        E_Directory = 1,
+        E_File,         // payload is the file data at offset
+        E_Symlink       // payload is the link target
+    };
+
+    struct TreeRecordHeader {
+        std::uint32_t magic;
+        ETreeRecordType type;
+        std::uint16_t pathLength;
+        std::uint32_t mode;
+        std::uint32_t reserved;
+        // Size of the whole file, the offset and length of this fragment
+        std::uint64_t fileSize;
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+
+    constexpr std::uint32_t TREE_RECORD_MAGIC = 0x43505452; // "CPTR"
+    constexpr std::size_t TREE_RECORD_ALIGNMENT = 8;
+
+    constexpr std::size_t treeRecordSize(std::size_t pathLength, std::uint64_t length) {
+        const std::size_t size = sizeof(TreeRecordHeader) + pathLength + length;
+        return (size + TREE_RECORD_ALIGNMENT - 1) / TREE_RECORD_ALIGNMENT * TREE_RECORD_ALIGNMENT;
+    }
+
+} // namespace cp
@@ -0,0 +1,146 @@
+#include "Tuner.h"
+#include "Constants.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+namespace cp {
+
+    namespace {
+
+        constexpr std::size_t STAGE_COUNT = static_cast<std::size_t>(EStage::E_Count);
+
+    } // namespace
+
+    ChunkTuner::ChunkTuner(std::size_t chunkSize, std::size_t depth, const CopyStats* stats)
+        : stats_(stats)
+        , current_(0)
+        , settled_(false)
+        , chosen_(0)
+        , trialLength_(std::max<std::uint64_t>(TUNE_TRIAL_BYTES, 4 * static_cast<std::uint64_t>(chunkSize)))
+        , trialStart_(0)
+        , trialBytes_(0)
+        , stageStart_{} {
+
+        depth = std::max<std::size_t>(depth, 1);
+        trials_.push_back({chunkSize, depth});
+        // Whole pages, so that O_DIRECT reads stay aligned
+        for (std::size_t size = chunkSize / 2 / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+             trials_.size() < TUNE_CHUNK_CANDIDATES and size >= TUNE_MIN_CHUNK; size = size / 2 / SLOT_ALIGNMENT * SLOT_ALIGNMENT) {
+            trials_.push_back({size, depth});
+        }
+        chunkTrials_ = trials_.size();
+        // Nothing to compare
+        settled_ = chunkTrials_ == 1 and depth == 1;
+    }
+
+    std::size_t ChunkTuner::chunkSize() const {
+        return settled_ ? best().chunkSize : trials_[current_].chunkSize;
+    }
+
+    std::size_t ChunkTuner::depth() const {
+        return settled_ ? best().depth : trials_[current_].depth;
+    }
+
+    bool ChunkTuner::settled() const {
+        return settled_;
+    }
+
+    void ChunkTuner::record(std::size_t bytes, std::uint64_t now) {
+        if (settled_) {
+            return;
+        }
+        // The first chunk of a trial only starts its clock
+        if (trialStart_ == 0) {
+            trialStart_ = now;
+            sampleStages(stageStart_);
+            return;
+        }
+        trialBytes_ += bytes;
+        if (trialBytes_ >= trialLength_) {
+            finishTrial(now);
+        }
+    }
+
+    void ChunkTuner::sampleStages(std::uint64_t (&totals)[STAGE_COUNT]) const {
+        for (std::size_t index = 0; index < STAGE_COUNT; ++index) {
+            totals[index] = stats_ ? stats_->stages[index].totalNanoseconds.load(std::memory_order_relaxed) : 0;
+        }
+    }
+
+    void ChunkTuner::finishTrial(std::uint64_t now) {
+        Trial& trial = trials_[current_];
+        const std::uint64_t elapsed = std::max<std::uint64_t>(now - trialStart_, 1);
+        trial.rate = static_cast<double>(trialBytes_) * 1e9 / static_cast<double>(elapsed);
+
+        if (stats_) {
+            std::uint64_t totals[STAGE_COUNT];
+            sampleStages(totals);
+            for (std::size_t index = 0; index < STAGE_COUNT; ++index) {
+                const std::uint32_t threads = readerStage(static_cast<EStage>(index)) ? stats_->readers : stats_->writers;
+                trial.shares[index] = std::min(1.0, static_cast<double>(totals[index] - stageStart_[index])
+                    / std::max<std::uint32_t>(threads, 1) / static_cast<double>(elapsed));
+            }
+        }
+        trialStart_ = 0;
+        trialBytes_ = 0;
+        ++current_;
+
+        auto choose = [this](std::size_t end) {
+            // In the order tried, larger settings first
+            std::size_t chosen = 0;
+            for (std::size_t index = 1; index < end; ++index) {
+                if (trials_[index].rate > trials_[chosen].rate * (1 + TUNE_MARGIN)) {
+                    chosen = index;
+                }
+            }
+            return chosen;
+        };
+
+        if (current_ == chunkTrials_) {
+            // The full depth was measured with every chunk size already
+            const Trial chunk = trials_[choose(chunkTrials_)];
+            for (std::size_t depth = chunk.depth / 2; depth >= 1; depth /= 2) {
+                trials_.push_back({chunk.chunkSize, depth});
+            }
+        }
+        if (current_ == trials_.size()) {
+            chosen_ = choose(trials_.size());
+            settled_ = true;
+        }
+    }
+
+    const ChunkTuner::Trial& ChunkTuner::best() const {
+        return trials_[chosen_];
+    }
+
+    std::string ChunkTuner::summary() const {
+        const Trial& chosen = best();
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        out << "Tuned to " << chosen.chunkSize << " byte chunks and a read depth of " << chosen.depth;
+        if (chosen.rate > 0) {
+            out << ", " << chosen.rate / 1e6 << " MB/s";
+        }
+        if (stats_ and chosen.rate > 0) {
+            // The codec stages only if chunks went through the codec
+            const char* separator = " (";
+            for (std::size_t index = 0; index < STAGE_COUNT; ++index) {
+                const EStage stage = static_cast<EStage>(index);
+                if (chosen.shares[index] > 0 or stage <= EStage::E_WaitForData) {
+                    out << std::exchange(separator, ", ") << toString(stage) << " " << 100 * chosen.shares[index] << "%";
+                }
+            }
+            out << ")";
+        }
+        out << "; tried";
+        for (const Trial& trial : trials_) {
+            out << " " << trial.chunkSize << "/" << trial.depth << ": " << trial.rate / 1e6 << " MB/s"
+                << (&trial == &trials_.back() ? "" : ",");
+        }
+        return out.str();
+    }
+
+} // namespace cp
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Stats.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cp {
+
+    // Picks the chunk size and read depth of a copy while it runs. The segment geometry and the
+    // source's queue depth are upper bounds; the first chunks are sent in trials of TUNE_TRIAL_BYTES
+    // each, halving the chunk size at full depth first, then lowering the depth with the best chunk
+    // size. Every trial is scored by the rate the chunks leave the reader at, which the writer holds
+    // back once the slots are full, so it covers both sides. A smaller setting has to win by
+    // TUNE_MARGIN to replace a larger one.
+    class ChunkTuner {
+    public:
+        // stats, if any, are sampled at the trial boundaries to report where the time went
+        ChunkTuner(std::size_t chunkSize, std::size_t depth, const CopyStats* stats = nullptr);
+
+        // What the next read should use
+        std::size_t chunkSize() const;
+        std::size_t depth() const;
+
+        // Whether the trials are over; the settings do not change any more
+        bool settled() const;
+
+        // A chunk of bytes was read and published at now, in monotonic nanoseconds
+        void record(std::size_t bytes, std::uint64_t now);
+
+        // The settings it settled on, with the rate of each trial
+        std::string summary() const;
+
+    private:
+        struct Trial {
+            std::size_t chunkSize;
+            std::size_t depth;
+            // Bytes per second, 0 until measured
+            double rate = 0;
+            // Share of the trial each stage took, if stats are available
+            double shares[static_cast<std::size_t>(EStage::E_Count)] = {};
+        };
+
+        // Sum of each stage's time so far
+        void sampleStages(std::uint64_t (&totals)[static_cast<std::size_t>(EStage::E_Count)]) const;
+        void finishTrial(std::uint64_t now);
+        const Trial& best() const;
+
+        const CopyStats* stats_;
+        std::vector<Trial> trials_;
+        std::size_t current_;
+        // Trials measured with the maximum depth, the chunk size phase
+        std::size_t chunkTrials_;
+        bool settled_;
+        std::size_t chosen_;
+
+        std::uint64_t trialLength_;
+        std::uint64_t trialStart_;
+        std::uint64_t trialBytes_;
+        std::uint64_t stageStart_[static_cast<std::size_t>(EStage::E_Count)];
+    };
+
+} // namespace cp
@@ -0,0 +1,158 @@
+#include "UringFileDestination.h"
+#include "Constants.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp
+{
+    namespace {
+
+        bool aligned(std::uint64_t value) {
+            return value % SLOT_ALIGNMENT == 0;
+        }
+
+    } // namespace
+
+    UringFileDestination::UringFileDestination(std::string_view filename, std::size_t queueDepth, bool direct,
+                                               const std::vector<std::span<char>>& buffers, bool patch, EDurability durability)
+        // Direct writes do not go through the page cache, there is nothing to write back
+        : target_(filename, O_WRONLY, patch, durability, !direct)
+        , fd_(-1)
+        , direct_(direct)
+        , queueDepth_(std::max<std::size_t>(queueDepth, 1))
+        , ring_(static_cast<unsigned>(queueDepth_))
+        , offset_(0)
+        , completed_(0) {
+
+        fd_ = direct_ ? open(target_.path().c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC) : target_.fd();
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open target file for direct I/O: " + std::string(filename) + ": " + std::strerror(errno));
+        }
+
+        // Falls back to plain writes if the kernel refuses to pin the slots
+        ring_.registerBuffers(buffers);
+    }
+
+    UringFileDestination::~UringFileDestination() {
+        try {
+            while (!pending_.empty()) {
+                reap();
+                while (!pending_.empty() and pending_.front().done) {
+                    pending_.pop_front();
+                    ++completed_;
+                }
+            }
+        } catch (const std::exception&) {
+        }
+
+        if (fd_ != target_.fd()) {
+            close(fd_);
+        }
+    }
+
+    void UringFileDestination::reserve(std::uint64_t size) {
+        target_.reserve(size);
+    }
+
+    void UringFileDestination::writeChunk(std::span<const char> buffer) {
+        submitChunk(buffer);
+        completeChunk();
+    }
+
+    void UringFileDestination::writeHole(std::uint64_t length) {
+        target_.writeHole(offset_, length);
+        offset_ += length;
+    }
+
+    void UringFileDestination::skipUnchanged(std::uint64_t length) {
+        offset_ += length;
+        target_.advance(offset_);
+    }
+
+    std::size_t UringFileDestination::queueDepth() const {
+        return queueDepth_;
+    }
+
+    void UringFileDestination::submitChunk(std::span<const char> buffer) {
+        const std::uint64_t sequence = completed_ + pending_.size();
+        const std::uint64_t offset = offset_;
+        offset_ += buffer.size();
+
+        if (direct_ and !(aligned(offset) and aligned(buffer.size()) and aligned(reinterpret_cast<std::uintptr_t>(buffer.data())))) {
+            // O_DIRECT needs aligned offsets and lengths; the last chunk of a file rarely is
+            writeAll(buffer, offset);
+            pending_.push_back({buffer, offset, static_cast<std::int32_t>(buffer.size()), true});
+            return;
+        }
+
+        pending_.push_back({buffer, offset, 0, false});
+        ring_.prepareWrite(fd_, buffer, offset, sequence);
+    }
+
+    void UringFileDestination::reap() {
+        IoUring::Completion completion = ring_.waitCompletion();
+        Request& request = pending_.at(completion.userData - completed_);
+        request.result = completion.result;
+        request.done = true;
+    }
+
+    void UringFileDestination::completeChunk() {
+        while (!pending_.front().done) {
+            reap();
+        }
+
+        Request request = pending_.front();
+        pending_.pop_front();
+        ++completed_;
+
+        if (request.result < 0) {
+            throw std::runtime_error(std::string("Failed to write to target file: ") + std::strerror(-request.result));
+        }
+
+        const std::size_t written = static_cast<std::size_t>(request.result);
+        if (written < request.buffer.size()) {
+            writeAll(request.buffer.subspan(written), request.offset + written);
+        }
+        // Completions are handed out in order, so everything before the request is written
+        target_.advance(request.offset + request.buffer.size());
+    }
+
+    void UringFileDestination::finish() {
+        target_.finish();
+    }
+
+    void UringFileDestination::writeAll(std::span<const char> buffer, std::uint64_t offset) {
+        while (!buffer.empty()) {
+            ssize_t result = pwrite(target_.fd(), buffer.data(), buffer.size(), offset);
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                throw std::runtime_error(std::string("Failed to write to target file: ") + std::strerror(errno));
+            }
+            buffer = buffer.subspan(static_cast<std::size_t>(result));
+            offset += static_cast<std::size_t>(result);
+        }
+    }
+
+    void UringFileDestination::resume(std::uint64_t offset) {
+        target_.resume(offset);
+        offset_ = offset;
+    }
+
+    void UringFileDestination::sync() {
+        target_.sync();
+    }
+
+    std::optional<std::string> UringFileDestination::localPath() const {
+        return target_.path();
+    }
+
+} // namespace cp
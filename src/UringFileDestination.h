@@ -0,0 +1,61 @@
+#pragma once
+
+#include "IDataDestination.h"
+#include "IoUring.h"
+#include "TargetFile.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cp
+{
+    // Writes a file through io_uring, keeping up to queueDepth writes in flight
+    class UringFileDestination final : public IDataDestination {
+    public:
+
+        // With patch an existing file is overwritten in place instead of truncated
+        UringFileDestination(std::string_view filename, std::size_t queueDepth, bool direct,
+                             const std::vector<std::span<char>>& buffers = {}, bool patch = false,
+                             EDurability durability = EDurability::E_End);
+        ~UringFileDestination() override;
+
+        void reserve(std::uint64_t size) override;
+        void writeChunk(std::span<const char> buffer) override;
+        void writeHole(std::uint64_t length) override;
+        void skipUnchanged(std::uint64_t length) override;
+        void resume(std::uint64_t offset) override;
+        void sync() override;
+        std::optional<std::string> localPath() const override;
+
+        std::size_t queueDepth() const override;
+        void submitChunk(std::span<const char> buffer) override;
+        void completeChunk() override;
+        void finish() override;
+
+    private:
+        struct Request {
+            std::span<const char> buffer;
+            std::uint64_t offset;
+            std::int32_t result;
+            bool done;
+        };
+
+        void reap();
+        void writeAll(std::span<const char> buffer, std::uint64_t offset);
+
+        // Written through its own descriptor, which takes the unaligned tail of an O_DIRECT copy
+        TargetFile target_;
+        // Opened with O_DIRECT if requested, the descriptor of the target otherwise
+        int fd_;
+        bool direct_;
+        std::size_t queueDepth_;
+        IoUring ring_;
+        std::uint64_t offset_;
+        std::deque<Request> pending_;
+        std::uint64_t completed_;
+    };
+
+} // namespace cp
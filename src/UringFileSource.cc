@@ -0,0 +1,135 @@
+#include "UringFileSource.h"
+#include "KernelCopy.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cp
+{
+    UringFileSource::UringFileSource(std::string_view filename, std::size_t queueDepth, bool direct,
+                                     const std::vector<std::span<char>>& buffers)
+        : filename_(filename)
+        , fd_(open(filename_.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0)))
+        , queueDepth_(std::max<std::size_t>(queueDepth, 1))
+        , ring_(static_cast<unsigned>(queueDepth_))
+        , offset_(0)
+        , completed_(0) {
+
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open source file: " + std::string(filename) + ": " + std::strerror(errno));
+        }
+
+        // Falls back to plain reads if the kernel refuses to pin the slots
+        ring_.registerBuffers(buffers);
+    }
+
+    UringFileSource::~UringFileSource() {
+        // The kernel may still be writing into the slots
+        try {
+            while (!pending_.empty()) {
+                reap();
+                while (!pending_.empty() and pending_.front().done) {
+                    pending_.pop_front();
+                    ++completed_;
+                }
+            }
+        } catch (const std::exception&) {
+        }
+        close(fd_);
+    }
+
+    bool UringFileSource::readChunk(std::span<char> buffer, std::size_t& bytesRead) {
+        submitChunk(buffer);
+        bytesRead = completeChunk().size();
+        return bytesRead > 0;
+    }
+
+    std::optional<LocalFile> UringFileSource::localFile() const {
+        return describeLocalFile(filename_);
+    }
+
+    std::optional<std::uint64_t> UringFileSource::size() const {
+        struct stat status{};
+        if (fstat(fd_, &status) != 0 or !S_ISREG(status.st_mode)) {
+            return std::nullopt;
+        }
+        return static_cast<std::uint64_t>(status.st_size);
+    }
+
+    std::uint64_t UringFileSource::holeLength() {
+        if (!extents_) {
+            extents_.emplace(fd_);
+        }
+        return extents_->holeAt(offset_);
+    }
+
+    void UringFileSource::skipHole() {
+        offset_ += holeLength();
+    }
+
+    void UringFileSource::seek(std::uint64_t offset) {
+        offset_ = offset;
+    }
+
+    std::size_t UringFileSource::queueDepth() const {
+        return queueDepth_;
+    }
+
+    void UringFileSource::submitChunk(std::span<char> buffer) {
+        // Stop where the next hole starts, it is skipped rather than read
+        if (extents_) {
+            if (std::uint64_t data = extents_->dataAt(offset_)) {
+                buffer = buffer.first(static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), data)));
+            }
+        }
+
+        const std::uint64_t sequence = completed_ + pending_.size();
+        pending_.push_back({buffer, offset_, 0, false});
+        ring_.prepareRead(fd_, buffer, offset_, sequence);
+        offset_ += buffer.size();
+    }
+
+    void UringFileSource::reap() {
+        IoUring::Completion completion = ring_.waitCompletion();
+        Request& request = pending_.at(completion.userData - completed_);
+        request.result = completion.result;
+        request.done = true;
+    }
+
+    std::span<char> UringFileSource::completeChunk() {
+        while (!pending_.front().done) {
+            reap();
+        }
+
+        Request request = pending_.front();
+        pending_.pop_front();
+        ++completed_;
+
+        if (request.result < 0) {
+            throw std::runtime_error(std::string("Failed to read source file: ") + std::strerror(-request.result));
+        }
+
+        // A short read of a regular file only happens at its end; make sure of it with plain reads
+        std::size_t bytesRead = static_cast<std::size_t>(request.result);
+        while (bytesRead > 0 and bytesRead < request.buffer.size()) {
+            ssize_t result = pread(fd_, request.buffer.data() + bytesRead, request.buffer.size() - bytesRead, request.offset + bytesRead);
+            if (result < 0 and errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+            bytesRead += static_cast<std::size_t>(result);
+        }
+
+        return request.buffer.first(bytesRead);
+    }
+
+} // namespace cp
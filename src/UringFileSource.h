@@ -0,0 +1,56 @@
+#pragma once
+
+#include "IDataSource.h"
+#include "IoUring.h"
+#include "Sparse.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cp
+{
+    // Reads a file through io_uring, keeping up to queueDepth reads in flight
+    class UringFileSource final : public IDataSource {
+    public:
+
+        UringFileSource(std::string_view filename, std::size_t queueDepth, bool direct,
+                        const std::vector<std::span<char>>& buffers = {});
+        ~UringFileSource() override;
+
+        bool readChunk(std::span<char> buffer, std::size_t& bytesRead) override;
+        std::optional<std::uint64_t> size() const override;
+        std::optional<LocalFile> localFile() const override;
+
+        std::uint64_t holeLength() override;
+        void skipHole() override;
+        void seek(std::uint64_t offset) override;
+
+        std::size_t queueDepth() const override;
+        void submitChunk(std::span<char> buffer) override;
+        std::span<char> completeChunk() override;
+
+    private:
+        struct Request {
+            std::span<char> buffer;
+            std::uint64_t offset;
+            std::int32_t result;
+            bool done;
+        };
+
+        void reap();
+
+        std::string filename_;
+        int fd_;
+        std::size_t queueDepth_;
+        IoUring ring_;
+        std::uint64_t offset_;
+        // Requests in submission order; the front one has sequence number completed_
+        std::deque<Request> pending_;
+        std::uint64_t completed_;
+        std::optional<FileExtents> extents_;
+    };
+
+} // namespace cp
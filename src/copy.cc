@@ -1,44 +1,208 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include "CopyDaemon.h"
 #include "CopyManager.h"
-#include "FileDestination.h"
-#include "FileSource.h"
+#include "Endpoints.h"
+#include "Options.h"
+#include "ParallelCopyManager.h"
 #include "SharedMemoryTransport.h"
+#include "SocketTransport.h"
 
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cerr << "Usage: "<< argv[0] << " <source file> <target file>\n";
-        return 1;
+namespace {
+
+    std::string writers(const cp::Geometry& geometry) {
+        return geometry.consumerCount > 1 ? ", " + std::to_string(geometry.consumerCount) + " writers" : std::string();
     }
 
-    try {
-        std::string_view sourceFilename = argv[1];
-        std::string_view targetFilename = argv[2];
-        std::string_view sharedMemoryName = argv[3];
+    cp::MemoryPolicy memoryPolicy(const cp::Options& options) {
+        cp::MemoryPolicy policy{options.hugePages, options.numaNode, options.prefaultThreads};
+        if (options.numa == cp::ENumaPlacement::E_Source or options.numa == cp::ENumaPlacement::E_Target) {
+            const std::string& path = options.numa == cp::ENumaPlacement::E_Source ? options.source : options.target;
+            policy.numaNode = cp::deviceNode(path);
+            if (policy.numaNode < 0) {
+                std::cout << "The device of " << path << " has no NUMA node, the slots are not bound" << std::endl;
+            }
+        }
+        return policy;
+    }
 
-        if (sourceFilename == targetFilename) {
-            std::cout << "Source and destination are the same. Exiting.\n";
-            return 0;
+    double millisecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void reportThroughput(std::chrono::steady_clock::time_point start, std::optional<std::uint64_t> size) {
+        const double elapsed = millisecondsSince(start);
+        std::cout << "Finished in " << elapsed << " ms";
+        if (size and elapsed > 0) {
+            std::cout << ", " << *size / elapsed / 1000 << " MB/s";
+        }
+        std::cout << std::endl;
+    }
+
+    // Stage timings of the copy and the side that limited it, if the transport keeps them
+    void reportStats(cp::IDataTransport& transport) {
+        const cp::CopyStats* stats = transport.stats();
+        if (stats and stats->sent.chunks > 0) {
+            cp::printSummary(std::cout, *stats, cp::monotonicNanoseconds());
+        }
+    }
+
+    // Prints the progress of the copy using the shared memory until its last process leaves
+    void watchStats(const cp::Options& options) {
+        if (options.maxRate) {
+            cp::SharedMemoryTransport::setMaxRate(options.sharedMemoryName, *options.maxRate);
+            std::cout << (*options.maxRate > 0 ? "Capped the reader at " + std::to_string(*options.maxRate) + " bytes per second"
+                                               : std::string("Lifted the rate cap of the reader")) << std::endl;
         }
+        std::shared_ptr<const cp::CopyStats> stats = cp::SharedMemoryTransport::openStats(options.sharedMemoryName);
+        std::uint64_t previousTime = cp::monotonicNanoseconds();
+        std::uint64_t previousBytes = cp::writtenBytes(*stats);
+        while (stats->endedAt == 0) {
+            std::this_thread::sleep_for(STATS_INTERVAL);
+            const std::uint64_t now = cp::monotonicNanoseconds();
+            cp::printProgress(std::cout, *stats, now, previousBytes, previousTime);
+            previousTime = now;
+            previousBytes = cp::writtenBytes(*stats);
+        }
+        cp::printSummary(std::cout, *stats, cp::monotonicNanoseconds());
+    }
+
+    cp::CopySettings copySettings(const cp::Options& options) {
+        cp::CopySettings settings;
+        settings.kernelOffload = options.kernelOffload;
+        settings.verify = options.verify;
+        settings.sparse = options.sparse;
+        settings.delta = options.delta;
+        settings.resume = options.resume;
+        settings.durability = options.durability;
+        settings.codec = options.codec;
+        settings.compressWorkers = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, DEFAULT_COMPRESS_WORKERS);
+        settings.tune = options.tune;
+        settings.maxRate = options.maxRate.value_or(0);
+        return settings;
+    }
+
+    // Copies through a transport with a single ring, on whichever side it made this process
+    template <typename Transport>
+    void copySingle(const cp::Options& options, std::unique_ptr<Transport> transport) {
+        // Owned by the copy manager below, which outlives every use
+        cp::IDataTransport* ring = transport.get();
+        const cp::Geometry geometry = transport->geometry();
 
-        cp::SharedMemoryTransport::Ptr transport = std::make_unique<cp::SharedMemoryTransport>(sharedMemoryName);
         cp::IDataSource::Ptr source = nullptr;
         cp::IDataDestination::Ptr destination = nullptr;
         if (cp::EStrategy::E_Read == transport->strategy()) {
             std::cout << "Create reader" << std::endl;
-            source = std::make_unique<cp::FileSource>(sourceFilename);
+            source = cp::makeSource(options, *transport);
         } else {
             std::cout << "Create writer" << std::endl;
-            destination = std::make_unique<cp::FileDestination>(targetFilename);
+            destination = cp::makeDestination(options, *transport);
         }
-        
-        cp::CopyManager manager(std::move(source), std::move(destination), std::move(transport));
+
+        std::cout << "Chunk size " << geometry.chunkSize << " bytes, " << geometry.slotCount << " slots" << writers(geometry) << std::endl;
+
+        const auto copyStarted = std::chrono::steady_clock::now();
+        cp::CopyManager manager(std::move(source), std::move(destination), std::move(transport), copySettings(options));
         manager.start();
+        reportThroughput(copyStarted, ring->totalSize());
+        reportStats(*ring);
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    cp::Options options;
+    try {
+        options = cp::parseOptions(argc, argv);
+    } catch (const std::invalid_argument& ex) {
+        std::cerr << "Error: " << ex.what() << "\n" << cp::usage(argv[0]);
+        return 1;
+    }
+
+    if (options.help) {
+        std::cout << cp::usage(argv[0]);
+        return 0;
+    }
+
+    try {
+        // Before any thread is started, they inherit it
+        cp::setIoPriority(options.ioPriority);
+
+        if (options.mode == cp::EMode::E_Daemon) {
+            cp::CopyDaemon(options).run();
+            return 0;
+        }
+        if (options.mode == cp::EMode::E_Stats) {
+            watchStats(options);
+            return 0;
+        }
+
+        std::string_view sourceFilename = options.source;
+        std::string_view targetFilename = options.target;
+        std::string_view sharedMemoryName = options.sharedMemoryName;
+
+        // The data goes to stdout, so the progress messages go to stderr
+        if (cp::parseDescriptor(targetFilename, STDOUT_FILENO) == STDOUT_FILENO) {
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+
+        if (sourceFilename == targetFilename and !cp::parseDescriptor(sourceFilename, STDIN_FILENO)) {
+            std::cout << "Source and destination are the same. Exiting.\n";
+            return 0;
+        }
+
+        if (options.mode == cp::EMode::E_Submit) {
+            return cp::submitJob(options);
+        }
+
+        const auto started = std::chrono::steady_clock::now();
+        if (options.transport != cp::ETransport::E_SharedMemory) {
+            const cp::ESocketFamily family = options.transport == cp::ETransport::E_Unix ? cp::ESocketFamily::E_Unix : cp::ESocketFamily::E_Tcp;
+            cp::SocketTransport::Ptr transport = std::make_unique<cp::SocketTransport>(
+                family, sharedMemoryName, cp::Geometry{options.chunkSize, options.slotCount});
+            std::cout << "Connected in " << millisecondsSince(started) << " ms" << std::endl;
+            copySingle(options, std::move(transport));
+            std::cout << "Copy operation completed successfully.\n";
+            return 0;
+        }
+
+        cp::SharedMemoryTransport::Ptr transport = std::make_unique<cp::SharedMemoryTransport>(
+            sharedMemoryName, cp::Geometry{options.chunkSize, options.slotCount, options.streamCount, options.writerCount},
+            memoryPolicy(options));
+        std::cout << "Shared memory ready in " << millisecondsSince(started) << " ms" << std::endl;
+
+        // The number of lanes is decided by the reader, the writer follows it
+        cp::Geometry geometry = transport->geometry();
+        if (geometry.laneCount > 1) {
+            // Owned by the copy manager below, which outlives every use
+            cp::IDataTransport* ring = transport.get();
+            std::cout << (cp::EStrategy::E_Read == transport->strategy() ? "Create reader" : "Create writer") << std::endl;
+            std::cout << "Chunk size " << geometry.chunkSize << " bytes, " << geometry.slotCount << " slots, "
+                << geometry.laneCount << " streams" << writers(geometry) << std::endl;
+
+            const auto copyStarted = std::chrono::steady_clock::now();
+            cp::ParallelCopyManager manager(sourceFilename, targetFilename, std::move(transport), copySettings(options));
+            manager.start();
+            reportThroughput(copyStarted, ring->totalSize());
+            reportStats(*ring);
+
+            std::cout << "Copy operation completed successfully.\n";
+            return 0;
+        }
+
+        copySingle(options, std::move(transport));
 
         std::cout << "Copy operation completed successfully.\n";
     } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << "\n";
         return 1;
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
@@ -5,15 +5,35 @@
 #include <cstdlib>
 #include <sys/stat.h>
 
+#include "Checkpoint.h"
+#include "Checksum.h"
+#include "Codec.h"
 #include "CopyManager.h"
+#include "CopyPipeline.h"
+#include "DirectoryDestination.h"
 #include "FileSource.h"
 #include "FileDestination.h"
+#include "LocalTransport.h"
+#include "MappedFileDestination.h"
+#include "UringFileDestination.h"
+#include "SharedMemoryTransport.h"
+#include "Stats.h"
+#include "Throttle.h"
+#include "TreeRecord.h"
+#include "Tuner.h"
 
 #include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -50,7 +70,8 @@ bool compareFiles(const std::string& file1, const std::string& file2) {
     return std::equal(begin1, end, begin2);
 }
 
-int runProcess(const char* cmd, const char* source, const char* destination, const char* smname, const char* output) {
+int runProcess(const char* cmd, const char* source, const char* destination, const char* smname, const char* output,
+               const std::vector<std::string>& options = {}) {
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -69,7 +90,13 @@ int runProcess(const char* cmd, const char* source, const char* destination, con
         }
 
         close(fd); 
-        execlp(cmd, cmd, source, destination, smname, (char*)NULL);
+
+        std::vector<char*> argv{const_cast<char*>(cmd)};
+        for (const std::string& option : options) {
+            argv.push_back(const_cast<char*>(option.c_str()));
+        }
+        argv.insert(argv.end(), {const_cast<char*>(source), const_cast<char*>(destination), const_cast<char*>(smname), nullptr});
+        execvp(cmd, argv.data());
         
         throw std::runtime_error(std::string("Failed to execute '") + cmd + "': " + strerror(errno));
     } else {
@@ -78,13 +105,14 @@ int runProcess(const char* cmd, const char* source, const char* destination, con
     }
 }
 
-bool sharedMemoryLaunch(std::string_view source, std::string_view destination, bool enableThird = false) {
+bool sharedMemoryLaunch(std::string_view source, std::string_view destination, bool enableThird = false,
+                        const std::vector<std::string>& options = {}) {
     std::vector<pid_t> pids;
     // Start two processes
-    pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process1.log"));
-    pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process2.log"));
+    pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process1.log", options));
+    pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process2.log", options));
     if (enableThird) {
-        pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process2.log"));
+        pids.push_back(runProcess("/copy/build/src/copy", source.data(), destination.data(), "shared_mem", "/copy/build/process2.log", options));
     }    
     // Wait for processes to finish
     for (pid_t p : pids) {
@@ -132,6 +160,405 @@ TEST_CASE("Test CopyManager functionality", "[CopyManager]") {
         REQUIRE(compareFiles(sourceFilename, targetFilename));
     }
 
+    SECTION("Copy file through shared memory") {
+        createFile(sourceFilename, 10 * 1024 * 1024);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--no-offload"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file with custom geometry") {
+        createFile(sourceFilename, 3 * 1024 * 1024 + 64 * 1024); // not a multiple of the chunk size
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--chunk-size=256K", "--slots=8", "--no-offload"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file with io_uring") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 64 * 1024);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--io=uring", "--chunk-size=1M", "--queue-depth=4", "--no-offload"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file with memory mapped files") {
+        createFile(sourceFilename, 70 * 1024 * 1024); // crosses a map window
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--io=mmap", "--no-offload"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file in parallel streams") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 12345);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--streams=4", "--chunk-size=1M"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file through pre-faulted slots") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 4321);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--prefault=3", "--streams=2", "--chunk-size=1M"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy file with checksums") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--verify", "--chunk-size=1M"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Copy sparse file") {
+        createFile(sourceFilename, 1024 * 1024 + 999);
+        fs::resize_file(sourceFilename, 64 * 1024 * 1024);
+        {
+            std::ofstream file(sourceFilename, std::ios::binary | std::ios::app);
+            file << randomString(4096);
+        }
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--no-offload", "--chunk-size=1M"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+
+        // The hole is not allocated in the target either
+        struct stat source{}, target{};
+        REQUIRE(stat(sourceFilename.c_str(), &source) == 0);
+        REQUIRE(stat(targetFilename.c_str(), &target) == 0);
+        REQUIRE(target.st_blocks <= source.st_blocks + 2 * 1024 * 1024 / 512);
+    }
+
+    SECTION("Preallocate the target and sync it as asked") {
+        const std::string data = randomString(1024 * 1024);
+        {
+            cp::FileDestination destination(targetFilename, false, cp::EDurability::E_Periodic);
+            destination.reserve(64 * 1024 * 1024 + data.size());
+            destination.writeHole(64 * 1024 * 1024);
+            destination.writeChunk(std::span<const char>(data.data(), data.size()));
+            destination.finish();
+        }
+
+        // The blocks reserved for the hole are given back
+        struct stat target{};
+        REQUIRE(stat(targetFilename.c_str(), &target) == 0);
+        REQUIRE(fs::file_size(targetFilename) == 64 * 1024 * 1024 + data.size());
+        REQUIRE(target.st_blocks <= 2 * 1024 * 1024 / 512);
+
+        // An interrupted copy keeps what it wrote and nothing it only reserved
+        {
+            cp::FileDestination destination(targetFilename, false, cp::EDurability::E_None);
+            destination.reserve(64 * 1024 * 1024);
+            destination.writeChunk(std::span<const char>(data.data(), data.size()));
+        }
+        REQUIRE(stat(targetFilename.c_str(), &target) == 0);
+        REQUIRE(fs::file_size(targetFilename) == data.size());
+        REQUIRE(target.st_blocks <= 2 * 1024 * 1024 / 512);
+
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--no-offload", "--durability=periodic", "--chunk-size=1M"}));
+        }
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Compress chunks between the processes") {
+        std::string text;
+        while (text.size() < 1024 * 1024) {
+            text += "line " + std::to_string(text.size() % 997) + " of a file that compresses well\n";
+        }
+        std::vector<char> packed(text.size());
+        const std::size_t size = cp::compress(text, packed);
+        REQUIRE(size > 0);
+        REQUIRE(size < text.size() / 4);
+        std::string unpacked(text.size(), '\0');
+        cp::decompress(std::span<const char>(packed.data(), size), unpacked);
+        REQUIRE(unpacked == text);
+        REQUIRE_THROWS(cp::decompress(std::span<const char>(packed.data(), size - 1), unpacked));
+
+        // Without repetitions nothing is gained, so a bound below the input size is never met
+        const std::string noise = randomString(256 * 1024);
+        REQUIRE(cp::compress(noise, std::span<char>(packed.data(), noise.size() - noise.size() / 16)) == 0);
+
+        {
+            std::ofstream file(sourceFilename, std::ios::binary);
+            for (int round = 0; round < 4; ++round) {
+                file << text << randomString(1024 * 1024 + round);
+            }
+        }
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--compress=lz", "--no-offload", "--verify", "--chunk-size=1M"}));
+        }
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Tune the chunk size and the read depth") {
+        // Feeds the tuner chunks at the rate the given function makes up, until it settles
+        auto tune = [](cp::ChunkTuner& tuner, auto rate) {
+            std::uint64_t now = 1;
+            for (int chunk = 0; chunk < 100000 and !tuner.settled(); ++chunk) {
+                now += static_cast<std::uint64_t>(tuner.chunkSize() * 1e9 / rate(tuner.chunkSize(), tuner.depth()));
+                tuner.record(tuner.chunkSize(), now);
+            }
+        };
+
+        cp::ChunkTuner faster(4 * 1024 * 1024, 4);
+        REQUIRE(faster.chunkSize() == 4 * 1024 * 1024);
+        REQUIRE(faster.depth() == 4);
+        tune(faster, [](std::size_t chunkSize, std::size_t depth) {
+            return (chunkSize == 1024 * 1024 ? 2e9 : 1e9) * (depth == 2 ? 1.5 : 1.0);
+        });
+        REQUIRE(faster.settled());
+        REQUIRE(faster.chunkSize() == 1024 * 1024);
+        REQUIRE(faster.depth() == 2);
+
+        // Within the margin the larger settings stay
+        cp::ChunkTuner same(4 * 1024 * 1024, 4);
+        tune(same, [](std::size_t chunkSize, std::size_t) { return chunkSize < 4 * 1024 * 1024 ? 1.02e9 : 1e9; });
+        REQUIRE(same.settled());
+        REQUIRE(same.chunkSize() == 4 * 1024 * 1024);
+        REQUIRE(same.depth() == 4);
+        REQUIRE(same.summary().find("Tuned to 4194304 byte chunks") == 0);
+
+        // Nothing smaller to try
+        REQUIRE(cp::ChunkTuner(TUNE_MIN_CHUNK, 1).settled());
+    }
+
+    SECTION("Cap the read rate") {
+        // 10 ms worth of bytes at a time, in whole pages
+        cp::RateLimiter limiter(10 * 1024 * 1024);
+        REQUIRE(limiter.pieceSize(4 * 1024 * 1024) == 25 * 4096);
+        REQUIRE(limiter.pieceSize(8192) == 8192);
+        REQUIRE(cp::RateLimiter(0).pieceSize(4 * 1024 * 1024) == 4 * 1024 * 1024);
+
+        const auto started = std::chrono::steady_clock::now();
+        for (int piece = 0; piece < 11; ++piece) {
+            limiter.take(512 * 1024);
+        }
+        // The first piece goes right away, the other ten take half a second
+        REQUIRE(std::chrono::steady_clock::now() - started >= std::chrono::milliseconds(450));
+
+        createFile(sourceFilename, 2 * 1024 * 1024 + 7);
+        const auto copyStarted = std::chrono::steady_clock::now();
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--max-rate=8M", "--io-class=best-effort"}));
+        }
+        REQUIRE(std::chrono::steady_clock::now() - copyStarted >= std::chrono::milliseconds(200));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Patch existing file with delta copy") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        fs::copy_file(sourceFilename, targetFilename, fs::copy_options::overwrite_existing);
+        {
+            std::fstream file(targetFilename, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(3 * 1024 * 1024 + 17);
+            file << "changed";
+        }
+        {
+            std::ofstream file(targetFilename, std::ios::binary | std::ios::app);
+            file << randomString(4096);
+        }
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--delta", "--verify", "--chunk-size=1M"}));
+        }
+
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Patch existing file with delta copy under a rate cap") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        auto change = [&] {
+            fs::copy_file(sourceFilename, targetFilename, fs::copy_options::overwrite_existing);
+            std::fstream file(targetFilename, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(3 * 1024 * 1024 + 17);
+            file << "changed";
+        };
+        auto kept = [] {
+            std::ostringstream text;
+            text << std::ifstream("/copy/build/process1.log").rdbuf() << std::ifstream("/copy/build/process2.log").rdbuf();
+            const std::string log = text.str();
+            const std::size_t begin = log.find("Kept ");
+            return begin == std::string::npos ? std::string() : log.substr(begin, log.find('\n', begin) - begin);
+        };
+
+        change();
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--delta", "--chunk-size=1M"}));
+        }
+        const std::string uncapped = kept();
+        REQUIRE(uncapped == "Kept 9502720 of 10551296 bytes of the target unchanged");
+
+        // Pieces of the cap are smaller than a block, which must still be matched whole
+        change();
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--delta", "--max-rate=50M", "--chunk-size=1M"}));
+        }
+        REQUIRE(kept() == uncapped);
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Interrupted delta copy through a mapping keeps the old tail") {
+        createFile(targetFilename, 10 * 1024 * 1024 + 999);
+        std::ifstream original(targetFilename, std::ios::binary);
+        const std::string before((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+        {
+            // Gone before finish(), as when the reader dies halfway
+            cp::MappedFileDestination destination(targetFilename, true);
+            destination.reserve(before.size());
+            destination.skipUnchanged(1024 * 1024);
+            destination.writeChunk(std::string(4096, 'x'));
+        }
+
+        std::ifstream patched(targetFilename, std::ios::binary);
+        const std::string after((std::istreambuf_iterator<char>(patched)), std::istreambuf_iterator<char>());
+        REQUIRE(after.size() == before.size());
+        REQUIRE(after.substr(1024 * 1024, 4096) == std::string(4096, 'x'));
+        REQUIRE(after.substr(1024 * 1024 + 4096) == before.substr(1024 * 1024 + 4096));
+    }
+
+    SECTION("Interrupted delta copy to a new target gives back what it reserved") {
+        // A target that does not exist yet is created, not patched, whatever the backend
+        auto interrupt = [&](cp::IDataDestination&& destination) {
+            destination.reserve(10 * 1024 * 1024);
+            destination.writeChunk(std::string(4096, 'x'));
+        };
+        fs::remove(targetFilename);
+        interrupt(cp::FileDestination(targetFilename, true));
+        REQUIRE(fs::file_size(targetFilename) == 4096);
+        fs::remove(targetFilename);
+        interrupt(cp::UringFileDestination(targetFilename, 4, false, {}, true));
+        REQUIRE(fs::file_size(targetFilename) == 4096);
+        fs::remove(targetFilename);
+        interrupt(cp::MappedFileDestination(targetFilename, true));
+        REQUIRE(fs::file_size(targetFilename) == 4096);
+    }
+
+    SECTION("Resume an interrupted copy from its checkpoint") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        const std::size_t prefix = 8 * 1024 * 1024;
+        std::vector<char> data(prefix);
+        std::ifstream(sourceFilename, std::ios::binary).read(data.data(), static_cast<std::streamsize>(data.size()));
+        const std::uint32_t checksum = cp::crc32c(0, data);
+
+        // What a writer that died leaves behind: a durable prefix it checkpointed, and more after it
+        auto interrupt = [&] {
+            std::ofstream(targetFilename, std::ios::binary).write(data.data(), static_cast<std::streamsize>(data.size())) << randomString(4096);
+            cp::Checkpoint(targetFilename, fs::file_size(sourceFilename)).save({prefix, checksum});
+        };
+        auto logs = [] {
+            std::ostringstream text;
+            text << std::ifstream("/copy/build/process1.log").rdbuf() << std::ifstream("/copy/build/process2.log").rdbuf();
+            return text.str();
+        };
+
+        interrupt();
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--resume", "--chunk-size=1M"}));
+        }
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+        REQUIRE(logs().find("Resuming after the first 8388608 bytes") != std::string::npos);
+        REQUIRE(!fs::exists(targetFilename + ".checkpoint"));
+
+        // A prefix that changed since is not trusted
+        interrupt();
+        {
+            std::fstream file(targetFilename, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(1024 * 1024 + 17);
+            file << "changed";
+        }
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--resume", "--chunk-size=1M", "--io=uring"}));
+        }
+        REQUIRE(fs::file_size(sourceFilename) == fs::file_size(targetFilename));
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+        REQUIRE(logs().find("Resuming") == std::string::npos);
+        REQUIRE(!fs::exists(targetFilename + ".checkpoint"));
+    }
+
+    SECTION("Stream from a pipe into a pipe") {
+        createFile(sourceFilename, 9 * 1024 * 1024 + 333);
+        std::ifstream source(sourceFilename, std::ios::binary);
+        const std::string expected((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+
+        // Both processes get the read end of the input and the write end of the output, so either
+        // can become the reader; the other ends stay with the test
+        int input[2];
+        int output[2];
+        REQUIRE(pipe2(input, O_CLOEXEC) == 0);
+        REQUIRE(pipe2(output, O_CLOEXEC) == 0);
+        fcntl(input[0], F_SETFD, 0);
+        fcntl(output[1], F_SETFD, 0);
+
+        const std::string from = "fd:" + std::to_string(input[0]);
+        const std::string to = "fd:" + std::to_string(output[1]);
+        std::vector<pid_t> pids;
+        pids.push_back(runProcess("/copy/build/src/copy", from.c_str(), to.c_str(), "shared_mem", "/copy/build/process1.log", {"--chunk-size=1M"}));
+        pids.push_back(runProcess("/copy/build/src/copy", from.c_str(), to.c_str(), "shared_mem", "/copy/build/process2.log", {"--chunk-size=1M"}));
+        close(input[0]);
+        close(output[1]);
+
+        std::thread feeder([&] {
+            for (std::size_t offset = 0; offset < expected.size();) {
+                const ssize_t count = write(input[1], expected.data() + offset, expected.size() - offset);
+                if (count <= 0) {
+                    break;
+                }
+                offset += static_cast<std::size_t>(count);
+            }
+            close(input[1]);
+        });
+
+        std::string received;
+        char buffer[64 * 1024];
+        for (ssize_t count; (count = read(output[0], buffer, sizeof(buffer))) > 0;) {
+            received.append(buffer, static_cast<std::size_t>(count));
+        }
+        close(output[0]);
+        feeder.join();
+
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+        REQUIRE(received.size() == expected.size());
+        REQUIRE(received == expected);
+    }
+
+    SECTION("Invalid geometry") {
+        createFile(sourceFilename, 1024);
+        {
+            REQUIRE_THROWS_AS(sharedMemoryLaunch(sourceFilename, targetFilename, false, {"--chunk-size=1K"}), std::runtime_error);
+        }
+    }
+
     SECTION("Copy empty file") {
         if (fs::exists(sourceFilename))
             REQUIRE(std::remove(sourceFilename.c_str()) == 0);
@@ -181,6 +608,311 @@ TEST_CASE("Test CopyManager functionality", "[CopyManager]") {
         REQUIRE(compareFiles(sourceFilename, targetFilename));
     }
 
+    SECTION("Run independent copies concurrently") {
+        createFile(sourceFilename, 5 * 1024 * 1024 + 77);
+        const std::vector<std::string> targets{"target1.txt", "target2.txt"};
+
+        std::vector<pid_t> pids;
+        for (std::size_t index = 0; index < targets.size(); ++index) {
+            fs::remove(targets[index]);
+            const std::string name = "shared_mem" + std::to_string(index + 1);
+            for (int process = 1; process <= 2; ++process) {
+                const std::string output = "/copy/build/process" + std::to_string(2 * index + process) + ".log";
+                pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targets[index].c_str(), name.c_str(),
+                                          output.c_str(), {"--no-offload", "--chunk-size=1M"}));
+            }
+        }
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+
+        for (const std::string& target : targets) {
+            REQUIRE(compareFiles(sourceFilename, target));
+        }
+        REQUIRE_FALSE(fs::exists("/dev/shm/shared_mem1"));
+        REQUIRE_FALSE(fs::exists("/dev/shm/shared_mem2"));
+    }
+
+    SECTION("Copy file through a compile-time pipeline") {
+        static_assert(cp::DataSource<cp::FileSource> and cp::DataDestination<cp::FileDestination>);
+        static_assert(cp::DataTransport<cp::LocalTransport> and cp::DataTransport<cp::IDataTransport>);
+
+        createFile(sourceFilename, 3 * 1024 * 1024 + 17);
+        fs::remove(targetFilename);
+
+        std::vector<char> memory(4 * 256 * 1024);
+        std::vector<std::span<char>> buffers;
+        for (std::size_t index = 0; index < 4; ++index) {
+            buffers.emplace_back(memory.data() + index * 256 * 1024, 256 * 1024);
+        }
+        cp::LocalTransport producer(buffers);
+        cp::LocalTransport::Ptr consumer = producer.connect();
+        cp::CopySettings settings;
+        settings.verify = true;
+        {
+            cp::FileSource source(sourceFilename);
+            cp::FileDestination destination(targetFilename);
+            std::thread writer([&] {
+                cp::CopyPipeline<cp::IDataSource, cp::LocalTransport, cp::FileDestination>(nullptr, &destination, *consumer, settings).write();
+            });
+            cp::CopyPipeline<cp::FileSource, cp::LocalTransport, cp::IDataDestination>(&source, nullptr, producer, settings).read();
+            writer.join();
+        }
+
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Record stage statistics in the shared memory") {
+        cp::CopyStats histogramOnly{};
+        cp::StageHistogram& histogram = histogramOnly.stage(cp::EStage::E_Read);
+        for (std::uint64_t nanoseconds = 1; nanoseconds <= 1000; ++nanoseconds) {
+            histogram.record(nanoseconds * 1000);
+        }
+        REQUIRE(histogram.count == 1000);
+        REQUIRE(histogram.maxNanoseconds == 1000 * 1000);
+        // Within the 1/8 resolution of a bucket
+        REQUIRE(histogram.percentile(0.5) <= 500 * 1000);
+        REQUIRE(histogram.percentile(0.5) >= 500 * 1000 * 7 / 8);
+        REQUIRE(histogram.percentile(0.99) >= 990 * 1000 * 7 / 8);
+
+        createFile(sourceFilename, 5 * 1024 * 1024 + 123);
+        fs::remove(targetFilename);
+        std::shared_ptr<const cp::CopyStats> stats;
+        {
+            const cp::Geometry geometry{256 * 1024, 4};
+            cp::SharedMemoryTransport producer("copy_stats_test", geometry);
+            cp::SharedMemoryTransport consumer("copy_stats_test", geometry);
+            stats = cp::SharedMemoryTransport::openStats("copy_stats_test");
+            cp::CopySettings settings;
+            settings.kernelOffload = false;
+
+            cp::FileSource source(sourceFilename);
+            cp::FileDestination destination(targetFilename);
+            std::thread writer([&] {
+                cp::CopyPipeline<cp::IDataSource, cp::SharedMemoryTransport, cp::FileDestination>(nullptr, &destination, consumer, settings).write();
+            });
+            cp::CopyPipeline<cp::FileSource, cp::SharedMemoryTransport, cp::IDataDestination>(&source, nullptr, producer, settings).read();
+            writer.join();
+            REQUIRE(stats->endedAt == 0);
+        }
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+
+        // Still readable once the copy has left the segment
+        const std::uint64_t size = fs::file_size(sourceFilename);
+        const std::uint64_t chunks = (size + 256 * 1024 - 1) / (256 * 1024);
+        REQUIRE(stats->endedAt >= stats->startedAt);
+        REQUIRE(stats->totalBytes == size);
+        REQUIRE(stats->sent.chunks == chunks);
+        REQUIRE(stats->written.chunks == chunks);
+        REQUIRE(stats->sent.bytes == size);
+        REQUIRE(cp::writtenBytes(*stats) == size);
+        REQUIRE(stats->stage(cp::EStage::E_Write).count == chunks);
+        REQUIRE(cp::bottleneck(*stats, cp::monotonicNanoseconds()) != cp::EBottleneck::E_None);
+        REQUIRE_THROWS(cp::SharedMemoryTransport::openStats("copy_stats_test"));
+    }
+
+    SECTION("Copy file over Unix and TCP sockets") {
+        createFile(sourceFilename, 9 * 1024 * 1024 + 4321);
+        const std::vector<std::vector<std::string>> transports{
+            {"--transport=unix", "/copy/build/copy.sock"},
+            {"--transport=tcp", "127.0.0.1:47391"}
+        };
+
+        for (const std::vector<std::string>& transport : transports) {
+            fs::remove(targetFilename);
+            std::vector<pid_t> pids;
+            for (int process = 1; process <= 2; ++process) {
+                const std::string output = "/copy/build/process" + std::to_string(process) + ".log";
+                pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targetFilename.c_str(), transport[1].c_str(),
+                                          output.c_str(), {transport[0], "--chunk-size=1M", "--verify"}));
+            }
+            for (pid_t pid : pids) {
+                int status = 0;
+                REQUIRE(waitpid(pid, &status, 0) == pid);
+                REQUIRE(WIFEXITED(status));
+                REQUIRE(WEXITSTATUS(status) == 0);
+            }
+
+            REQUIRE(compareFiles(sourceFilename, targetFilename));
+        }
+        // The listener removes the socket file once the writer is connected
+        REQUIRE_FALSE(fs::exists("/copy/build/copy.sock"));
+    }
+
+    SECTION("Socket copy waits for a stalled peer") {
+        createFile(sourceFilename, 30 * 1024 * 1024);
+        fs::remove(targetFilename);
+        std::vector<pid_t> pids;
+        for (int process = 1; process <= 2; ++process) {
+            const std::string output = "/copy/build/process" + std::to_string(process) + ".log";
+            pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targetFilename.c_str(), "127.0.0.1:47392",
+                                      output.c_str(), {"--transport=tcp", "--chunk-size=1M", "--max-rate=10M"}));
+        }
+
+        // Stopped for longer than the transport timeout, the reader leaves the writer blocked on a
+        // connection that is still up, as a slow source or a slow target would
+        while (!fs::exists(targetFilename)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        std::ostringstream first;
+        first << std::ifstream("/copy/build/process1.log").rdbuf();
+        const pid_t reader = first.str().find("reader") != std::string::npos ? pids[0] : pids[1];
+        REQUIRE(kill(reader, SIGSTOP) == 0);
+        std::this_thread::sleep_for(TRANSPORT_TIMEOUT + std::chrono::seconds(2));
+        REQUIRE(kill(reader, SIGCONT) == 0);
+
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+        REQUIRE(compareFiles(sourceFilename, targetFilename));
+    }
+
+    SECTION("Broadcast file to two writers") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        const std::vector<std::string> targets{"target1.txt", "target2.txt", "target3.txt"};
+        for (const std::string& target : targets) {
+            fs::remove(target);
+        }
+
+        std::vector<pid_t> pids;
+        for (std::size_t index = 0; index < targets.size(); ++index) {
+            const std::string output = "/copy/build/process" + std::to_string(index + 1) + ".log";
+            pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targets[index].c_str(), "shared_mem",
+                                      output.c_str(), {"--writers=2", "--no-offload", "--chunk-size=1M"}));
+        }
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+
+        // The process that attached first became the reader and left its target alone
+        std::size_t copies = 0;
+        for (const std::string& target : targets) {
+            if (fs::exists(target) and compareFiles(sourceFilename, target)) {
+                ++copies;
+            }
+        }
+        REQUIRE(copies == 2);
+    }
+
+    SECTION("Copy files through the daemon") {
+        createFile(sourceFilename, 10 * 1024 * 1024 + 999);
+        const std::vector<std::string> targets{"target1.txt", "target2.txt"};
+        for (const std::string& target : targets) {
+            fs::remove(target);
+        }
+
+        pid_t daemon = fork();
+        REQUIRE(daemon != -1);
+        if (daemon == 0) {
+            int fd = open("/copy/build/daemon.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            execl("/copy/build/src/copy", "/copy/build/src/copy", "--daemon", "--workers=2", "--chunk-size=1M", "daemon_queue", nullptr);
+            _exit(127);
+        }
+        // Clients fail until the daemon has published its queue
+        usleep(500000);
+
+        std::vector<pid_t> pids;
+        pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targets[0].c_str(), "daemon_queue",
+                                  "/copy/build/process1.log", {"--submit"}));
+        pids.push_back(runProcess("/copy/build/src/copy", sourceFilename.c_str(), targets[1].c_str(), "daemon_queue",
+                                  "/copy/build/process2.log", {"--submit", "--verify", "--no-offload"}));
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+
+        REQUIRE(kill(daemon, SIGTERM) == 0);
+        int status = 0;
+        REQUIRE(waitpid(daemon, &status, 0) == daemon);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 0);
+        REQUIRE_FALSE(fs::exists("/dev/shm/daemon_queue"));
+
+        for (const std::string& target : targets) {
+            REQUIRE(compareFiles(sourceFilename, target));
+        }
+    }
+
+    SECTION("Copy directory tree") {
+        const std::string sourceDirectory = "source_tree";
+        const std::string targetDirectory = "target_tree";
+        fs::remove_all(sourceDirectory);
+        fs::remove_all(targetDirectory);
+
+        fs::create_directories(sourceDirectory + "/small/nested");
+        for (int i = 0; i < 500; ++i) {
+            createFile(sourceDirectory + "/small/file" + std::to_string(i), 1 + i * 7);
+        }
+        createFile(sourceDirectory + "/small/nested/empty", 0);
+        createFile(sourceDirectory + "/large", 10 * 1024 * 1024 + 4321);
+        {
+            REQUIRE_NOTHROW(sharedMemoryLaunch(sourceDirectory, targetDirectory, false, {"--recursive", "--chunk-size=1M"}));
+        }
+
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(sourceDirectory)) {
+            const fs::path target = targetDirectory / fs::relative(entry.path(), sourceDirectory);
+            REQUIRE(fs::exists(target));
+            if (entry.is_regular_file()) {
+                REQUIRE(fs::file_size(entry.path()) == fs::file_size(target));
+                REQUIRE(compareFiles(entry.path().string(), target.string()));
+            }
+        }
+
+        fs::remove_all(sourceDirectory);
+        fs::remove_all(targetDirectory);
+    }
+
+    SECTION("Directory copy does not write through links it created") {
+        const std::string targetDirectory = "target_tree";
+        const std::string outside = fs::absolute("outside_tree").string();
+        fs::remove_all(targetDirectory);
+        fs::remove_all(outside);
+        fs::create_directories(outside);
+        createFile(outside + "/victim", 1024);
+
+        // A link followed by a file below it or in its place, as a reader could send them
+        auto pack = [](std::string& chunk, cp::ETreeRecordType type, const std::string& path, const std::string& payload) {
+            cp::TreeRecordHeader header{};
+            header.magic = cp::TREE_RECORD_MAGIC;
+            header.type = type;
+            header.pathLength = static_cast<std::uint16_t>(path.size());
+            header.mode = 0644;
+            header.fileSize = type == cp::ETreeRecordType::E_File ? payload.size() : 0;
+            header.length = payload.size();
+            std::string record(cp::treeRecordSize(path.size(), payload.size()), '\0');
+            std::memcpy(record.data(), &header, sizeof(header));
+            std::memcpy(record.data() + sizeof(header), path.data(), path.size());
+            std::memcpy(record.data() + sizeof(header) + path.size(), payload.data(), payload.size());
+            chunk += record;
+        };
+        for (const auto& [link, linkTarget, file] : {std::tuple{"a", outside, "a/victim"}, std::tuple{"x", outside + "/victim", "x"}}) {
+            std::string chunk;
+            pack(chunk, cp::ETreeRecordType::E_Symlink, link, linkTarget);
+            pack(chunk, cp::ETreeRecordType::E_File, file, "overwritten");
+            cp::DirectoryDestination destination(targetDirectory, 2, cp::EDurability::E_None);
+            REQUIRE_THROWS_AS(destination.writeChunk(chunk), std::runtime_error);
+            REQUIRE(fs::is_symlink(targetDirectory + "/" + link));
+        }
+        REQUIRE(fs::file_size(outside + "/victim") == 1024);
+
+        fs::remove_all(targetDirectory);
+        fs::remove_all(outside);
+    }
+
     // Clean up test files
     std::remove(sourceFilename.c_str());
     std::remove(targetFilename.c_str());